@@ -0,0 +1,284 @@
+#ifndef ALARMS_H
+#define ALARMS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "dispatch.h"
+#include "metrics.h"
+
+/**
+* Stateful alarm correlation for the MDP. Every alarm command of every vehicle
+* is a cell of a table kept as a structure of arrays, one row of cells per
+* link, so updating an alarm touches a handful of words and a report walks
+* each aggregate as a contiguous array. A cell counts the frames raising its
+* alarm overall and within a sliding window, when it was first and last seen,
+* and how often it was raised by a frame after one of its vehicle without it.
+* An alarm raised ALARM_FLAP_RAISES times within the window is flapping.
+*
+* The window is a ring of ALARM_BUCKETS counts, each covering a slice of the
+* window, which a cell slides forward lazily when it is next updated, so no
+* history is ever rescanned. Frames without alarms of vehicles without raised
+* alarms cost a single test; the clock is only read for frames raising or
+* clearing an alarm, from the coarse monotonic clock.
+*
+* @author Vincent Nigro
+* @version 0.0.2
+*/
+
+#define ALARM_BUCKETS 16
+#define ALARM_FLAP_RAISES 3
+#define ALARM_DEFAULT_WINDOW 10
+#define ALARM_INITIAL_VEHICLES 64
+
+/**
+* The alarm state of every vehicle. The raised mask of a vehicle holds the
+* alarms of its last frame; every other array is indexed by the cell of an
+* alarm of a vehicle, vehicle * alarms + alarm, the buckets and raise times of
+* a cell following one another.
+*/
+struct alarmTable
+{
+    unsigned int alarms;
+    unsigned int vehicles;
+    unsigned long start;
+    unsigned long window;
+    unsigned long width;
+    unsigned long *raised;
+    unsigned long *frames;
+    unsigned long *raises;
+    unsigned long *firstSeen;
+    unsigned long *lastSeen;
+    unsigned long *epochs;
+    unsigned int *windowed;
+    unsigned int *buckets;
+    unsigned long *raiseTimes;
+};
+
+struct alarmTable alarmTable;
+
+unsigned long alarmNow();
+void alarmInit(double);
+void alarmGrow(unsigned int);
+void alarmApply(unsigned int, unsigned long);
+void alarmSlide(size_t, unsigned long);
+int alarmFlapping(size_t, unsigned long);
+void alarmReport();
+
+/**
+* Returns the coarse monotonic clock in nanoseconds, which is read without
+* waiting on the timestamp counter.
+*
+* @return unsigned long
+*/
+unsigned long alarmNow()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    return now.tv_sec * 1000000000UL + now.tv_nsec;
+}
+
+/**
+* Sets up the table for the alarm commands of the dispatch table over a
+* sliding window of the given number of seconds.
+*
+* @param seconds
+* @return void
+*/
+void alarmInit(double seconds)
+{
+    memset(&alarmTable, 0, sizeof(alarmTable));
+
+    alarmTable.alarms = dispatchAlarmCount;
+    alarmTable.window = seconds * 1e9;
+    alarmTable.width = alarmTable.window / ALARM_BUCKETS > 0 ? alarmTable.window / ALARM_BUCKETS : 1;
+    alarmTable.start = alarmNow();
+
+    if (alarmTable.alarms > 0)
+        alarmGrow(ALARM_INITIAL_VEHICLES);
+}
+
+/**
+* Grows the table to hold the rows of vehicles up to and including the given
+* one, doubling its size so rows are added in amortized constant time.
+*
+* @param vehicle
+* @return void
+*/
+void alarmGrow(unsigned int vehicle)
+{
+    struct alarmTable *t = &alarmTable;
+    unsigned int vehicles = t->vehicles > 0 ? t->vehicles : 1;
+    size_t cells, old = (size_t)t->vehicles * t->alarms;
+
+    while (vehicles <= vehicle)
+        vehicles *= 2;
+
+    cells = (size_t)vehicles * t->alarms;
+
+    if ((t->raised = realloc(t->raised, vehicles * sizeof(*t->raised))) == NULL ||
+        (t->frames = realloc(t->frames, cells * sizeof(*t->frames))) == NULL ||
+        (t->raises = realloc(t->raises, cells * sizeof(*t->raises))) == NULL ||
+        (t->firstSeen = realloc(t->firstSeen, cells * sizeof(*t->firstSeen))) == NULL ||
+        (t->lastSeen = realloc(t->lastSeen, cells * sizeof(*t->lastSeen))) == NULL ||
+        (t->epochs = realloc(t->epochs, cells * sizeof(*t->epochs))) == NULL ||
+        (t->windowed = realloc(t->windowed, cells * sizeof(*t->windowed))) == NULL ||
+        (t->buckets = realloc(t->buckets, cells * ALARM_BUCKETS * sizeof(*t->buckets))) == NULL ||
+        (t->raiseTimes = realloc(t->raiseTimes, cells * ALARM_FLAP_RAISES * sizeof(*t->raiseTimes))) == NULL)
+    {
+        printf("Unable to allocate alarm state: %s.\n", strerror(errno));
+        exit(1);
+    }
+
+    memset(t->raised + t->vehicles, 0, (vehicles - t->vehicles) * sizeof(*t->raised));
+    memset(t->frames + old, 0, (cells - old) * sizeof(*t->frames));
+    memset(t->raises + old, 0, (cells - old) * sizeof(*t->raises));
+    memset(t->firstSeen + old, 0, (cells - old) * sizeof(*t->firstSeen));
+    memset(t->lastSeen + old, 0, (cells - old) * sizeof(*t->lastSeen));
+    memset(t->epochs + old, 0, (cells - old) * sizeof(*t->epochs));
+    memset(t->windowed + old, 0, (cells - old) * sizeof(*t->windowed));
+    memset(t->buckets + old * ALARM_BUCKETS, 0, (cells - old) * ALARM_BUCKETS * sizeof(*t->buckets));
+    memset(t->raiseTimes + old * ALARM_FLAP_RAISES, 0,
+        (cells - old) * ALARM_FLAP_RAISES * sizeof(*t->raiseTimes));
+
+    t->vehicles = vehicles;
+}
+
+/**
+* Accounts for the alarms raised by a major frame of a vehicle. Only frames
+* raising an alarm, or following one that did, are looked at any further.
+*
+* @param vehicle
+* @param alarms
+* @return void
+*/
+static inline void alarmUpdate(unsigned int vehicle, unsigned long alarms)
+{
+    if (vehicle < alarmTable.vehicles ? (alarms | alarmTable.raised[vehicle]) != 0 : alarms != 0)
+        alarmApply(vehicle, alarms);
+}
+
+/**
+* Updates the cells of the alarms raised by a major frame of a vehicle and
+* counts the alarms raised again since its previous frame.
+*
+* @param vehicle
+* @param alarms
+* @return void
+*/
+void alarmApply(unsigned int vehicle, unsigned long alarms)
+{
+    size_t cell;
+    unsigned long now, epoch, rising;
+    struct alarmTable *t = &alarmTable;
+
+    if (vehicle >= t->vehicles)
+        alarmGrow(vehicle);
+
+    now = alarmNow() - t->start;
+    epoch = now / t->width;
+    rising = alarms & ~t->raised[vehicle];
+    t->raised[vehicle] = alarms;
+
+    for (unsigned long pending = alarms; pending != 0; pending &= pending - 1)
+    {
+        cell = (size_t)vehicle * t->alarms + __builtin_ctzl(pending);
+
+        if (t->frames[cell]++ == 0)
+            t->firstSeen[cell] = now;
+
+        t->lastSeen[cell] = now;
+
+        alarmSlide(cell, epoch);
+        t->buckets[cell * ALARM_BUCKETS + epoch % ALARM_BUCKETS]++;
+        t->windowed[cell]++;
+
+        if (rising & (pending & -pending))
+        {
+            t->raiseTimes[cell * ALARM_FLAP_RAISES + t->raises[cell]++ % ALARM_FLAP_RAISES] = now;
+            metricAdd(METRIC_ALARM_RAISES, 1);
+
+            if (alarmFlapping(cell, now))
+                metricAdd(METRIC_ALARM_FLAPS, 1);
+        }
+    }
+}
+
+/**
+* Slides the window of a cell forward to the given bucket epoch, dropping the
+* counts of the buckets that fall out of it.
+*
+* @param cell
+* @param epoch
+* @return void
+*/
+void alarmSlide(size_t cell, unsigned long epoch)
+{
+    struct alarmTable *t = &alarmTable;
+    unsigned int *buckets = &t->buckets[cell * ALARM_BUCKETS];
+
+    for (unsigned long e = t->epochs[cell] + 1; e <= epoch && e <= t->epochs[cell] + ALARM_BUCKETS; e++)
+    {
+        t->windowed[cell] -= buckets[e % ALARM_BUCKETS];
+        buckets[e % ALARM_BUCKETS] = 0;
+    }
+
+    if (epoch > t->epochs[cell])
+        t->epochs[cell] = epoch;
+}
+
+/**
+* Returns whether the alarm of a cell has been raised ALARM_FLAP_RAISES times
+* within the window ending at the given time.
+*
+* @param cell
+* @param now
+* @return int
+*/
+int alarmFlapping(size_t cell, unsigned long now)
+{
+    const struct alarmTable *t = &alarmTable;
+    unsigned long raises = t->raises[cell];
+
+    // The oldest remembered raise is overwritten by the next one
+    return raises >= ALARM_FLAP_RAISES &&
+        now - t->raiseTimes[cell * ALARM_FLAP_RAISES + raises % ALARM_FLAP_RAISES] <= t->window;
+}
+
+/**
+* Prints the aggregates of every alarm seen for every vehicle, the window
+* ending now.
+*
+* @return void
+*/
+void alarmReport()
+{
+    size_t cell;
+    struct alarmTable *t = &alarmTable;
+    unsigned long now = alarmNow() - t->start, span;
+
+    for (unsigned int vehicle = 0; vehicle < t->vehicles; vehicle++)
+    {
+        for (unsigned int alarm = 0; alarm < t->alarms; alarm++)
+        {
+            if (t->frames[cell = (size_t)vehicle * t->alarms + alarm] == 0)
+                continue;
+
+            alarmSlide(cell, now / t->width);
+
+            // Alarms first seen within the window are rated over their lifetime
+            span = now - t->firstSeen[cell] < t->window ? now - t->firstSeen[cell] : t->window;
+
+            printf("Spacecraft %u %s: %lu frames, %u in the last %.1f s (%.2f/s), first seen %.3f s, "
+                "last seen %.3f s, raised %lu times%s.\n", vehicle, dispatchAlarmCommands[alarm]->name,
+                t->frames[cell], t->windowed[cell], t->window / 1e9,
+                span > 0 ? t->windowed[cell] / (span / 1e9) : 0.0, t->firstSeen[cell] / 1e9,
+                t->lastSeen[cell] / 1e9, t->raises[cell], alarmFlapping(cell, now) ? ", flapping" : "");
+        }
+    }
+}
+
+#endif
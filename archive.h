@@ -0,0 +1,1117 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "commands.h"
+#include "columnar.h"
+#include "index.h"
+
+/**
+* Telemetry archive segments shared among mdp.c and simulator.c. A segment is
+* a preallocated file mapped into memory holding a header followed by fixed
+* size records, each made of the receive timestamp, the link and frame
+* sequence numbers and the raw major frame. The recorder appends frames by
+* copying them from the receive buffer straight into the mapping, so recording
+* costs no system calls until a segment fills or reaches its time limit and is
+* rolled over to the next file.
+*
+* Compressed segments hold the same records in blocks of up to
+* ARCHIVE_BLOCK_FRAMES. The recorder stages a block column by column, one
+* column per word of the record, and encodes each column with the column codec
+* once the block fills, the segment rolls over, recording stops or its first
+* frame has been staged for ARCHIVE_FLUSH_NS; a flusher thread enforces the
+* last for links gone quiet, so staged frames are at most that old when they
+* become readable, and at most that much is lost when the MDP dies. Readers
+* decode a block at a time back into records, finding the block of a record
+* from the frame counts of the block headers before it.
+*
+* Each sealed segment is written a sparse index of its blocks, which raw
+* segments are cut into every ARCHIVE_BLOCK_FRAMES records.
+*
+* @author Vincent Nigro
+* @version 0.0.2
+*/
+
+#define ARCHIVE_MAGIC "TLMSEG01"
+#define ARCHIVE_VERSION 1
+#define ARCHIVE_COLUMNAR_VERSION 2
+#define ARCHIVE_NAME_FORMAT "%s/segment-%06u.tlm"
+#define ARCHIVE_PATH_BYTES 4096
+#define ARCHIVE_SEGMENT_BYTES (64UL * 1024 * 1024)
+#define ARCHIVE_BLOCK_FRAMES 4096
+#define ARCHIVE_FLUSH_NS 1000000000UL
+#define ARCHIVE_RECORD_WORDS (sizeof(struct archiveRecord) / sizeof(unsigned long))
+
+/**
+* The first bytes of every segment. The count is published after the records
+* it covers are written, so a segment can be read while it is being recorded,
+* up to the frames still staged for its next block when compressed.
+* The capacity of a compressed segment counts the bytes available to blocks
+* and bytes those already used.
+*/
+struct archiveHeader
+{
+    char magic[8];
+    unsigned int version;
+    unsigned int frameBytes;
+    unsigned int recordBytes;
+    unsigned int segment;
+    unsigned long capacity;
+    atomic_ulong count;
+    unsigned long firstNs;
+    unsigned long lastNs;
+    unsigned long bytes;
+};
+
+struct archiveRecord
+{
+    unsigned long timestampNs;
+    unsigned long seq;
+    unsigned int link;
+    unsigned int length;
+    char frame[];
+};
+
+_Static_assert(ARCHIVE_RECORD_WORDS == INDEX_FRAME_WORD && ARCHIVE_BLOCK_FRAMES == INDEX_BLOCK_FRAMES,
+    "archive blocks and records must match their index");
+
+/**
+* Precedes the columns of every block of a compressed segment; bytes counts
+* the block with this header.
+*/
+struct archiveBlock
+{
+    unsigned int frames;
+    unsigned int bytes;
+};
+
+/**
+* The state of a recorder. A compressed recorder is shared with its flusher
+* thread, each holding the lock while touching it; stagedNs is when the first
+* frame of the staged block arrived.
+*/
+struct recorder
+{
+    char dir[ARCHIVE_PATH_BYTES];
+    unsigned int segment;
+    unsigned int segments;
+    size_t segmentBytes;
+    unsigned long segmentNs;
+    unsigned long openedNs;
+    unsigned long recorded;
+    char *map;
+    size_t mapBytes;
+    int fd;
+    struct archiveHeader *header;
+    unsigned long *columns;
+    size_t staged;
+    unsigned long stagedNs;
+    int indexing;
+    struct indexEntry *entries;
+    size_t blocks;
+    size_t entrySlots;
+    pthread_t flusher;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int stopping;
+};
+
+/**
+* A segment mapped for reading. Compressed segments also keep the offset and
+* first record of the blocks walked so far, where the next block starts, and
+* the records of the last block decoded.
+*/
+struct archiveSegment
+{
+    char *map;
+    size_t mapBytes;
+    struct archiveHeader *header;
+    size_t *blocks;
+    unsigned long *firsts;
+    size_t indexed;
+    size_t slots;
+    size_t nextOffset;
+    unsigned long nextFirst;
+    size_t decoded;
+    unsigned long decodedFirst;
+    unsigned long decodedFrames;
+    unsigned long *columns;
+    char *records;
+};
+
+/**
+* Every segment of an archive directory mapped for reading, in recording order.
+*/
+struct archiveSet
+{
+    size_t count;
+    unsigned long records;
+    struct archiveSegment *segments;
+};
+
+size_t archiveRecordBytes(size_t);
+unsigned long archiveNow();
+int recorderOpen(struct recorder*, const char*, size_t, unsigned long, int);
+int recorderRoll(struct recorder*, unsigned long);
+void recorderSeal(struct recorder*);
+void recorderAppend(struct recorder*, unsigned int, unsigned long, const char*, size_t);
+void recorderStage(struct recorder*, unsigned int, unsigned long, const char*, size_t, unsigned long);
+int recorderFlush(struct recorder*);
+void *recorderFlusher(void*);
+void recorderClose(struct recorder*);
+void recorderIndex(struct recorder*, const unsigned long*, size_t, size_t, size_t);
+void recorderWriteIndex(struct recorder*);
+int archiveMapSegment(struct archiveSegment*, const char*);
+void archiveUnmapSegment(struct archiveSegment*);
+struct archiveRecord *archiveRecordAt(struct archiveSegment*, unsigned long);
+int archiveRecordCached(const struct archiveSegment*, unsigned long);
+unsigned long archiveBlockFrames(struct archiveSegment*, unsigned long);
+long archiveFindBlock(struct archiveSegment*, unsigned long);
+int archiveDecodeBlock(struct archiveSegment*, size_t);
+int archiveOpenIndex(struct segmentIndex*, struct archiveSegment*, const char*);
+int archiveIndexSegment(struct segmentIndex*, struct archiveSegment*);
+int archiveSegmentName(const struct dirent*);
+int archiveOpenSet(struct archiveSet*, const char*);
+void archiveCloseSet(struct archiveSet*);
+
+/**
+* Returns the record size for frames of the given size, padded to whole words.
+*
+* @param frameBytes
+* @return size_t
+*/
+size_t archiveRecordBytes(size_t frameBytes)
+{
+    return (sizeof(struct archiveRecord) + frameBytes + 7) & ~(size_t)7;
+}
+
+/**
+* Returns the wall clock time in nanoseconds; served by the vDSO without a
+* system call.
+*
+* @return unsigned long
+*/
+unsigned long archiveNow()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    return now.tv_sec * 1000000000UL + now.tv_nsec;
+}
+
+/**
+* Starts recording into the directory, continuing after the highest numbered
+* segment already present. Segments roll over once segmentBytes are used or,
+* when segmentSeconds is not zero, once they have been open that long. The
+* segments are compressed when columnar is set, with a flusher thread writing
+* out blocks staged for ARCHIVE_FLUSH_NS.
+*
+* @param rec
+* @param dir
+* @param segmentBytes
+* @param segmentSeconds
+* @param columnar
+* @return int
+*/
+int recorderOpen(struct recorder *rec, const char *dir, size_t segmentBytes, unsigned long segmentSeconds,
+    int columnar)
+{
+    DIR *d;
+    unsigned int index;
+    struct dirent *entry;
+
+    memset(rec, 0, sizeof(*rec));
+    rec->fd = -1;
+    rec->segmentBytes = segmentBytes;
+    rec->segmentNs = segmentSeconds * 1000000000UL;
+    snprintf(rec->dir, sizeof(rec->dir), "%s", dir);
+
+    // A block is staged as one column per word of its records
+    if (columnar && (rec->columns = malloc((ARCHIVE_RECORD_WORDS + frameGeometry.frameSize) *
+        ARCHIVE_BLOCK_FRAMES * sizeof(*rec->columns))) == NULL)
+        return -1;
+
+    if (mkdir(dir, 0755) == -1 && errno != EEXIST)
+        return -1;
+
+    if ((d = opendir(dir)) == NULL)
+        return -1;
+
+    while ((entry = readdir(d)) != NULL)
+    {
+        if (sscanf(entry->d_name, "segment-%u.tlm", &index) == 1 && index >= rec->segment)
+            rec->segment = index + 1;
+    }
+    closedir(d);
+
+    if (recorderRoll(rec, archiveNow()) == -1)
+        return -1;
+
+    pthread_mutex_init(&rec->lock, NULL);
+    pthread_cond_init(&rec->wake, NULL);
+
+    if (rec->columns != NULL && (errno = pthread_create(&rec->flusher, NULL, recorderFlusher, rec)) != 0)
+        return -1;
+
+    return 0;
+}
+
+/**
+* Seals the current segment, if any, and maps a freshly preallocated one.
+*
+* @param rec
+* @param now
+* @return int
+*/
+int recorderRoll(struct recorder *rec, unsigned long now)
+{
+    int error;
+    char path[ARCHIVE_PATH_BYTES + 32];
+    size_t recordBytes = archiveRecordBytes(frameGeometry.frameBytes);
+
+    recorderSeal(rec);
+
+    snprintf(path, sizeof(path), ARCHIVE_NAME_FORMAT, rec->dir, rec->segment);
+
+    if ((rec->fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644)) == -1)
+        return -1;
+
+    rec->mapBytes = rec->segmentBytes;
+
+    // Reserves the blocks up front so appends never fault on a full disk
+    if ((errno = posix_fallocate(rec->fd, 0, rec->mapBytes)) == 0 &&
+        (rec->map = mmap(NULL, rec->mapBytes, PROT_READ | PROT_WRITE, MAP_SHARED, rec->fd, 0)) == MAP_FAILED)
+        rec->map = NULL;
+
+    // A segment that cannot be mapped is never left behind empty
+    if (rec->map == NULL)
+    {
+        error = errno;
+        close(rec->fd);
+        unlink(path);
+        rec->fd = -1;
+        errno = error;
+        return -1;
+    }
+
+    rec->header = (struct archiveHeader *)rec->map;
+    memcpy(rec->header->magic, ARCHIVE_MAGIC, sizeof(rec->header->magic));
+    rec->header->version = rec->columns != NULL ? ARCHIVE_COLUMNAR_VERSION : ARCHIVE_VERSION;
+    rec->header->frameBytes = frameGeometry.frameBytes;
+    rec->header->recordBytes = recordBytes;
+    rec->header->segment = rec->segment;
+    rec->header->capacity = (rec->mapBytes - sizeof(struct archiveHeader)) / (rec->columns != NULL ? 1 : recordBytes);
+    rec->header->bytes = 0;
+    atomic_store_explicit(&rec->header->count, 0, memory_order_release);
+
+    rec->indexing = 1;
+    rec->openedNs = now;
+    rec->segment++;
+    rec->segments++;
+
+    return 0;
+}
+
+/**
+* Writes the index of the current segment, unmaps it and trims its file to the
+* records or blocks written. Frames still staged are kept for the next segment.
+*
+* @param rec
+* @return void
+*/
+void recorderSeal(struct recorder *rec)
+{
+    size_t used, tail;
+
+    if (rec->map == NULL)
+        return;
+
+    // The records after the last full block of a raw segment make its last block
+    if (rec->columns == NULL && (tail = rec->header->count % ARCHIVE_BLOCK_FRAMES) != 0)
+        recorderIndex(rec, (const unsigned long *)(rec->map + sizeof(struct archiveHeader) +
+            (rec->header->count - tail) * rec->header->recordBytes), rec->header->recordBytes / sizeof(unsigned long),
+            1, tail);
+
+    recorderWriteIndex(rec);
+
+    used = sizeof(struct archiveHeader) + (rec->columns != NULL ? rec->header->bytes :
+        rec->header->count * rec->header->recordBytes);
+
+    munmap(rec->map, rec->mapBytes);
+    ftruncate(rec->fd, used);
+    close(rec->fd);
+
+    rec->map = NULL;
+    rec->header = NULL;
+    rec->fd = -1;
+}
+
+/**
+* Appends a run of major frames received on a link, numbering them from seq.
+* All frames of the run share the receive timestamp.
+*
+* @param rec
+* @param link
+* @param seq
+* @param frames
+* @param count
+* @return void
+*/
+void recorderAppend(struct recorder *rec, unsigned int link, unsigned long seq,
+    const char *frames, size_t count)
+{
+    unsigned long now = archiveNow(), written;
+    size_t frameBytes = frameGeometry.frameBytes;
+    struct archiveRecord *record;
+
+    // The flusher may seal a compressed segment, so its state is only read locked
+    if (rec->columns != NULL)
+    {
+        pthread_mutex_lock(&rec->lock);
+        recorderStage(rec, link, seq, frames, count, now);
+        pthread_mutex_unlock(&rec->lock);
+        return;
+    }
+
+    if (rec->map == NULL)
+        return;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        written = atomic_load_explicit(&rec->header->count, memory_order_relaxed);
+
+        if (written == rec->header->capacity ||
+            (rec->segmentNs && written > 0 && now - rec->openedNs >= rec->segmentNs))
+        {
+            if (recorderRoll(rec, now) == -1)
+            {
+                printf("Unable to roll archive segment: %s, recording stopped.\n", strerror(errno));
+                recorderSeal(rec);
+                return;
+            }
+            written = 0;
+        }
+
+        record = (struct archiveRecord *)(rec->map + sizeof(struct archiveHeader) +
+            written * rec->header->recordBytes);
+        record->timestampNs = now;
+        record->seq = seq + i;
+        record->link = link;
+        record->length = frameBytes;
+        memcpy(record->frame, frames + i * frameBytes, frameBytes);
+
+        if (written == 0)
+            rec->header->firstNs = now;
+
+        rec->header->lastNs = now;
+        atomic_store_explicit(&rec->header->count, written + 1, memory_order_release);
+        rec->recorded++;
+
+        if ((written + 1) % ARCHIVE_BLOCK_FRAMES == 0)
+            recorderIndex(rec, (const unsigned long *)(rec->map + sizeof(struct archiveHeader) +
+                (written + 1 - ARCHIVE_BLOCK_FRAMES) * rec->header->recordBytes),
+                rec->header->recordBytes / sizeof(unsigned long), 1, ARCHIVE_BLOCK_FRAMES);
+    }
+}
+
+/**
+* Stages a run of major frames received on a link into the columns of the
+* current block, transposing the frames into their columns, and encodes the
+* block whenever it fills or has been staged for ARCHIVE_FLUSH_NS. Called with
+* the lock of the recorder held.
+*
+* @param rec
+* @param link
+* @param seq
+* @param frames
+* @param count
+* @param now
+* @return void
+*/
+void recorderStage(struct recorder *rec, unsigned int link, unsigned long seq, const char *frames,
+    size_t count, unsigned long now)
+{
+    size_t n, frameBytes = frameGeometry.frameBytes;
+    unsigned long *columns = rec->columns, linkLength = link | (unsigned long)frameBytes << 32;
+
+    for (size_t done = 0; done < count; done += n)
+    {
+        if (rec->map == NULL)
+            return;
+
+        if (rec->segmentNs && rec->header->count + rec->staged > 0 && now - rec->openedNs >= rec->segmentNs &&
+            (recorderFlush(rec) == -1 || recorderRoll(rec, now) == -1))
+        {
+            printf("Unable to roll archive segment: %s, recording stopped.\n", strerror(errno));
+            recorderSeal(rec);
+            return;
+        }
+
+        if (rec->staged > 0 && now - rec->stagedNs >= ARCHIVE_FLUSH_NS && recorderFlush(rec) == -1)
+        {
+            printf("Unable to write archive block: %s, recording stopped.\n", strerror(errno));
+            recorderSeal(rec);
+            return;
+        }
+
+        if (rec->staged == 0)
+            rec->stagedNs = now;
+
+        n = count - done < ARCHIVE_BLOCK_FRAMES - rec->staged ? count - done : ARCHIVE_BLOCK_FRAMES - rec->staged;
+
+        for (size_t i = 0; i < n; i++)
+        {
+            columns[rec->staged + i] = now;
+            columns[ARCHIVE_BLOCK_FRAMES + rec->staged + i] = seq + done + i;
+            columns[2 * ARCHIVE_BLOCK_FRAMES + rec->staged + i] = linkLength;
+        }
+
+        columnTranspose((const uint64_t *)(frames + done * frameBytes), frameGeometry.frameSize,
+            &columns[ARCHIVE_RECORD_WORDS * ARCHIVE_BLOCK_FRAMES + rec->staged], ARCHIVE_BLOCK_FRAMES, n,
+            frameGeometry.frameSize);
+
+        rec->staged += n;
+        rec->recorded += n;
+
+        if (rec->staged == ARCHIVE_BLOCK_FRAMES && recorderFlush(rec) == -1)
+        {
+            printf("Unable to write archive block: %s, recording stopped.\n", strerror(errno));
+            recorderSeal(rec);
+            return;
+        }
+    }
+}
+
+/**
+* Encodes the staged frames as a block of the current segment and publishes
+* them, rolling over to a new segment first when the block may not fit.
+* Returns -1 with errno set when no segment can take the block.
+*
+* @param rec
+* @return int
+*/
+int recorderFlush(struct recorder *rec)
+{
+    char *out;
+    struct archiveBlock block;
+    size_t words = ARCHIVE_RECORD_WORDS + frameGeometry.frameSize;
+    size_t bound = sizeof(block) + words * columnBound(rec->staged);
+
+    if (rec->staged == 0)
+        return 0;
+
+    // A block too large for an empty segment never fits
+    if (bound > rec->header->capacity)
+    {
+        errno = EFBIG;
+        return -1;
+    }
+
+    if (rec->header->bytes + bound > rec->header->capacity && recorderRoll(rec, archiveNow()) == -1)
+        return -1;
+
+    recorderIndex(rec, rec->columns, 1, ARCHIVE_BLOCK_FRAMES, rec->staged);
+
+    out = rec->map + sizeof(struct archiveHeader) + rec->header->bytes;
+    block.frames = rec->staged;
+    block.bytes = sizeof(block);
+
+    for (size_t c = 0; c < words; c++)
+        block.bytes += columnEncode(&rec->columns[c * ARCHIVE_BLOCK_FRAMES], rec->staged, out + block.bytes);
+
+    memcpy(out, &block, sizeof(block));
+
+    if (rec->header->count == 0)
+        rec->header->firstNs = rec->columns[0];
+
+    rec->header->lastNs = rec->columns[rec->staged - 1];
+    rec->header->bytes += block.bytes;
+    atomic_store_explicit(&rec->header->count, rec->header->count + rec->staged, memory_order_release);
+    rec->staged = 0;
+
+    return 0;
+}
+
+/**
+* Flusher thread of a compressed recorder. Wakes every tenth of
+* ARCHIVE_FLUSH_NS and encodes the staged block once its first frame has
+* waited that long, so frames of links gone quiet are not held back.
+*
+* @param arg
+* @return void*
+*/
+void *recorderFlusher(void *arg)
+{
+    struct timespec deadline;
+    struct recorder *rec = arg;
+
+    pthread_mutex_lock(&rec->lock);
+
+    while (!rec->stopping)
+    {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += ARCHIVE_FLUSH_NS / 10;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+
+        pthread_cond_timedwait(&rec->wake, &rec->lock, &deadline);
+
+        if (rec->map != NULL && rec->staged > 0 && archiveNow() - rec->stagedNs >= ARCHIVE_FLUSH_NS &&
+            recorderFlush(rec) == -1)
+        {
+            printf("Unable to write archive block: %s, recording stopped.\n", strerror(errno));
+            recorderSeal(rec);
+        }
+    }
+    pthread_mutex_unlock(&rec->lock);
+
+    return NULL;
+}
+
+/**
+* Stops the flusher, encodes any staged frames, seals the current segment and
+* stops recording.
+*
+* @param rec
+* @return void
+*/
+void recorderClose(struct recorder *rec)
+{
+    if (rec->columns != NULL)
+    {
+        pthread_mutex_lock(&rec->lock);
+        rec->stopping = 1;
+        pthread_cond_signal(&rec->wake);
+        pthread_mutex_unlock(&rec->lock);
+        pthread_join(rec->flusher, NULL);
+    }
+
+    if (rec->map != NULL && rec->columns != NULL && recorderFlush(rec) == -1)
+        printf("Unable to write archive block: %s.\n", strerror(errno));
+
+    recorderSeal(rec);
+    free(rec->columns);
+    free(rec->entries);
+    rec->columns = NULL;
+    rec->entries = NULL;
+}
+
+/**
+* Adds the index entry of the next block of the current segment, laid out as
+* indexBlock expects. A segment whose entries cannot be kept goes unindexed.
+*
+* @param rec
+* @param records
+* @param recordStride
+* @param wordStride
+* @param count
+* @return void
+*/
+void recorderIndex(struct recorder *rec, const unsigned long *records, size_t recordStride, size_t wordStride,
+    size_t count)
+{
+    struct indexEntry *entries;
+
+    if (!rec->indexing)
+        return;
+
+    if (rec->blocks == rec->entrySlots)
+    {
+        if ((entries = realloc(rec->entries, (rec->entrySlots + 64) * 2 * sizeof(*entries))) == NULL)
+        {
+            printf("Unable to index archive segment %u: %s.\n", rec->header->segment, strerror(errno));
+            rec->indexing = 0;
+            return;
+        }
+        rec->entries = entries;
+        rec->entrySlots = (rec->entrySlots + 64) * 2;
+    }
+
+    indexBlock(&rec->entries[rec->blocks++], records, recordStride, wordStride, count);
+}
+
+/**
+* Writes the index of the current segment next to it and starts the entries
+* of the next one.
+*
+* @param rec
+* @return void
+*/
+void recorderWriteIndex(struct recorder *rec)
+{
+    char path[ARCHIVE_PATH_BYTES + 32];
+    struct indexHeader header = { INDEX_MAGIC, rec->header->segment, ARCHIVE_BLOCK_FRAMES,
+        frameGeometry.headerWidth, frameGeometry.trailerWords, rec->header->count, rec->blocks,
+        rec->header->firstNs, rec->header->lastNs, indexFingerprint };
+
+    snprintf(path, sizeof(path), INDEX_NAME_FORMAT, rec->dir, rec->header->segment);
+
+    if (rec->indexing && indexWrite(path, &header, rec->entries) == -1)
+        printf("Unable to write archive index %s: %s.\n", path, strerror(errno));
+
+    rec->indexing = 0;
+    rec->blocks = 0;
+}
+
+/**
+* Maps an archive segment for reading. Returns zero on success and -1 with
+* errno set on failure, EINVAL marking a file that is not a segment or a raw
+* segment whose records do not fit the file.
+*
+* @param seg
+* @param path
+* @return int
+*/
+int archiveMapSegment(struct archiveSegment *seg, const char *path)
+{
+    int fd;
+    struct stat st;
+
+    memset(seg, 0, sizeof(*seg));
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+        return -1;
+
+    if (fstat(fd, &st) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+
+    if ((size_t)st.st_size < sizeof(struct archiveHeader))
+    {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    seg->mapBytes = st.st_size;
+    seg->map = mmap(NULL, seg->mapBytes, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (seg->map == MAP_FAILED)
+    {
+        seg->map = NULL;
+        return -1;
+    }
+
+    seg->header = (struct archiveHeader *)seg->map;
+
+    // Records of a raw segment are addressed straight from its header
+    if (memcmp(seg->header->magic, ARCHIVE_MAGIC, sizeof(seg->header->magic)) != 0 ||
+        (seg->header->version != ARCHIVE_VERSION && seg->header->version != ARCHIVE_COLUMNAR_VERSION) ||
+        seg->header->frameBytes > FRAME_MAX_SIZE * sizeof(unsigned long) ||
+        seg->header->recordBytes != archiveRecordBytes(seg->header->frameBytes) ||
+        (seg->header->version == ARCHIVE_VERSION && atomic_load_explicit(&seg->header->count, memory_order_acquire) >
+        (seg->mapBytes - sizeof(struct archiveHeader)) / seg->header->recordBytes))
+    {
+        archiveUnmapSegment(seg);
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+* Unmaps an archive segment and frees its decoded block.
+*
+* @param seg
+* @return void
+*/
+void archiveUnmapSegment(struct archiveSegment *seg)
+{
+    if (seg->map != NULL)
+        munmap(seg->map, seg->mapBytes);
+
+    free(seg->blocks);
+    free(seg->firsts);
+    free(seg->columns);
+    free(seg->records);
+    memset(seg, 0, sizeof(*seg));
+}
+
+/**
+* Returns the record at the given index of a mapped segment. Records of a
+* compressed segment stay valid until a record of another block is asked for;
+* NULL is returned with errno set when the record is not published or its
+* block cannot be decoded.
+*
+* @param seg
+* @param index
+* @return struct archiveRecord*
+*/
+struct archiveRecord *archiveRecordAt(struct archiveSegment *seg, unsigned long index)
+{
+    long block;
+
+    if (seg->header->version == ARCHIVE_VERSION && index >= atomic_load_explicit(&seg->header->count,
+        memory_order_acquire))
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if (seg->header->version == ARCHIVE_VERSION)
+        return (struct archiveRecord *)(seg->map + sizeof(struct archiveHeader) +
+            index * seg->header->recordBytes);
+
+    if (!archiveRecordCached(seg, index) &&
+        ((block = archiveFindBlock(seg, index)) == -1 || archiveDecodeBlock(seg, block) == -1))
+        return NULL;
+
+    return (struct archiveRecord *)(seg->records + (index - seg->decodedFirst) * seg->header->recordBytes);
+}
+
+/**
+* Returns whether the record at the given index is returned by archiveRecordAt
+* without decoding another block, leaving the records returned before valid.
+*
+* @param seg
+* @param index
+* @return int
+*/
+int archiveRecordCached(const struct archiveSegment *seg, unsigned long index)
+{
+    return seg->header->version == ARCHIVE_VERSION ||
+        (seg->records != NULL && index >= seg->decodedFirst && index - seg->decodedFirst < seg->decodedFrames);
+}
+
+/**
+* Returns the number of records of the block starting at record first: up to
+* ARCHIVE_BLOCK_FRAMES of a raw segment, as recorded for a compressed one.
+* Returns zero with errno set when the block cannot be found.
+*
+* @param seg
+* @param first
+* @return unsigned long
+*/
+unsigned long archiveBlockFrames(struct archiveSegment *seg, unsigned long first)
+{
+    long block;
+    unsigned long count = atomic_load_explicit(&seg->header->count, memory_order_acquire);
+
+    if (seg->header->version == ARCHIVE_VERSION)
+        return first >= count ? 0 : count - first < ARCHIVE_BLOCK_FRAMES ? count - first : ARCHIVE_BLOCK_FRAMES;
+
+    if ((block = archiveFindBlock(seg, first)) == -1)
+        return 0;
+
+    return ((size_t)block + 1 < seg->indexed ? seg->firsts[block + 1] : seg->nextFirst) - first;
+}
+
+/**
+* Returns the block of a compressed segment holding the record at the given
+* index, walking the block headers up to it the first time and noting where
+* each block starts and its first record. Returns -1 with errno set when the
+* record is not within the published part of the segment or a block header is
+* corrupt.
+*
+* @param seg
+* @param index
+* @return long
+*/
+long archiveFindBlock(struct archiveSegment *seg, unsigned long index)
+{
+    struct archiveBlock header;
+    size_t *blocks, low = 0, high;
+    unsigned long *firsts, published = atomic_load_explicit(&seg->header->count, memory_order_acquire);
+
+    if (index >= published)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (seg->indexed == 0)
+        seg->nextOffset = sizeof(struct archiveHeader);
+
+    // Blocks are only found by walking the ones before them
+    while (seg->nextFirst <= index)
+    {
+        if (seg->indexed == seg->slots)
+        {
+            if ((blocks = realloc(seg->blocks, (seg->slots + 64) * 2 * sizeof(*blocks))) == NULL)
+                return -1;
+
+            seg->blocks = blocks;
+
+            if ((firsts = realloc(seg->firsts, (seg->slots + 64) * 2 * sizeof(*firsts))) == NULL)
+                return -1;
+
+            seg->firsts = firsts;
+            seg->slots = (seg->slots + 64) * 2;
+        }
+
+        if (seg->nextOffset + sizeof(header) > seg->mapBytes)
+        {
+            errno = EINVAL;
+            return -1;
+        }
+
+        memcpy(&header, seg->map + seg->nextOffset, sizeof(header));
+
+        if (header.bytes < sizeof(header) || header.frames == 0 || header.frames > ARCHIVE_BLOCK_FRAMES ||
+            seg->nextOffset + header.bytes > seg->mapBytes)
+        {
+            errno = EINVAL;
+            return -1;
+        }
+
+        seg->blocks[seg->indexed] = seg->nextOffset;
+        seg->firsts[seg->indexed++] = seg->nextFirst;
+        seg->nextOffset += header.bytes;
+        seg->nextFirst += header.frames;
+    }
+
+    // The last block whose first record is not past the index holds it
+    for (high = seg->indexed; high - low > 1; )
+    {
+        if (seg->firsts[(low + high) / 2] <= index)
+            low = (low + high) / 2;
+        else
+            high = (low + high) / 2;
+    }
+    return low;
+}
+
+/**
+* Decodes a walked block of a compressed segment into its records. Returns -1
+* with errno set when the block is corrupt.
+*
+* @param seg
+* @param block
+* @return int
+*/
+int archiveDecodeBlock(struct archiveSegment *seg, size_t block)
+{
+    struct archiveBlock header;
+    const char *column;
+    size_t words = seg->header->recordBytes / sizeof(unsigned long);
+
+    if (block >= seg->indexed || words < ARCHIVE_RECORD_WORDS)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (seg->records == NULL &&
+        ((seg->columns = malloc(words * ARCHIVE_BLOCK_FRAMES * sizeof(*seg->columns))) == NULL ||
+        (seg->records = malloc(ARCHIVE_BLOCK_FRAMES * seg->header->recordBytes)) == NULL))
+        return -1;
+
+    memcpy(&header, seg->map + seg->blocks[block], sizeof(header));
+    column = seg->map + seg->blocks[block] + sizeof(header);
+
+    // A block that fails to decode leaves none decoded
+    seg->decodedFrames = 0;
+
+    // Columns are only decoded within their block
+    for (size_t c = 0; c < words && column != NULL; c++)
+        column = columnDecode(column, seg->map + seg->blocks[block] + header.bytes, header.frames,
+            &seg->columns[c * ARCHIVE_BLOCK_FRAMES]);
+
+    if (column == NULL)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    columnTranspose(seg->columns, ARCHIVE_BLOCK_FRAMES, (uint64_t *)seg->records, words, words, header.frames);
+    seg->decoded = block;
+    seg->decodedFirst = seg->firsts[block];
+    seg->decodedFrames = header.frames;
+
+    return 0;
+}
+
+/**
+* Opens the index of a segment of the archive directory dir, mapping its file
+* when it covers every published record of the segment with the command codes
+* of the current dictionary and building it in memory otherwise. The frame
+* geometry must be that of the segment. Returns -1 with errno set on failure.
+*
+* @param idx
+* @param seg
+* @param dir
+* @return int
+*/
+int archiveOpenIndex(struct segmentIndex *idx, struct archiveSegment *seg, const char *dir)
+{
+    char path[ARCHIVE_PATH_BYTES + 32];
+
+    snprintf(path, sizeof(path), INDEX_NAME_FORMAT, dir, seg->header->segment);
+
+    if (indexMap(idx, path) == 0)
+    {
+        if (idx->header->segment == seg->header->segment && idx->header->codes == indexFingerprint &&
+            idx->header->records == atomic_load_explicit(&seg->header->count, memory_order_acquire))
+            return 0;
+
+        indexClose(idx);
+    }
+    return archiveIndexSegment(idx, seg);
+}
+
+/**
+* Builds the index of a segment in memory from its published records. Returns
+* -1 with errno set on failure.
+*
+* @param idx
+* @param seg
+* @return int
+*/
+int archiveIndexSegment(struct segmentIndex *idx, struct archiveSegment *seg)
+{
+    struct archiveRecord *record;
+    unsigned long frames, first = 0, count = atomic_load_explicit(&seg->header->count, memory_order_acquire);
+    size_t blocks = (count + ARCHIVE_BLOCK_FRAMES - 1) / ARCHIVE_BLOCK_FRAMES;
+
+    memset(idx, 0, sizeof(*idx));
+
+    // Compressed blocks are counted by walking them all
+    if (seg->header->version == ARCHIVE_COLUMNAR_VERSION && count > 0)
+    {
+        if (archiveFindBlock(seg, count - 1) == -1)
+            return -1;
+
+        blocks = seg->indexed;
+    }
+
+    if ((idx->header = malloc(sizeof(*idx->header) + blocks * sizeof(*idx->entries))) == NULL)
+        return -1;
+
+    memcpy(idx->header->magic, INDEX_MAGIC, sizeof(idx->header->magic));
+    idx->header->segment = seg->header->segment;
+    idx->header->blockFrames = ARCHIVE_BLOCK_FRAMES;
+    idx->header->headerWidth = frameGeometry.headerWidth;
+    idx->header->trailerWords = frameGeometry.trailerWords;
+    idx->header->records = count;
+    idx->header->blocks = blocks;
+    idx->header->firstNs = seg->header->firstNs;
+    idx->header->lastNs = seg->header->lastNs;
+    idx->header->codes = indexFingerprint;
+    idx->entries = (struct indexEntry *)(idx->header + 1);
+
+    // Records of a block are contiguous, decoded or mapped
+    for (size_t b = 0; b < blocks; b++, first += frames)
+    {
+        if ((frames = archiveBlockFrames(seg, first)) == 0 || (record = archiveRecordAt(seg, first)) == NULL)
+        {
+            indexClose(idx);
+            return -1;
+        }
+
+        indexBlock(&idx->entries[b], (const unsigned long *)record, seg->header->recordBytes / sizeof(unsigned long),
+            1, frames);
+    }
+    return 0;
+}
+
+/**
+* scandir filter selecting archive segment files.
+*
+* @param entry
+* @return int
+*/
+int archiveSegmentName(const struct dirent *entry)
+{
+    unsigned int index;
+    char end;
+
+    return sscanf(entry->d_name, "segment-%u.tl%c", &index, &end) == 2 && end == 'm';
+}
+
+/**
+* Maps an archive for reading, either a single segment file or every segment
+* of a recording directory in order. Returns -1 with errno set on failure.
+*
+* @param set
+* @param path
+* @return int
+*/
+int archiveOpenSet(struct archiveSet *set, const char *path)
+{
+    int found;
+    struct stat st;
+    struct dirent **names;
+    char segmentPath[ARCHIVE_PATH_BYTES + 256];
+
+    memset(set, 0, sizeof(*set));
+
+    if (stat(path, &st) == -1)
+        return -1;
+
+    if (!S_ISDIR(st.st_mode))
+    {
+        if ((set->segments = calloc(1, sizeof(*set->segments))) == NULL)
+            return -1;
+
+        if (archiveMapSegment(&set->segments[0], path) == -1)
+        {
+            archiveCloseSet(set);
+            return -1;
+        }
+        set->count = 1;
+        set->records = set->segments[0].header->count;
+        return 0;
+    }
+
+    // Zero padded segment numbers sort in recording order
+    if ((found = scandir(path, &names, archiveSegmentName, alphasort)) == -1)
+        return -1;
+
+    if (found == 0 || (set->segments = calloc(found, sizeof(*set->segments))) == NULL)
+    {
+        free(names);
+        errno = found == 0 ? ENOENT : errno;
+        return -1;
+    }
+
+    for (int i = 0; i < found; i++)
+    {
+        snprintf(segmentPath, sizeof(segmentPath), "%s/%s", path, names[i]->d_name);
+
+        if (archiveMapSegment(&set->segments[set->count], segmentPath) == 0)
+        {
+            set->records += set->segments[set->count].header->count;
+            set->count++;
+        }
+        else
+        {
+            printf("Skipping archive segment %s: %s.\n", segmentPath, strerror(errno));
+        }
+        free(names[i]);
+    }
+    free(names);
+
+    return 0;
+}
+
+/**
+* Unmaps every segment of an archive.
+*
+* @param set
+* @return void
+*/
+void archiveCloseSet(struct archiveSet *set)
+{
+    for (size_t i = 0; i < set->count; i++)
+        archiveUnmapSegment(&set->segments[i]);
+
+    free(set->segments);
+    set->segments = NULL;
+    set->count = 0;
+}
+
+#endif
@@ -0,0 +1,147 @@
+#!/bin/sh
+#
+# End to end loopback benchmark of sim -> mdp. Builds both utilities once,
+# then for every combination of frame size, per connection frame
+# rate and connection count starts a quiet mdp on the epoll event loop and the
+# given number of quiet, latency stamping sims, and reports one result per run
+# from the final metrics snapshots.
+#
+# Usage: bench/loopback.sh [-s "16 32"] [-r "1000 max"] [-c "1 4"] [-d SEC]
+#                          [-w WORKERS] [-b read|recvmmsg|uring] [-f csv|json]
+#                          [-p BASE_PORT] [-o BUILD_DIR]
+#
+# Sizes are in minor frames, rates in frames per second per connection (max
+# sends back to back). Latencies are end to end from the sim write to the mdp
+# dispatch of the frame and are reported in microseconds.
+#
+# @author Vincent Nigro
+# @version 0.0.2
+
+set -e
+
+SIZES="16"
+RATES="1000 10000 max"
+CONNECTIONS="1 4"
+DURATION=5
+WORKERS=0
+BACKEND=read
+FORMAT=csv
+PORT=19100
+BUILD=""
+
+while getopts "s:r:c:d:w:b:f:p:o:" opt
+do
+    case $opt in
+        s) SIZES=$OPTARG ;;
+        r) RATES=$OPTARG ;;
+        c) CONNECTIONS=$OPTARG ;;
+        d) DURATION=$OPTARG ;;
+        w) WORKERS=$OPTARG ;;
+        b) BACKEND=$OPTARG ;;
+        f) FORMAT=$OPTARG ;;
+        p) PORT=$OPTARG ;;
+        o) BUILD=$OPTARG ;;
+        *) sed -n '9,11p' "$0"; exit 1 ;;
+    esac
+done
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+BUILD=${BUILD:-$(mktemp -d "${TMPDIR:-/tmp}/telemsim-bench.XXXXXX")}
+CC=${CC:-gcc}
+CFLAGS=${CFLAGS:--O2}
+
+mkdir -p "$BUILD"
+
+# Prints a numeric field of a flat JSON snapshot, or of one of its stages
+field()
+{
+    sed -n "s/.*\"$2\":{[^}]*\"$3\":\([0-9.]*\).*/\1/p" "$1" | head -n 1
+}
+
+counter()
+{
+    sed -n "s/.*\"$2\":\([0-9.]*\).*/\1/p" "$1" | head -n 1
+}
+
+if [ "$FORMAT" = csv ]
+then
+    echo "frame_words,rate_per_conn,connections,workers,backend,duration_s,frames,frames_per_s,mb_per_s,mdp_cpu_us_per_frame,sim_cpu_us_per_frame,latency_p50_us,latency_p99_us,latency_p999_us,latency_max_us,unknown_commands,sync_losses,log_dropped"
+fi
+
+$CC $CFLAGS -pthread "$ROOT/mdp.c" -o "$BUILD/mdp"
+$CC $CFLAGS -pthread "$ROOT/simulator.c" -o "$BUILD/sim"
+
+for size in $SIZES
+do
+
+    for rate in $RATES
+    do
+        for conns in $CONNECTIONS
+        do
+            PORT=$((PORT + 1))
+            run="$BUILD/run-$size-$rate-$conns"
+            rm -f "$run".*
+
+            set -- --INET --epoll --quiet --frame-size "$size" --recv "$BACKEND" --stats "$run.mdp.json"
+
+            if [ "$WORKERS" -gt 0 ]
+            then
+                set -- "$@" --workers "$WORKERS"
+            fi
+
+            "$BUILD/mdp" "$PORT" "$@" > "$run.mdp.log" 2>&1 &
+            mdp=$!
+            sleep 0.5
+
+            start=$(date +%s.%N)
+            pids=""
+
+            for i in $(seq "$conns")
+            do
+                "$BUILD/sim" 127.0.0.1 "$PORT" "$DURATION" --quiet --stamp --rate "$rate" --frame-size "$size" \
+                    --stats "$run.sim$i.json" > "$run.sim$i.log" 2>&1 &
+                pids="$pids $!"
+            done
+
+            wait $pids
+            end=$(date +%s.%N)
+
+            # Lets mdp handle the last frames before stopping it
+            sleep 0.5
+            kill -INT "$mdp"
+            wait "$mdp" || true
+
+            simCpu=0
+            for i in $(seq "$conns")
+            do
+                simCpu=$(echo "$simCpu $(counter "$run.sim$i.json" cpu_s)" | awk '{ print $1 + $2 }')
+            done
+
+            awk -v size="$size" -v rate="$rate" -v conns="$conns" -v workers="$WORKERS" \
+                -v backend="$BACKEND" -v format="$FORMAT" -v start="$start" -v end="$end" \
+                -v frames="$(counter "$run.mdp.json" frames)" -v bytes="$(counter "$run.mdp.json" bytes)" \
+                -v mdpCpu="$(counter "$run.mdp.json" cpu_s)" -v simCpu="$simCpu" \
+                -v p50="$(field "$run.mdp.json" latency p50_ns)" -v p99="$(field "$run.mdp.json" latency p99_ns)" \
+                -v p999="$(field "$run.mdp.json" latency p999_ns)" -v max="$(field "$run.mdp.json" latency max_ns)" \
+                -v unknown="$(counter "$run.mdp.json" unknown_commands)" \
+                -v losses="$(counter "$run.mdp.json" sync_losses)" \
+                -v dropped="$(counter "$run.mdp.json" log_dropped)" '
+            BEGIN {
+                seconds = end - start
+                fps = frames / seconds
+                mbps = bytes / seconds / 1e6
+                mdpUs = frames ? mdpCpu * 1e6 / frames : 0
+                simUs = frames ? simCpu * 1e6 / frames : 0
+
+                if (format == "json")
+                    printf "{\"frame_words\":%d,\"rate_per_conn\":\"%s\",\"connections\":%d,\"workers\":%d,\"backend\":\"%s\",\"duration_s\":%.3f,\"frames\":%d,\"frames_per_s\":%.1f,\"mb_per_s\":%.3f,\"mdp_cpu_us_per_frame\":%.3f,\"sim_cpu_us_per_frame\":%.3f,\"latency_p50_us\":%.3f,\"latency_p99_us\":%.3f,\"latency_p999_us\":%.3f,\"latency_max_us\":%.3f,\"unknown_commands\":%d,\"sync_losses\":%d,\"log_dropped\":%d}\n",
+                        size, rate, conns, workers, backend, seconds, frames, fps, mbps, mdpUs, simUs,
+                        p50 / 1e3, p99 / 1e3, p999 / 1e3, max / 1e3, unknown, losses, dropped
+                else
+                    printf "%d,%s,%d,%d,%s,%.3f,%d,%.1f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%d,%d,%d\n",
+                        size, rate, conns, workers, backend, seconds, frames, fps, mbps, mdpUs, simUs,
+                        p50 / 1e3, p99 / 1e3, p999 / 1e3, max / 1e3, unknown, losses, dropped
+            }'
+        done
+    done
+done
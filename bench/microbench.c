@@ -0,0 +1,389 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <x86intrin.h>
+#include "../commands.h"
+#include "../logger.h"
+#include "../reassembler.h"
+#include "../scan.h"
+#include "../dispatch.h"
+#include "../decode.h"
+#include "../frame.h"
+#include "../integrity.h"
+#include "../archive.h"
+
+#define MICRO_FRAMES 65536
+#define MICRO_ROUNDS 7
+#define MICRO_PRINT_DIVISOR 256
+
+/**
+* Microbenchmarks of the per frame kernels of sim and mdp over large in memory
+* batches of synthetic major frames, without sockets or output in the way. Each
+* kernel runs MICRO_ROUNDS times over the batch and the fastest round is
+* reported as nanoseconds per major frame and time stamp counter cycles per
+* minor frame, one CSV row per kernel and command mix. The frame geometry
+* defaults to the build time -DFRAME_SIZE and -DHEADER_WIDTH and may be given
+* on the command line; geometries of FRAME_GEOMETRIES run their specialized
+* kernels.
+*
+* @author Vincent Nigro
+* @version 0.0.2
+*/
+
+enum microMix
+{
+    MIX_SOH,
+    MIX_ALARM,
+    MIX_MIXED,
+    MIX_UNKNOWN,
+    MIX_COUNT
+};
+
+static const char *mixNames[MIX_COUNT] = { "soh", "alarm", "mixed", "unknown" };
+
+static FILE *report;
+static size_t frames = MICRO_FRAMES;
+static char *batch;
+static struct decodedFrame *decoded;
+static struct scanMasks *masks;
+static unsigned long *columns;
+static char *encoded;
+static const char *encodedEnd;
+static volatile unsigned long sink;
+
+void fillFrames(int);
+unsigned long nextRandom(unsigned long*);
+void runKernel(const char*, int, size_t, void (*)(size_t));
+void kernelGenerateHeader(size_t);
+void kernelGenerateSOHCheck(size_t);
+void kernelScan(size_t);
+void kernelRemoveHeader(size_t);
+void kernelDecode(size_t);
+void kernelHandleMajorFrame(size_t);
+void kernelPrintBits(size_t);
+void kernelCrc32c(size_t);
+void kernelColumnEncode(size_t);
+void kernelColumnDecode(size_t);
+
+/**
+* Runs every kernel over every command mix and prints the results as CSV.
+*
+* @param argc
+* @param argv
+* @return int
+*/
+int main(int argc, char **argv)
+{
+    if ((argc > 1 && (frames = strtoul(argv[1], NULL, 10)) == 0) || argc == 3 ||
+        (argc > 3 && !geometrySet(atoi(argv[2]), atoi(argv[3]))))
+    {
+        printf("Usage: ./microbench [FRAMES [FRAME_WORDS HEADER_WORDS]]\n");
+        exit(1);
+    }
+
+    // Results go to the original standard output, kernel output is discarded
+    if ((report = fdopen(dup(STDOUT_FILENO), "w")) == NULL || freopen("/dev/null", "w", stdout) == NULL)
+    {
+        perror("Unable to redirect output");
+        exit(1);
+    }
+
+    batch = aligned_alloc(64, frames * MAJOR_FRAME_BYTES);
+    decoded = calloc(frames, decodedFrameBytes());
+    masks = aligned_alloc(64, SCAN_BLOCKS(frames * frameGeometry.frameSize) * sizeof(*masks) + 64);
+    columns = malloc(ARCHIVE_BLOCK_FRAMES * frameGeometry.frameSize * sizeof(*columns));
+    encoded = malloc((frames / ARCHIVE_BLOCK_FRAMES + 1) * frameGeometry.frameSize * columnBound(ARCHIVE_BLOCK_FRAMES));
+
+    if (batch == NULL || decoded == NULL || masks == NULL || columns == NULL || encoded == NULL)
+    {
+        fprintf(report, "Unable to allocate %zu frames.\n", frames);
+        exit(1);
+    }
+
+    scanInit();
+    decodeInit();
+    frameInit();
+    integrityInit();
+    columnarInit();
+    dispatchInit();
+    loggerInit(0, 1);
+
+    fprintf(report, "kernel,mix,frame_words,header_words,scan_kernel,decode_kernel,frame_kernel,frames,ns_per_frame,cycles_per_minor_frame\n");
+
+    runKernel("generateHeader", MIX_SOH, frames, kernelGenerateHeader);
+    runKernel("generateSOHCheck", MIX_SOH, frames, kernelGenerateSOHCheck);
+    runKernel("crc32c", MIX_SOH, frames, kernelCrc32c);
+
+    for (int mix = 0; mix < MIX_COUNT; mix++)
+    {
+        fillFrames(mix);
+        scanWords((const unsigned long *)batch, frames * frameGeometry.frameSize, masks);
+        decodeFrames(batch, frames, decoded);
+
+        runKernel("scan", mix, frames, kernelScan);
+        runKernel("removeHeader", mix, frames, kernelRemoveHeader);
+        runKernel("decodeFrames", mix, frames, kernelDecode);
+        runKernel("handleMajorFrame", mix, frames, kernelHandleMajorFrame);
+        runKernel("printBits", mix, frames / MICRO_PRINT_DIVISOR ? frames / MICRO_PRINT_DIVISOR : 1,
+            kernelPrintBits);
+        runKernel("columnEncode", mix, frames, kernelColumnEncode);
+        runKernel("columnDecode", mix, frames, kernelColumnDecode);
+    }
+
+    loggerShutdown();
+    fclose(report);
+
+    return 0;
+}
+
+/**
+* Returns the next value of a splitmix64 sequence.
+*
+* @param state
+* @return unsigned long
+*/
+unsigned long nextRandom(unsigned long *state)
+{
+    unsigned long z = (*state += 0x9E3779B97F4A7C15);
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+
+    return z ^ (z >> 31);
+}
+
+/**
+* Fills the batch with major frames of a command mix: the simulator SOH check,
+* alternating alarms, random known commands or random unknown words, each
+* behind a standard header and ended by END.
+*
+* @param mix
+* @return void
+*/
+void fillFrames(int mix)
+{
+    int kill = 0;
+    unsigned long state = 42, word, *minorFrame;
+    const unsigned long alarms[] = { ICING_ALARM, OVERHEAT_ALARM, SENSOR_1_ALARM, SENSOR_2_ALARM };
+
+    for (size_t f = 0; f < frames; f++)
+    {
+        char *frame = batch + f * MAJOR_FRAME_BYTES;
+
+        generateSOHCheck(frame, &GOOD, &kill);
+
+        if (mix == MIX_SOH)
+            continue;
+
+        minorFrame = (unsigned long *)frame;
+
+        for (int i = frameGeometry.headerWidth; i < frameGeometry.frameSize - 1; i++)
+        {
+            if (mix == MIX_ALARM)
+                word = alarms[i % 4];
+            else if (mix == MIX_MIXED)
+                // Skips END, KILL and STAMP so every word is a plain command
+                word = commandTable[2 + nextRandom(&state) % (commandCount - 3)].code;
+            else
+                word = nextRandom(&state) | 1;
+
+            memcpy(minorFrame + i, &word, sizeof(word));
+        }
+    }
+}
+
+/**
+* Times the fastest of MICRO_ROUNDS runs of a kernel over count frames and
+* reports it.
+*
+* @param name
+* @param mix
+* @param count
+* @param kernel
+* @return void
+*/
+void runKernel(const char *name, int mix, size_t count, void (*kernel)(size_t))
+{
+    struct timespec start, end;
+    unsigned long ns, best = ~0UL, cycles, bestCycles = ~0UL;
+
+    for (int round = 0; round < MICRO_ROUNDS; round++)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        cycles = __rdtsc();
+
+        kernel(count);
+
+        cycles = __rdtsc() - cycles;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        ns = (end.tv_sec - start.tv_sec) * 1000000000UL + end.tv_nsec - start.tv_nsec;
+
+        if (ns < best)
+        {
+            best = ns;
+            bestCycles = cycles;
+        }
+    }
+
+    fprintf(report, "%s,%s,%d,%d,%s,%s,%s,%zu,%.3f,%.3f\n", name, mixNames[mix], frameGeometry.frameSize,
+        frameGeometry.headerWidth, scanKernelName(), decodeKernelName(), frameKernelName(), count,
+        (double)best / count, (double)bestCycles / (count * frameGeometry.frameSize));
+    fflush(report);
+}
+
+/**
+* Writes the header of every frame.
+*
+* @param count
+* @return void
+*/
+void kernelGenerateHeader(size_t count)
+{
+    for (size_t f = 0; f < count; f++)
+        generateHeader((unsigned long *)(batch + f * MAJOR_FRAME_BYTES));
+}
+
+/**
+* Generates a complete SOH check frame into every frame.
+*
+* @param count
+* @return void
+*/
+void kernelGenerateSOHCheck(size_t count)
+{
+    int kill = 0;
+
+    for (size_t f = 0; f < count; f++)
+        generateSOHCheck(batch + f * MAJOR_FRAME_BYTES, &GOOD, &kill);
+}
+
+/**
+* Scans the minor frames of the batch into header, stop, zero and alarm masks.
+*
+* @param count
+* @return void
+*/
+void kernelScan(size_t count)
+{
+    scanWords((const unsigned long *)batch, count * frameGeometry.frameSize, masks);
+}
+
+/**
+* Measures the header of every frame from the scanned masks.
+*
+* @param count
+* @return void
+*/
+void kernelRemoveHeader(size_t count)
+{
+    unsigned long total = 0;
+
+    for (size_t f = 0; f < count; f++)
+        total += removeHeader(masks, f * frameGeometry.frameSize);
+
+    sink = total;
+}
+
+/**
+* Scans and decodes the batch, resolving every command to its dispatch entry.
+*
+* @param count
+* @return void
+*/
+void kernelDecode(size_t count)
+{
+    decodeFrames(batch, count, decoded);
+}
+
+/**
+* Runs the command handlers of every decoded frame.
+*
+* @param count
+* @return void
+*/
+void kernelHandleMajorFrame(size_t count)
+{
+    unsigned long total = 0;
+
+    for (size_t f = 0; f < count; f++)
+        total += handleMajorFrame(batch + f * MAJOR_FRAME_BYTES, decodedFrameAt(decoded, f));
+
+    sink = total;
+}
+
+/**
+* Dumps every frame as bits to the discarded standard output.
+*
+* @param count
+* @return void
+*/
+void kernelPrintBits(size_t count)
+{
+    for (size_t f = 0; f < count; f++)
+        printBits(MAJOR_FRAME_BYTES, batch + f * MAJOR_FRAME_BYTES);
+}
+
+/**
+* Computes the trailer CRC32C of every frame with the selected kernel.
+*
+* @param count
+* @return void
+*/
+void kernelCrc32c(size_t count)
+{
+    unsigned long total = 0;
+
+    for (size_t f = 0; f < count; f++)
+        total += crc32cWords((const unsigned long *)(batch + f * MAJOR_FRAME_BYTES), frameGeometry.frameSize - 1);
+
+    sink = total;
+}
+
+/**
+* Encodes the batch as compressed archive blocks of minor frame columns.
+*
+* @param count
+* @return void
+*/
+void kernelColumnEncode(size_t count)
+{
+    size_t n, used = 0;
+
+    for (size_t f = 0; f < count; f += n)
+    {
+        n = count - f < ARCHIVE_BLOCK_FRAMES ? count - f : ARCHIVE_BLOCK_FRAMES;
+        columnTranspose((const uint64_t *)(batch + f * MAJOR_FRAME_BYTES), frameGeometry.frameSize, columns,
+            ARCHIVE_BLOCK_FRAMES, n, frameGeometry.frameSize);
+
+        for (int c = 0; c < frameGeometry.frameSize; c++)
+            used += columnEncode(&columns[c * ARCHIVE_BLOCK_FRAMES], n, encoded + used);
+    }
+    encodedEnd = encoded + used;
+    sink = used;
+}
+
+/**
+* Decodes the blocks encoded by kernelColumnEncode back into the batch.
+*
+* @param count
+* @return void
+*/
+void kernelColumnDecode(size_t count)
+{
+    size_t n;
+    const char *column = encoded;
+
+    for (size_t f = 0; f < count; f += n)
+    {
+        n = count - f < ARCHIVE_BLOCK_FRAMES ? count - f : ARCHIVE_BLOCK_FRAMES;
+
+        for (int c = 0; c < frameGeometry.frameSize; c++)
+            column = columnDecode(column, encodedEnd, n, &columns[c * ARCHIVE_BLOCK_FRAMES]);
+
+        columnTranspose(columns, ARCHIVE_BLOCK_FRAMES, (uint64_t *)(batch + f * MAJOR_FRAME_BYTES),
+            frameGeometry.frameSize, frameGeometry.frameSize, n);
+    }
+}
@@ -0,0 +1,107 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../commands.h"
+#include "../reassembler.h"
+#include "../frame.h"
+
+#define RESYNC_FRAMES 6
+#define RESYNC_CORRUPT 1
+
+/**
+* Regression check of the reassembler hunt for frame boundaries. For header
+* widths from 2 to 6 words, RESYNC_FRAMES SOH check frames are written through
+* a pipe with the first sync word of frame RESYNC_CORRUPT corrupted; every
+* other frame must come back whole and aligned, at the cost of one sync loss.
+* Exits non-zero on the first geometry that fails.
+*
+* @author Vincent Nigro
+* @version 0.0.2
+*/
+
+int resyncCheck(int);
+
+/**
+* Runs the check for every header width and prints the outcome.
+*
+* @return int
+*/
+int main()
+{
+    int failed = 0;
+
+    for (int width = 2; width <= 6 && !failed; width++)
+        failed = resyncCheck(width);
+
+    printf("%s\n", failed ? "FAIL" : "OK");
+
+    return failed;
+}
+
+/**
+* Checks one header width, returning non-zero when a frame is lost, misaligned
+* or more than one sync loss is counted.
+*
+* @param width
+* @return int
+*/
+int resyncCheck(int width)
+{
+    int pipes[2], kill = 0;
+    size_t returned = 0, expected = 0;
+    char frames[RESYNC_FRAMES][FRAME_MAX_SIZE * sizeof(unsigned long)], *frame;
+    struct reassembler ra;
+
+    if (!geometrySet(16, width) || pipe(pipes) == -1 || reassemblerInit(&ra, REASSEMBLER_CAPACITY) == -1)
+    {
+        perror("Unable to set up the check");
+        return 1;
+    }
+
+    // Generation kernels are specialized per geometry
+    frameInit();
+
+    for (int f = 0; f < RESYNC_FRAMES; f++)
+    {
+        generateSOHCheck(frames[f], &GOOD, &kill);
+
+        if (f == RESYNC_CORRUPT)
+            frames[f][0] ^= 1;
+
+        if (write(pipes[1], frames[f], MAJOR_FRAME_BYTES) != (ssize_t)MAJOR_FRAME_BYTES)
+        {
+            perror("Unable to write frames");
+            return 1;
+        }
+    }
+    close(pipes[1]);
+
+    while (reassemblerFill(&ra, pipes[0]) > 0)
+    {
+        while ((frame = reassemblerNext(&ra)) != NULL)
+        {
+            // The corrupted frame is the one that may not come back
+            expected += expected == RESYNC_CORRUPT;
+
+            if (expected >= RESYNC_FRAMES || memcmp(frame, frames[expected], MAJOR_FRAME_BYTES) != 0)
+            {
+                printf("Header width %d: frame %zu returned misaligned.\n", width, returned);
+                return 1;
+            }
+            expected++;
+            returned++;
+        }
+    }
+    close(pipes[0]);
+    reassemblerFree(&ra);
+
+    if (returned != RESYNC_FRAMES - 1 || ra.syncLosses != 1)
+    {
+        printf("Header width %d: %zu of %d frames returned with %lu sync losses.\n", width, returned,
+            RESYNC_FRAMES - 1, ra.syncLosses);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,516 @@
+#ifndef COLUMNAR_H
+#define COLUMNAR_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <immintrin.h>
+
+/**
+* Column codec of the compressed archive. A column is a run of 64 bit values,
+* one per frame of a block, stored with whichever encoding is smallest:
+*
+*   STEP  the first value and a constant step, covering constant columns
+*   RUNS  the distinct runs of equal values and their lengths
+*   DICT  a dictionary of up to COLUMNAR_DICT_MAX values and a byte per frame
+*   DELTA the first value and zigzag varint deltas between neighbours
+*   RAW   the values as they are
+*
+* Frames are turned into columns and back with a transpose, done four by four
+* minor frames with AVX2 shuffles when available, and dictionary columns are
+* expanded with AVX2 gathers. The kernels are selected once at runtime by
+* columnarInit.
+*
+* @author Vincent Nigro
+* @version 0.0.2
+*/
+
+#define COLUMNAR_DICT_MAX 256
+#define COLUMNAR_HASH_BITS 9
+#define COLUMNAR_HASH_SLOTS (1 << COLUMNAR_HASH_BITS)
+
+enum columnEncoding
+{
+    COLUMN_STEP,
+    COLUMN_RUNS,
+    COLUMN_DICT,
+    COLUMN_DELTA,
+    COLUMN_RAW
+};
+
+/**
+* Precedes the payload of every column; bytes counts the payload, which is
+* padded to whole words.
+*/
+struct columnHeader
+{
+    uint32_t encoding;
+    uint32_t bytes;
+};
+
+typedef void (*columnTransposeKernel)(const uint64_t*, size_t, uint64_t*, size_t, size_t, size_t);
+typedef void (*columnGatherKernel)(const uint64_t*, const uint8_t*, uint64_t*, size_t);
+
+void columnarInit();
+const char *columnarKernelName();
+size_t columnBound(size_t);
+size_t columnEncode(const uint64_t*, size_t, char*);
+const char *columnDecode(const char*, const char*, size_t, uint64_t*);
+void columnTransposeScalar(const uint64_t*, size_t, uint64_t*, size_t, size_t, size_t);
+void columnTransposeAVX2(const uint64_t*, size_t, uint64_t*, size_t, size_t, size_t);
+void columnGatherScalar(const uint64_t*, const uint8_t*, uint64_t*, size_t);
+void columnGatherAVX2(const uint64_t*, const uint8_t*, uint64_t*, size_t);
+
+static columnTransposeKernel columnTranspose = columnTransposeScalar;
+static columnGatherKernel columnGather = columnGatherScalar;
+
+/**
+* Selects the AVX2 kernels when the executing processor supports them.
+*
+* @return void
+*/
+void columnarInit()
+{
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+    {
+        columnTranspose = columnTransposeAVX2;
+        columnGather = columnGatherAVX2;
+    }
+}
+
+/**
+* Returns the name of the selected column kernels.
+*
+* @return const char*
+*/
+const char *columnarKernelName()
+{
+    return columnTranspose == columnTransposeAVX2 ? "avx2" : "scalar";
+}
+
+/**
+* Returns the largest encoded size of a column of count values: that of the
+* raw encoding, which every other encoding is only chosen to undercut, or of
+* the step encoding of a single value.
+*
+* @param count
+* @return size_t
+*/
+size_t columnBound(size_t count)
+{
+    return sizeof(struct columnHeader) + (count > 2 ? count : 2) * sizeof(uint64_t);
+}
+
+/**
+* Returns the number of bytes of the varint of a value.
+*
+* @param value
+* @return size_t
+*/
+static inline size_t columnVarintBytes(uint64_t value)
+{
+    return value < 0x80 ? 1 : (64 - __builtin_clzl(value) + 6) / 7;
+}
+
+/**
+* Returns a payload size padded to whole words.
+*
+* @param bytes
+* @return size_t
+*/
+static inline size_t columnPad(size_t bytes)
+{
+    return (bytes + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+}
+
+/**
+* Maps a signed delta onto an unsigned value small for small magnitudes.
+*
+* @param delta
+* @return uint64_t
+*/
+static inline uint64_t columnZigzag(uint64_t delta)
+{
+    return (delta << 1) ^ (uint64_t)((int64_t)delta >> 63);
+}
+
+/**
+* Returns the dictionary slot of a value, inserting it with the next index
+* while the dictionary has room. Slots hold the index plus one, zero when free.
+*
+* @param keys
+* @param slots
+* @param value
+* @param distinct
+* @return unsigned int
+*/
+static inline unsigned int columnDictSlot(uint64_t *keys, uint16_t *slots, uint64_t value, size_t *distinct)
+{
+    unsigned int slot = (value * 0x9E3779B97F4A7C15) >> (64 - COLUMNAR_HASH_BITS);
+
+    while (slots[slot] != 0 && keys[slot] != value)
+        slot = (slot + 1) & (COLUMNAR_HASH_SLOTS - 1);
+
+    if (slots[slot] == 0 && *distinct < COLUMNAR_DICT_MAX)
+    {
+        keys[slot] = value;
+        slots[slot] = ++*distinct;
+    }
+    else if (slots[slot] == 0)
+        ++*distinct;
+
+    return slot;
+}
+
+/**
+* Encodes a column of count values with its smallest encoding, returning the
+* bytes written including the column header, at most columnBound(count).
+*
+* @param values
+* @param count
+* @param out
+* @return size_t
+*/
+size_t columnEncode(const uint64_t *values, size_t count, char *out)
+{
+    struct columnHeader header;
+    char *payload = out + sizeof(header), *lengths;
+    uint64_t step = count > 1 ? values[1] - values[0] : 0, keys[COLUMNAR_HASH_SLOTS], zigzag;
+    uint16_t slots[COLUMNAR_HASH_SLOTS];
+    size_t i, runs = 1, distinct = 0, delta = sizeof(uint64_t), raw = count * sizeof(uint64_t), size, run;
+    uint32_t length;
+
+    for (i = 2; i < count && values[i] - values[i - 1] == step; i++)
+        ;
+
+    if (i >= count)
+    {
+        header.encoding = COLUMN_STEP;
+        memcpy(payload, &values[0], sizeof(uint64_t));
+        memcpy(payload + sizeof(uint64_t), &step, sizeof(step));
+        header.bytes = 2 * sizeof(uint64_t);
+        memcpy(out, &header, sizeof(header));
+        return sizeof(header) + header.bytes;
+    }
+
+    memset(keys, 0, sizeof(keys));
+    memset(slots, 0, sizeof(slots));
+    columnDictSlot(keys, slots, values[0], &distinct);
+
+    for (i = 1; i < count; i++)
+    {
+        runs += values[i] != values[i - 1];
+        delta += columnVarintBytes(columnZigzag(values[i] - values[i - 1]));
+
+        if (distinct <= COLUMNAR_DICT_MAX)
+            columnDictSlot(keys, slots, values[i], &distinct);
+    }
+
+    // Smallest of the encodings, each padded to whole words
+    header.encoding = COLUMN_RAW;
+    size = raw;
+
+    if (columnPad(delta) < size)
+    {
+        header.encoding = COLUMN_DELTA;
+        size = columnPad(delta);
+    }
+
+    if (distinct <= COLUMNAR_DICT_MAX && columnPad(sizeof(uint64_t) * (1 + distinct) + count) < size)
+    {
+        header.encoding = COLUMN_DICT;
+        size = columnPad(sizeof(uint64_t) * (1 + distinct) + count);
+    }
+
+    if (columnPad(sizeof(uint64_t) + runs * (sizeof(uint64_t) + sizeof(length))) < size)
+    {
+        header.encoding = COLUMN_RUNS;
+        size = columnPad(sizeof(uint64_t) + runs * (sizeof(uint64_t) + sizeof(length)));
+    }
+
+    header.bytes = size;
+    memcpy(out, &header, sizeof(header));
+    memset(payload + size - sizeof(uint64_t), 0, sizeof(uint64_t));
+
+    switch (header.encoding)
+    {
+        case COLUMN_RUNS:
+            // The values of the runs, then their lengths
+            memcpy(payload, &runs, sizeof(uint64_t));
+            lengths = payload + sizeof(uint64_t) + runs * sizeof(uint64_t);
+
+            for (i = 0, run = 0; i < count; i += length, run++)
+            {
+                for (length = 1; i + length < count && values[i + length] == values[i]; length++)
+                    ;
+
+                memcpy(payload + sizeof(uint64_t) + run * sizeof(uint64_t), &values[i], sizeof(uint64_t));
+                memcpy(lengths + run * sizeof(length), &length, sizeof(length));
+            }
+            break;
+
+        case COLUMN_DICT:
+            memcpy(payload, &distinct, sizeof(uint64_t));
+
+            for (i = 0; i < COLUMNAR_HASH_SLOTS; i++)
+            {
+                if (slots[i] != 0)
+                    memcpy(payload + slots[i] * sizeof(uint64_t), &keys[i], sizeof(uint64_t));
+            }
+
+            for (i = 0; i < count; i++)
+                payload[(1 + distinct) * sizeof(uint64_t) + i] = slots[columnDictSlot(keys, slots, values[i],
+                    &distinct)] - 1;
+            break;
+
+        case COLUMN_DELTA:
+            memcpy(payload, &values[0], sizeof(uint64_t));
+            payload += sizeof(uint64_t);
+
+            for (i = 1; i < count; i++)
+            {
+                for (zigzag = columnZigzag(values[i] - values[i - 1]); zigzag >= 0x80; zigzag >>= 7)
+                    *payload++ = (char)(zigzag | 0x80);
+
+                *payload++ = (char)zigzag;
+            }
+            break;
+
+        default:
+            memcpy(payload, values, raw);
+            break;
+    }
+    return sizeof(header) + size;
+}
+
+/**
+* Decodes a column of count values into out, returning the first byte after
+* the column, or NULL when its encoding is unknown or it does not fit before
+* end: a column that runs past end, or whose runs, dictionary or varints do
+* not fit its own payload, is corrupt and never read past.
+*
+* @param in
+* @param end
+* @param count
+* @param out
+* @return const char*
+*/
+const char *columnDecode(const char *in, const char *end, size_t count, uint64_t *out)
+{
+    struct columnHeader header;
+    const char *payload = in + sizeof(header), *lengths, *last;
+    uint64_t first, step, entries, value, zigzag, runs, done;
+    uint32_t length;
+    size_t i;
+    int shift, bad = 0;
+
+    if (count == 0 || end - in < (ptrdiff_t)sizeof(header))
+        return NULL;
+
+    memcpy(&header, in, sizeof(header));
+
+    if (header.bytes < sizeof(first) || header.bytes > (size_t)(end - payload))
+        return NULL;
+
+    memcpy(&first, payload, sizeof(first));
+    last = payload + header.bytes;
+
+    switch (header.encoding)
+    {
+        case COLUMN_STEP:
+            if (header.bytes < sizeof(first) + sizeof(step))
+                return NULL;
+
+            memcpy(&step, payload + sizeof(first), sizeof(step));
+
+            for (i = 0; i < count; i++)
+                out[i] = first + i * step;
+            break;
+
+        case COLUMN_RUNS:
+            // Every run takes its value and its length
+            if (first > (header.bytes - sizeof(uint64_t)) / (sizeof(uint64_t) + sizeof(length)))
+                return NULL;
+
+            lengths = payload + sizeof(uint64_t) + first * sizeof(uint64_t);
+
+            for (runs = 0, done = 0; runs < first && done < count; runs++, done += length)
+            {
+                memcpy(&value, payload + sizeof(uint64_t) + runs * sizeof(uint64_t), sizeof(value));
+                memcpy(&length, lengths + runs * sizeof(length), sizeof(length));
+
+                if (length > count - done)
+                    length = count - done;
+
+                for (i = 0; i < length; i++)
+                    out[done + i] = value;
+            }
+
+            if (done < count)
+                return NULL;
+            break;
+
+        case COLUMN_DICT:
+            entries = first;
+
+            if (entries == 0 || entries > COLUMNAR_DICT_MAX ||
+                sizeof(uint64_t) * (1 + entries) + count > header.bytes)
+                return NULL;
+
+            for (i = 0; entries < COLUMNAR_DICT_MAX && i < count; i++)
+                bad |= (uint8_t)payload[sizeof(uint64_t) * (1 + entries) + i] >= entries;
+
+            if (bad)
+                return NULL;
+
+            columnGather((const uint64_t *)(payload + sizeof(uint64_t)),
+                (const uint8_t *)(payload + sizeof(uint64_t) + entries * sizeof(uint64_t)), out, count);
+            break;
+
+        case COLUMN_DELTA:
+            out[0] = first;
+            payload += sizeof(first);
+
+            for (i = 1; i < count; i++)
+            {
+                zigzag = 0;
+                shift = 0;
+
+                do
+                {
+                    if (payload == last || shift >= 64)
+                        return NULL;
+
+                    zigzag |= (uint64_t)(*payload & 0x7F) << shift;
+                    shift += 7;
+                }
+                while (*payload++ & 0x80);
+
+                out[i] = out[i - 1] + ((zigzag >> 1) ^ -(zigzag & 1));
+            }
+            break;
+
+        case COLUMN_RAW:
+            if (count > header.bytes / sizeof(uint64_t))
+                return NULL;
+
+            memcpy(out, payload, count * sizeof(uint64_t));
+            break;
+
+        default:
+            return NULL;
+    }
+    return last;
+}
+
+/**
+* Transposes a matrix of rows by cols words, rows srcStride words apart, into
+* one whose rows, dstStride words apart, are the columns of the source.
+*
+* @param src
+* @param srcStride
+* @param dst
+* @param dstStride
+* @param rows
+* @param cols
+* @return void
+*/
+void columnTransposeScalar(const uint64_t *src, size_t srcStride, uint64_t *dst, size_t dstStride, size_t rows,
+    size_t cols)
+{
+    for (size_t r = 0; r < rows; r++)
+    {
+        for (size_t c = 0; c < cols; c++)
+            dst[c * dstStride + r] = src[r * srcStride + c];
+    }
+}
+
+/**
+* Transposes a matrix as columnTransposeScalar does, four by four words at a
+* time with unpacks and lane permutes, the edges left to the scalar kernel.
+*
+* @param src
+* @param srcStride
+* @param dst
+* @param dstStride
+* @param rows
+* @param cols
+* @return void
+*/
+__attribute__((target("avx2")))
+void columnTransposeAVX2(const uint64_t *src, size_t srcStride, uint64_t *dst, size_t dstStride, size_t rows,
+    size_t cols)
+{
+    size_t r, c;
+    __m256i a, b, e, d, lo0, hi0, lo1, hi1;
+
+    for (r = 0; r + 4 <= rows; r += 4)
+    {
+        for (c = 0; c + 4 <= cols; c += 4)
+        {
+            a = _mm256_loadu_si256((const __m256i *)&src[r * srcStride + c]);
+            b = _mm256_loadu_si256((const __m256i *)&src[(r + 1) * srcStride + c]);
+            e = _mm256_loadu_si256((const __m256i *)&src[(r + 2) * srcStride + c]);
+            d = _mm256_loadu_si256((const __m256i *)&src[(r + 3) * srcStride + c]);
+
+            lo0 = _mm256_unpacklo_epi64(a, b);
+            hi0 = _mm256_unpackhi_epi64(a, b);
+            lo1 = _mm256_unpacklo_epi64(e, d);
+            hi1 = _mm256_unpackhi_epi64(e, d);
+
+            _mm256_storeu_si256((__m256i *)&dst[c * dstStride + r], _mm256_permute2x128_si256(lo0, lo1, 0x20));
+            _mm256_storeu_si256((__m256i *)&dst[(c + 1) * dstStride + r], _mm256_permute2x128_si256(hi0, hi1, 0x20));
+            _mm256_storeu_si256((__m256i *)&dst[(c + 2) * dstStride + r], _mm256_permute2x128_si256(lo0, lo1, 0x31));
+            _mm256_storeu_si256((__m256i *)&dst[(c + 3) * dstStride + r], _mm256_permute2x128_si256(hi0, hi1, 0x31));
+        }
+
+        columnTransposeScalar(&src[r * srcStride + c], srcStride, &dst[c * dstStride + r], dstStride, 4, cols - c);
+    }
+
+    columnTransposeScalar(&src[r * srcStride], srcStride, &dst[r], dstStride, rows - r, cols);
+}
+
+/**
+* Expands count dictionary indices into their values.
+*
+* @param dict
+* @param indices
+* @param out
+* @param count
+* @return void
+*/
+void columnGatherScalar(const uint64_t *dict, const uint8_t *indices, uint64_t *out, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        out[i] = dict[indices[i]];
+}
+
+/**
+* Expands dictionary indices as columnGatherScalar does, four per gather.
+*
+* @param dict
+* @param indices
+* @param out
+* @param count
+* @return void
+*/
+__attribute__((target("avx2")))
+void columnGatherAVX2(const uint64_t *dict, const uint8_t *indices, uint64_t *out, size_t count)
+{
+    size_t i = 0;
+    uint32_t four;
+    __m128i index;
+
+    for (; i + 4 <= count; i += 4)
+    {
+        memcpy(&four, &indices[i], sizeof(four));
+        index = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(four));
+        _mm256_storeu_si256((__m256i *)&out[i], _mm256_i32gather_epi64((const long long *)dict, index, 8));
+    }
+
+    columnGatherScalar(dict, indices + i, out + i, count - i);
+}
+
+#endif
@@ -1,3 +1,8 @@
+#ifndef COMMANDS_H
+#define COMMANDS_H
+
+#include <errno.h>
+#include <stddef.h>
 #include <time.h>
 
 /**
@@ -9,8 +14,21 @@
 
 #define HALF_MINUTE 30
 #define ONE_MINUTE 60
+
+// Default frame geometry in minor frames, may be overridden at build time
+#ifndef FRAME_SIZE
 #define FRAME_SIZE 16
+#endif
+#ifndef HEADER_WIDTH
 #define HEADER_WIDTH 4
+#endif
+#define FRAME_MAX_SIZE 256
+
+// Sequence number and CRC32C minor frames of the optional frame trailer
+#define FRAME_TRAILER_WORDS 2
+
+// Geometries given unrolled encode and decode paths, as (frame, header) pairs
+#define FRAME_GEOMETRIES(X) X(16, 4) X(32, 4) X(64, 8)
 
 const char * IPV4 = "--INET";
 const char * IPV6 = "--INET6";
@@ -30,6 +48,102 @@ const unsigned long         SENSOR_2_ALARM      = 0x1116395028409722; // 1231234
 const unsigned long         SENSOR_3_ALARM      = 0x1139C6736D1C49A7; // 1241241371371391399
 const unsigned long         SENSOR_4_ALARM      = 0x0CEEE2C5E648074A; // 931931512512186186
 const unsigned long         SENSOR_5_ALARM      = 0x78023A955400C1EA; // 8647538647538647530
+const unsigned long         STAMP               = 0x2E5F3A6C91D7B403; // 3341453686509908995
+
+// Command severities
+#define SEVERITY_NOMINAL 0
+#define SEVERITY_CAUTION 1
+#define SEVERITY_ALARM 2
+
+/**
+* Describes a command that may be issued within the minor frames of a major
+* frame. The label is how the MDP reports the command, terminal marks the
+* commands that end the session and operands counts the minor frames following
+* the command that carry its argument rather than further commands.
+*/
+struct command
+{
+    const char *name;
+    const char *label;
+    unsigned long code;
+    int severity;
+    int terminal;
+    int operands;
+};
+
+/**
+* The frame geometry in use, chosen at startup. Every frame holds frameSize
+* minor frames, the first headerWidth of them the alternating H1/H2 header and
+* the last trailerWords of them the trailer, if enabled.
+*/
+struct frameGeometry
+{
+    int frameSize;
+    int headerWidth;
+    size_t frameBytes;
+    int trailerWords;
+};
+
+struct frameGeometry frameGeometry = { FRAME_SIZE, HEADER_WIDTH, FRAME_SIZE * sizeof(unsigned long), 0 };
+
+/**
+* Sets the frame geometry, returning zero when it is not usable: the header
+* must hold the H1/H2 sync marker and leave room for at least one command.
+*
+* @param frameSize
+* @param headerWidth
+* @return int
+*/
+int geometrySet(int frameSize, int headerWidth)
+{
+    if (headerWidth < 2 || frameSize <= headerWidth || frameSize > FRAME_MAX_SIZE)
+        return 0;
+
+    frameGeometry.frameSize = frameSize;
+    frameGeometry.headerWidth = headerWidth;
+    frameGeometry.frameBytes = frameSize * sizeof(unsigned long);
+    return 1;
+}
+
+/**
+* Enables or disables the frame trailer of the current geometry, returning zero
+* when the trailer leaves no room for the final minor frame.
+*
+* @param enabled
+* @return int
+*/
+int geometryTrailer(int enabled)
+{
+    if (enabled && frameGeometry.frameSize - frameGeometry.headerWidth <= FRAME_TRAILER_WORDS)
+        return 0;
+
+    frameGeometry.trailerWords = enabled ? FRAME_TRAILER_WORDS : 0;
+    return 1;
+}
+
+// Built-in command dictionary, extended or overridden by a dictionary file
+const struct command builtinCommands[] =
+{
+    { "END",            "END",              END,            SEVERITY_NOMINAL,   0, 0 },
+    { "KILL",           "KILL",             KILL,           SEVERITY_NOMINAL,   1, 0 },
+    { "SOH",            "SOH",              SOH,            SEVERITY_NOMINAL,   0, 0 },
+    { "GOOD",           "GOOD Health",      GOOD,           SEVERITY_NOMINAL,   0, 0 },
+    { "BAD",            "BAD Health",       BAD,            SEVERITY_CAUTION,   0, 0 },
+    { "ICING_ALARM",    "ICING",            ICING_ALARM,    SEVERITY_ALARM,     0, 0 },
+    { "OVERHEAT_ALARM", "OVERHEAT",         OVERHEAT_ALARM, SEVERITY_ALARM,     0, 0 },
+    { "SENSOR_1_ALARM", "SENSOR_1_ALARM",   SENSOR_1_ALARM, SEVERITY_ALARM,     0, 0 },
+    { "SENSOR_2_ALARM", "SENSOR_2_ALARM",   SENSOR_2_ALARM, SEVERITY_ALARM,     0, 0 },
+    { "SENSOR_3_ALARM", "SENSOR_3_ALARM",   SENSOR_3_ALARM, SEVERITY_ALARM,     0, 0 },
+    { "SENSOR_4_ALARM", "SENSOR_4_ALARM",   SENSOR_4_ALARM, SEVERITY_ALARM,     0, 0 },
+    { "SENSOR_5_ALARM", "SENSOR_5_ALARM",   SENSOR_5_ALARM, SEVERITY_ALARM,     0, 0 },
+    { "STAMP",          "STAMP",            STAMP,          SEVERITY_NOMINAL,   0, 1 },
+};
+
+#define BUILTIN_COMMAND_COUNT (sizeof(builtinCommands) / sizeof(builtinCommands[0]))
+
+// The command dictionary in use, replaced by dictionaryLoad()
+const struct command *commandTable = builtinCommands;
+unsigned int commandCount = BUILTIN_COMMAND_COUNT;
 
 /**
 * Loops through the value passed to the function and converts to a
@@ -61,19 +175,18 @@ void printBits(size_t const size, void const * const ptr)
 
 /**
 * Causes delay in processing for the amount of milliseconds that was passed to
-* the function.
+* the function. Sleeps on the monotonic clock, so the delay is wall time and
+* does not consume the processor.
 *
 * @param milliseconds
 * @return void
 */
 void delay(int milliseconds)
 {
-    long pause;
-    clock_t now,then;
+    struct timespec pause = { milliseconds / 1000, (milliseconds % 1000) * 1000000L };
 
-    pause = milliseconds * (CLOCKS_PER_SEC / 1000);
-    now = then = clock();
-
-    while((now - then) < pause)
-        now = clock();
+    while (clock_nanosleep(CLOCK_MONOTONIC, 0, &pause, &pause) == EINTR)
+        ;
 }
+
+#endif
@@ -0,0 +1,425 @@
+#ifndef CONSTELLATION_H
+#define CONSTELLATION_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include "frame.h"
+#include "logger.h"
+#include "metrics.h"
+#include "schedule.h"
+#include "integrity.h"
+
+/**
+* A constellation load generator for the simulator. Every vehicle is an
+* independent spacecraft stream with its own connection, frame counter, health
+* scenario, scheduler and frame pool, and vehicle i is served by worker thread
+* (i % threads). Sockets are non-blocking: a worker queues the frames of every
+* due tick with one writev, keeps whatever the socket did not take as a backlog
+* to resume first, and otherwise sleeps in epoll_wait until a blocked socket
+* turns writable or a timerfd armed at the earliest deadline of its vehicles
+* fires. A vehicle past its time limit sends a KILL frame and closes.
+*
+* @author Vincent Nigro
+* @version 0.0.2
+*/
+
+#define CONSTELLATION_MAX_VEHICLES 4096
+#define CONSTELLATION_MAX_THREADS 64
+#define CONSTELLATION_MAX_SCENARIOS 16
+#define CONSTELLATION_POOL_FRAMES 64
+#define CONSTELLATION_EVENTS 64
+
+struct vehicle
+{
+    unsigned int id;
+    int fd;
+    int finished;
+    unsigned long health;
+    unsigned long frameCount;
+    unsigned long seq;
+    unsigned long frames;
+    unsigned long start;
+    unsigned long stop;
+    unsigned int pending;
+    unsigned int iovFirst;
+    unsigned int iovCount;
+    struct scheduler scheduler;
+    struct framePool pool;
+    struct iovec iov[CONSTELLATION_POOL_FRAMES];
+};
+
+struct constellation;
+
+struct constellationWorker
+{
+    struct constellation *owner;
+    unsigned int index;
+    pthread_t thread;
+};
+
+/**
+* Settings shared by every vehicle: the time limit, whether frames are
+* stamped, the scheduler each vehicle copies and the health scenarios assigned
+* to vehicles round robin.
+*/
+struct constellation
+{
+    unsigned int vehicleCount;
+    unsigned int threadCount;
+    double seconds;
+    int stamp;
+    int debug;
+    struct scheduler scheduler;
+    unsigned long healths[CONSTELLATION_MAX_SCENARIOS];
+    unsigned int healthCount;
+    struct vehicle *vehicles;
+    struct constellationWorker workers[CONSTELLATION_MAX_THREADS];
+};
+
+void constellationRun(struct constellation*, const int*);
+int vehicleFlush(struct vehicle*);
+unsigned long vehicleStep(struct constellation*, struct vehicle*, unsigned long);
+void *constellationWorkerMain(void*);
+void constellationReport(const struct constellation*, unsigned long);
+
+/**
+* Writes as much of the backlog of a vehicle as its socket takes, returning
+* zero while part of it is still queued.
+*
+* @param v
+* @return int
+*/
+int vehicleFlush(struct vehicle *v)
+{
+    ssize_t written;
+    struct iovec *iov;
+
+    while (v->iovCount > 0)
+    {
+        iov = &v->iov[v->iovFirst];
+
+        if ((written = writev(v->fd, iov, v->iovCount)) == -1)
+        {
+            if (errno == EINTR)
+                continue;
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+
+            printf("Vehicle %u writev call failed: %s.\n", v->id, strerror(errno));
+            exit(1);
+        }
+
+        // Skips the iovecs written in full and trims a partially written one
+        while (v->iovCount > 0 && (size_t)written >= iov->iov_len)
+        {
+            written -= iov->iov_len;
+            iov++;
+            v->iovFirst++;
+            v->iovCount--;
+        }
+
+        if (v->iovCount > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return 1;
+}
+
+/**
+* Advances a vehicle by at most one batch of frames. Returns the time the
+* vehicle next has work, which is now when it can go on at once, its next
+* deadline when it waits for the schedule and ULONG_MAX when it waits for its
+* socket or is done.
+*
+* @param c
+* @param v
+* @param now
+* @return unsigned long
+*/
+unsigned long vehicleStep(struct constellation *c, struct vehicle *v, unsigned long now)
+{
+    char *frame;
+    unsigned int batch;
+    unsigned long due, stage;
+
+    if (!vehicleFlush(v))
+        return ULONG_MAX;
+
+    // The KILL frame has gone out in full
+    if (v->finished)
+    {
+        close(v->fd);
+        v->fd = -1;
+        v->stop = now;
+        return ULONG_MAX;
+    }
+
+    if (v->pending == 0)
+    {
+        if ((due = scheduleDue(&v->scheduler, now)) > now)
+            return due;
+
+        v->pending = scheduleUnpaced(&v->scheduler) ? v->pool.count : scheduleTick(&v->scheduler, due, now);
+    }
+
+    batch = v->pending < v->pool.count ? v->pending : v->pool.count;
+
+    // The first frame past the time limit ends the stream on its own
+    if ((now - v->start) / 1e9 >= c->seconds)
+    {
+        v->finished = 1;
+        batch = 1;
+    }
+
+    stage = metricStart();
+
+    for (unsigned int i = 0; i < batch; i++)
+    {
+        frame = framePoolFrame(&v->pool, i);
+
+        // The KILL frame is generated afresh, a stamp left in its slot would be stale
+        if (v->finished)
+            generateSOHCheck(frame, &v->health, &v->finished);
+        else if (c->stamp)
+            stampFrame(frame);
+
+        if (frameGeometry.trailerWords)
+            sealFrame(frame, v->seq++);
+
+        v->iov[i].iov_base = frame;
+        v->iov[i].iov_len = frameGeometry.frameBytes;
+    }
+    metricStop(STAGE_GENERATE, stage, batch);
+
+    v->iovFirst = 0;
+    v->iovCount = batch;
+    v->pending -= batch;
+
+    metricAdd(METRIC_FRAMES, batch);
+    metricAdd(METRIC_BYTES, batch * frameGeometry.frameBytes);
+
+    for (unsigned int i = 0; !v->finished && i < batch; i++)
+    {
+        if (c->debug)
+        {
+            printf("\nVehicle %u Major Frame %lu Dump\n", v->id, v->frameCount);
+            printBits(frameGeometry.frameBytes, framePoolFrame(&v->pool, i));
+        }
+        logRecord(LOG_VEHICLE_SENT, v->id, v->frameCount++, NULL);
+    }
+
+    if (!v->finished)
+        v->frames += batch;
+
+    vehicleFlush(v);
+    return now;
+}
+
+/**
+* Serves the vehicles of one worker until all of them have sent their KILL
+* frame, sleeping in epoll_wait whenever none of them can go on.
+*
+* @param arg
+* @return void*
+*/
+void *constellationWorkerMain(void *arg)
+{
+    struct constellationWorker *worker = arg;
+    struct constellation *c = worker->owner;
+    struct vehicle *v;
+    struct epoll_event ev, events[CONSTELLATION_EVENTS];
+    struct itimerspec timer;
+    unsigned long now, due, next, expirations;
+    unsigned int active = 0;
+    int epoll_fd, timer_fd, ready;
+
+    if ((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) == -1 ||
+        (timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1)
+    {
+        printf("Unable to set up constellation worker %u: %s.\n", worker->index, strerror(errno));
+        exit(1);
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev);
+
+    // Blocked sockets report once when they turn writable again
+    for (unsigned int i = worker->index; i < c->vehicleCount; i += c->threadCount)
+    {
+        v = &c->vehicles[i];
+        ev.events = EPOLLOUT | EPOLLET;
+        ev.data.ptr = v;
+
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, v->fd, &ev) == -1)
+        {
+            printf("epoll_ctl call failed: %s.\n", strerror(errno));
+            exit(1);
+        }
+        v->start = metricsNow();
+        active++;
+    }
+
+    while (active > 0)
+    {
+        now = metricsNow();
+        next = ULONG_MAX;
+        active = 0;
+
+        for (unsigned int i = worker->index; i < c->vehicleCount; i += c->threadCount)
+        {
+            v = &c->vehicles[i];
+
+            if (v->fd == -1)
+                continue;
+
+            due = vehicleStep(c, v, now);
+            active += v->fd != -1;
+
+            if (due < next)
+                next = due;
+        }
+
+        // Every vehicle waits on its schedule or its socket
+        if (active > 0 && next > now)
+        {
+            memset(&timer, 0, sizeof(timer));
+
+            if (next != ULONG_MAX)
+            {
+                timer.it_value.tv_sec = next / 1000000000UL;
+                timer.it_value.tv_nsec = next % 1000000000UL;
+            }
+            timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &timer, NULL);
+
+            if ((ready = epoll_wait(epoll_fd, events, CONSTELLATION_EVENTS, -1)) == -1 && errno != EINTR)
+            {
+                printf("epoll_wait call failed: %s.\n", strerror(errno));
+                exit(1);
+            }
+
+            for (int i = 0; i < ready; i++)
+            {
+                if (events[i].data.ptr == NULL)
+                    read(timer_fd, &expirations, sizeof(expirations));
+            }
+        }
+    }
+
+    close(timer_fd);
+    close(epoll_fd);
+    return NULL;
+}
+
+/**
+* Runs a constellation over connected sockets, one per vehicle, and prints the
+* send rate of every vehicle and of the whole constellation once every vehicle
+* has ended its stream.
+*
+* @param c
+* @param fds
+* @return void
+*/
+void constellationRun(struct constellation *c, const int *fds)
+{
+    unsigned long start;
+
+    if ((c->vehicles = calloc(c->vehicleCount, sizeof(*c->vehicles))) == NULL)
+    {
+        printf("Unable to allocate %u vehicles.\n", c->vehicleCount);
+        exit(1);
+    }
+
+    for (unsigned int i = 0; i < c->vehicleCount; i++)
+    {
+        struct vehicle *v = &c->vehicles[i];
+
+        v->id = i + 1;
+        v->fd = fds[i];
+        v->frameCount = 1;
+        v->health = c->healths[i % c->healthCount];
+        v->scheduler = c->scheduler;
+
+        if (framePoolInit(&v->pool, &v->health, CONSTELLATION_POOL_FRAMES) == -1)
+        {
+            printf("Unable to allocate frame pool of vehicle %u.\n", v->id);
+            exit(1);
+        }
+
+        if (fcntl(v->fd, F_SETFL, fcntl(v->fd, F_GETFL) | O_NONBLOCK) == -1)
+        {
+            printf("fcntl call failed: %s.\n", strerror(errno));
+            exit(1);
+        }
+    }
+
+    printf("Sending %u vehicles over %u threads.\n", c->vehicleCount, c->threadCount);
+    start = metricsNow();
+
+    for (unsigned int i = 0; i < c->threadCount; i++)
+    {
+        c->workers[i].owner = c;
+        c->workers[i].index = i;
+
+        if (pthread_create(&c->workers[i].thread, NULL, constellationWorkerMain, &c->workers[i]) != 0)
+        {
+            printf("Unable to start constellation worker %u.\n", i);
+            exit(1);
+        }
+    }
+
+    for (unsigned int i = 0; i < c->threadCount; i++)
+        pthread_join(c->workers[i].thread, NULL);
+
+    constellationReport(c, metricsNow() - start);
+
+    for (unsigned int i = 0; i < c->vehicleCount; i++)
+        framePoolFree(&c->vehicles[i].pool);
+
+    free(c->vehicles);
+}
+
+/**
+* Prints the frames and send rate of every vehicle followed by the totals of
+* the constellation.
+*
+* @param c
+* @param elapsed
+* @return void
+*/
+void constellationReport(const struct constellation *c, unsigned long elapsed)
+{
+    const struct vehicle *v;
+    unsigned long frames = 0, late = 0;
+    double seconds;
+
+    for (unsigned int i = 0; i < c->vehicleCount; i++)
+    {
+        v = &c->vehicles[i];
+        seconds = (v->stop - v->start) / 1e9;
+        frames += v->frames;
+        late += v->scheduler.late;
+
+        printf("Vehicle %u sent %lu frames in %.3f s: %.0f frames per second, %.3f MB/s, %lu ticks late.\n",
+            v->id, v->frames, seconds, v->frames / seconds, v->frames * frameGeometry.frameBytes / seconds / 1e6,
+            v->scheduler.late);
+    }
+
+    seconds = elapsed / 1e9;
+    printf("Constellation sent %lu frames in %.3f s: %.0f frames per second, %.3f MB/s, %lu ticks late.\n",
+        frames, seconds, frames / seconds, frames * frameGeometry.frameBytes / seconds / 1e6, late);
+}
+
+#endif
@@ -0,0 +1,225 @@
+#ifndef DATAGRAM_H
+#define DATAGRAM_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include "metrics.h"
+#include "sequence.h"
+
+/**
+* The UDP datagram transport shared by sim and mdp. Each datagram carries a
+* header with a magic word, a sequence number counted per sender and the
+* number of whole major frames following it. The simulator gathers the header
+* and the frames of each datagram straight from the frame pool and sends up to
+* DATAGRAM_VLEN datagrams per sendmmsg call; the MDP receives as many with one
+* recvmmsg call and tracks the sequence numbers of each sender, counting gaps,
+* the datagrams missing in them, late arrivals filling a gap and duplicates.
+*
+* @author Vincent Nigro
+* @version 0.0.2
+*/
+
+#define DATAGRAM_MAGIC 0x444D4C54U
+#define DATAGRAM_MAX_BYTES 65507
+#define DATAGRAM_MAX_FRAMES 64
+#define DATAGRAM_DEFAULT_FRAMES 8
+#define DATAGRAM_VLEN 64
+#define DATAGRAM_KILL_COPIES 3
+#define DATAGRAM_RCVBUF (8 << 20)
+
+struct datagramHeader
+{
+    uint32_t magic;
+    uint16_t frames;
+    uint16_t reserved;
+    uint64_t seq;
+};
+
+struct datagramSender
+{
+    int fd;
+    unsigned int framesPer;
+    unsigned int last;
+    unsigned long seq;
+    unsigned long calls;
+    unsigned long refused;
+    struct datagramHeader headers[DATAGRAM_VLEN];
+    struct mmsghdr msgs[DATAGRAM_VLEN];
+    struct iovec iov[DATAGRAM_VLEN][DATAGRAM_MAX_FRAMES + 1];
+};
+
+int datagramFramesFit(unsigned int, size_t);
+void datagramSenderInit(struct datagramSender*, int, unsigned int);
+void datagramSend(struct datagramSender*, const struct iovec*, unsigned int);
+void datagramResend(struct datagramSender*, unsigned int);
+void datagramSendBatch(struct datagramSender*, unsigned int);
+char *datagramFrames(char*, size_t, size_t, unsigned int*, unsigned long*);
+
+/**
+* Returns whether a datagram of the given number of frames fits within the
+* largest UDP payload.
+*
+* @param frames
+* @param frameBytes
+* @return int
+*/
+int datagramFramesFit(unsigned int frames, size_t frameBytes)
+{
+    return frames >= 1 && frames <= DATAGRAM_MAX_FRAMES &&
+        sizeof(struct datagramHeader) + frames * frameBytes <= DATAGRAM_MAX_BYTES;
+}
+
+/**
+* Sets up a sender of datagrams of up to framesPer frames on a connected
+* datagram socket.
+*
+* @param s
+* @param fd
+* @param framesPer
+* @return void
+*/
+void datagramSenderInit(struct datagramSender *s, int fd, unsigned int framesPer)
+{
+    memset(s, 0, sizeof(*s));
+
+    s->fd = fd;
+    s->framesPer = framesPer;
+}
+
+/**
+* Sends the first count prepared datagrams of a sender, retrying interrupted
+* calls. Datagrams refused because nothing listens at the peer yet are counted
+* and skipped, as a lost datagram would be.
+*
+* @param s
+* @param count
+* @return void
+*/
+void datagramSendBatch(struct datagramSender *s, unsigned int count)
+{
+    int sent;
+
+    for (unsigned int done = 0; done < count; done += sent)
+    {
+        s->calls++;
+
+        if ((sent = sendmmsg(s->fd, s->msgs + done, count - done, 0)) == -1)
+        {
+            if (errno == EINTR)
+            {
+                sent = 0;
+                continue;
+            }
+
+            if (errno == ECONNREFUSED)
+            {
+                s->refused++;
+                sent = 1;
+                continue;
+            }
+
+            printf("sendmmsg call failed: %s.\n", strerror(errno));
+            exit(1);
+        }
+    }
+}
+
+/**
+* Sends a run of frames as datagrams of up to framesPer frames each, every
+* datagram gathering its header and frames without copying them.
+*
+* @param s
+* @param frames
+* @param count
+* @return void
+*/
+void datagramSend(struct datagramSender *s, const struct iovec *frames, unsigned int count)
+{
+    unsigned int msgs, n;
+    struct datagramHeader *header;
+
+    while (count > 0)
+    {
+        for (msgs = 0; count > 0 && msgs < DATAGRAM_VLEN; msgs++)
+        {
+            n = count < s->framesPer ? count : s->framesPer;
+
+            header = &s->headers[msgs];
+            header->magic = DATAGRAM_MAGIC;
+            header->frames = n;
+            header->reserved = 0;
+            header->seq = s->seq++;
+
+            s->iov[msgs][0].iov_base = header;
+            s->iov[msgs][0].iov_len = sizeof(*header);
+            memcpy(&s->iov[msgs][1], frames, n * sizeof(*frames));
+
+            memset(&s->msgs[msgs], 0, sizeof(s->msgs[msgs]));
+            s->msgs[msgs].msg_hdr.msg_iov = s->iov[msgs];
+            s->msgs[msgs].msg_hdr.msg_iovlen = n + 1;
+
+            frames += n;
+            count -= n;
+        }
+
+        datagramSendBatch(s, msgs);
+        s->last = msgs - 1;
+    }
+}
+
+/**
+* Sends the last datagram again the given number of times under its original
+* sequence number, so a final KILL frame survives the loss of a copy. The
+* frames of the datagram must still be in place.
+*
+* @param s
+* @param copies
+* @return void
+*/
+void datagramResend(struct datagramSender *s, unsigned int copies)
+{
+    for (unsigned int i = 0; i < copies; i++)
+    {
+        if (s->last != 0)
+            s->msgs[0] = s->msgs[s->last];
+
+        s->last = 0;
+        datagramSendBatch(s, 1);
+    }
+}
+
+/**
+* Validates a received datagram, returning its frames along with their count
+* and the sequence number, or NULL when it is malformed.
+*
+* @param data
+* @param length
+* @param frameBytes
+* @param count
+* @param seq
+* @return char*
+*/
+char *datagramFrames(char *data, size_t length, size_t frameBytes, unsigned int *count, unsigned long *seq)
+{
+    struct datagramHeader header;
+
+    if (length < sizeof(header))
+        return NULL;
+
+    memcpy(&header, data, sizeof(header));
+
+    if (header.magic != DATAGRAM_MAGIC || header.frames == 0 ||
+        length != sizeof(header) + header.frames * frameBytes)
+        return NULL;
+
+    *count = header.frames;
+    *seq = header.seq;
+    return data + sizeof(header);
+}
+
+#endif
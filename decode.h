@@ -0,0 +1,327 @@
+#ifndef DECODE_H
+#define DECODE_H
+
+#include <stddef.h>
+#include <string.h>
+#include "commands.h"
+#include "scan.h"
+#include "dispatch.h"
+
+/**
+* Major frame decoding for the MDP, split into a side effect free decode step
+* and the command handling step. Decoding strips the header and resolves every
+* command minor frame to its dispatch entry; handling then runs the resolved
+* command handlers in order. Keeping the two apart allows frames to be decoded
+* on any thread while commands are still handled in frame order.
+*
+* @author Vincent Nigro
+* @version 0.0.2
+*/
+
+#define DECODE_BATCH 64
+#define DECODED_FRAME_BYTES(frameSize) \
+    (sizeof(struct decodedFrame) + (frameSize) * sizeof(const struct dispatchEntry *))
+
+/**
+* The decoded form of one major frame: the header width in minor frames, the
+* number of commands following it and the dispatch entry of each command.
+* Arrays of decoded frames are laid out with a stride of decodedFrameBytes()
+* and indexed through decodedFrameAt().
+*/
+struct decodedFrame
+{
+    int headerSize;
+    int commands;
+    const struct dispatchEntry *entries[];
+};
+
+typedef void (*decodeKernel)(const char*, size_t, struct decodedFrame*);
+
+void decodeInit();
+const char *decodeKernelName();
+size_t decodedFrameBytes();
+struct decodedFrame *decodedFrameAt(struct decodedFrame*, size_t);
+int removeHeader(const struct scanMasks*, size_t);
+void decodeMajorFrame(const char*, const struct scanMasks*, size_t, struct decodedFrame*);
+void decodeFramesGeneric(const char*, size_t, struct decodedFrame*);
+int handleMajorFrame(char*, const struct decodedFrame*);
+int commandHandler(const struct dispatchEntry*, unsigned long*);
+
+static decodeKernel decodeFrames = decodeFramesGeneric;
+static const char *decodeName = "generic";
+
+/**
+* Returns the size of one decoded frame of the current frame geometry.
+*
+* @return size_t
+*/
+size_t decodedFrameBytes()
+{
+    return DECODED_FRAME_BYTES(frameGeometry.frameSize);
+}
+
+/**
+* Returns decoded frame i of an array of decoded frames.
+*
+* @param decoded
+* @param i
+* @return struct decodedFrame*
+*/
+struct decodedFrame *decodedFrameAt(struct decodedFrame *decoded, size_t i)
+{
+    return (struct decodedFrame *)((char *)decoded + i * decodedFrameBytes());
+}
+
+/**
+* Counts the header minor frames of the major frame starting at minor frame
+* first of the scanned buffer and returns the minor frame count that is
+* consumed by the header in order to jump over during processing of commands.
+*
+* @param masks
+* @param first
+* @return int
+*/
+int removeHeader(const struct scanMasks *masks, size_t first)
+{
+    return scanNextClear(masks, offsetof(struct scanMasks, header), first,
+        first + frameGeometry.frameSize) - first;
+}
+
+/**
+* Resolves the commands of a decoded frame to their dispatch entries once its
+* header width and command count are known.
+*
+* @param frame
+* @param decoded
+* @return void
+*/
+static inline __attribute__((always_inline)) void decodeCommands(const char *frame,
+    struct decodedFrame *decoded)
+{
+    unsigned long command;
+    const struct dispatchEntry *entry;
+
+    for (int i = 0; i < decoded->commands; i++)
+    {
+        memcpy(&command, frame + (decoded->headerSize + i) * sizeof(unsigned long), sizeof(command));
+        entry = decoded->entries[i] = dispatchLookup(command);
+
+        // Operand minor frames go to the operand handler of their command
+        for (int n = 0; entry->operand != NULL && n < entry->command->operands &&
+            i + 1 < decoded->commands; n++)
+            decoded->entries[++i] = entry->operand;
+    }
+}
+
+/**
+* Decodes the major frame starting at minor frame first of the scanned buffer,
+* resolving each command through the END or KILL minor frame, or up to an empty
+* minor frame, to its dispatch entry.
+*
+* @param frame
+* @param masks
+* @param first
+* @param decoded
+* @return void
+*/
+void decodeMajorFrame(const char *frame, const struct scanMasks *masks, size_t first,
+    struct decodedFrame *decoded)
+{
+    size_t start, last = first + frameGeometry.frameSize, stop, zero;
+
+    // Counts minor frames consumed by header
+    decoded->headerSize = removeHeader(masks, first);
+    start = first + decoded->headerSize;
+
+    stop = scanNextSet(masks, offsetof(struct scanMasks, stop), start, last);
+    zero = scanNextSet(masks, offsetof(struct scanMasks, zero), start, last);
+    decoded->commands = (stop < zero ? stop + 1 : zero) - start;
+
+    decodeCommands(frame, decoded);
+}
+
+/**
+* Decodes a contiguous run of major frames of any geometry, scanning
+* DECODE_BATCH frames at a time with the selected scanning kernel.
+*
+* @param frames
+* @param count
+* @param decoded
+* @return void
+*/
+void decodeFramesGeneric(const char *frames, size_t count, struct decodedFrame *decoded)
+{
+    size_t batch;
+    const size_t frameSize = frameGeometry.frameSize;
+    struct scanMasks masks[SCAN_BLOCKS(DECODE_BATCH * FRAME_MAX_SIZE)];
+
+    for (size_t done = 0; done < count; done += batch)
+    {
+        batch = count - done < DECODE_BATCH ? count - done : DECODE_BATCH;
+
+        scanWords((const unsigned long *)(frames + done * frameSize * sizeof(unsigned long)),
+            batch * frameSize, masks);
+
+        for (size_t i = 0; i < batch; i++)
+            decodeMajorFrame(frames + (done + i) * frameSize * sizeof(unsigned long),
+                masks, i * frameSize, decodedFrameAt(decoded, done + i));
+    }
+}
+
+/**
+* Decodes one major frame of a frame size dividing SCAN_BLOCK_WORDS, whose
+* masks all lie in a single word of its scan block starting at bit shift. The
+* header, stop and zero searches become a shift, a mask and a count of
+* trailing zeros each.
+*
+* @param frame
+* @param block
+* @param shift
+* @param decoded
+* @param frameSize
+* @return void
+*/
+static inline __attribute__((always_inline)) void decodeFixedFrame(const char *frame,
+    const struct scanMasks *block, unsigned int shift, struct decodedFrame *decoded, const int frameSize)
+{
+    int end;
+    unsigned long window = frameSize == SCAN_BLOCK_WORDS ? ~0UL : (1UL << frameSize) - 1;
+    unsigned long header = (block->header >> shift) & window, rest, stop, zero;
+
+    decoded->headerSize = header == window ? frameSize : __builtin_ctzl(~header);
+    rest = decoded->headerSize == frameSize ? 0 : window & (~0UL << decoded->headerSize);
+
+    stop = (block->stop >> shift) & rest;
+    zero = (block->zero >> shift) & rest;
+
+    // Through the first END or KILL, or up to the first empty minor frame
+    end = stop ? __builtin_ctzl(stop) + 1 : frameSize;
+    if (zero && __builtin_ctzl(zero) < end)
+        end = __builtin_ctzl(zero);
+
+    decoded->commands = end - decoded->headerSize;
+    decodeCommands(frame, decoded);
+}
+
+/**
+* Decodes a contiguous run of major frames of a frame size fixed at compile
+* time, the body of the specialized decoding kernels.
+*
+* @param frames
+* @param count
+* @param decoded
+* @param frameSize
+* @return void
+*/
+static inline __attribute__((always_inline)) void decodeFixed(const char *frames, size_t count,
+    struct decodedFrame *decoded, const int frameSize)
+{
+    size_t batch, first;
+    struct decodedFrame *frame;
+    const size_t frameBytes = frameSize * sizeof(unsigned long);
+    const size_t stride = DECODED_FRAME_BYTES(frameSize);
+    struct scanMasks masks[SCAN_BLOCKS(DECODE_BATCH * FRAME_MAX_SIZE)];
+
+    for (size_t done = 0; done < count; done += batch)
+    {
+        batch = count - done < DECODE_BATCH ? count - done : DECODE_BATCH;
+
+        scanWords((const unsigned long *)(frames + done * frameBytes), batch * frameSize, masks);
+
+        for (size_t i = 0; i < batch; i++)
+        {
+            first = i * frameSize;
+            frame = (struct decodedFrame *)((char *)decoded + (done + i) * stride);
+
+            // Frames straddling scan blocks take the generic search
+            if (SCAN_BLOCK_WORDS % frameSize == 0)
+                decodeFixedFrame(frames + (done + i) * frameBytes, &masks[first / SCAN_BLOCK_WORDS],
+                    first % SCAN_BLOCK_WORDS, frame, frameSize);
+            else
+                decodeMajorFrame(frames + (done + i) * frameBytes, masks, first, frame);
+        }
+    }
+}
+
+// One decoding kernel per geometry of FRAME_GEOMETRIES
+#define DECODE_SPECIALIZE(SIZE, HEADER) \
+void decodeFrames##SIZE##x##HEADER(const char *frames, size_t count, struct decodedFrame *decoded) \
+{ \
+    decodeFixed(frames, count, decoded, SIZE); \
+}
+FRAME_GEOMETRIES(DECODE_SPECIALIZE)
+#undef DECODE_SPECIALIZE
+
+/**
+* Selects the decoding kernel for the current frame geometry, falling back to
+* the generic kernel for geometries without a specialized one.
+*
+* @return void
+*/
+void decodeInit()
+{
+    decodeFrames = decodeFramesGeneric;
+    decodeName = "generic";
+
+#define DECODE_SELECT(SIZE, HEADER) \
+    if (frameGeometry.frameSize == SIZE && frameGeometry.headerWidth == HEADER) \
+    { \
+        decodeFrames = decodeFrames##SIZE##x##HEADER; \
+        decodeName = #SIZE "x" #HEADER; \
+    }
+    FRAME_GEOMETRIES(DECODE_SELECT)
+#undef DECODE_SELECT
+}
+
+/**
+* Returns the name of the selected decoding kernel.
+*
+* @return const char*
+*/
+const char *decodeKernelName()
+{
+    return decodeName;
+}
+
+/**
+* Processes a single decoded major frame and runs the commands within each
+* minor frame, up to and including the terminating one.
+*
+* @param buffer
+* @param decoded
+* @return int
+*/
+int handleMajorFrame(char *buffer, const struct decodedFrame *decoded)
+{
+    int executing = 1;
+    unsigned long command;
+    unsigned long *minorFrame = (unsigned long *)(buffer + (sizeof(unsigned long) * decoded->headerSize));
+
+    for (int i = 0; executing && i < decoded->commands; i++)
+    {
+        memcpy(&command, minorFrame + i, sizeof(command));
+
+        executing = commandHandler(decoded->entries[i], &command);
+    }
+    return executing;
+}
+
+/**
+* Handles a command coming into the MDP by running the handler of its resolved
+* dispatch entry.
+*
+* @param entry
+* @param command
+* @return int
+*/
+int commandHandler(const struct dispatchEntry *entry, unsigned long *command)
+{
+    dispatchCounts[entry->slot]++;
+
+    if (entry->command != NULL)
+        metricAdd(METRIC_COMMANDS, 1);
+
+    return entry->handler(entry, *command);
+}
+
+#endif
@@ -0,0 +1,244 @@
+#ifndef DICTIONARY_H
+#define DICTIONARY_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "commands.h"
+
+/**
+* Telemetry dictionary files, loaded at startup by mdp and sim so commands can
+* be added or changed without rebuilding either. Each line of a dictionary
+* describes one command as whitespace separated fields:
+*
+*   NAME CODE SEVERITY TERMINAL OPERANDS [LABEL]
+*
+* CODE is a 64 bit word in decimal or 0x prefixed hex, SEVERITY one of NOMINAL,
+* CAUTION or ALARM, TERMINAL 1 for commands ending the session and OPERANDS
+* the number of minor frames following the command that carry its argument.
+* The label is the rest of the line and defaults to the name. Blank lines and
+* lines starting with # are ignored.
+*
+* The built-in commands are loaded first; a line naming a built-in command or
+* reusing its code replaces it. The empty word and the H1/H2 header words are
+* never commands, and END and KILL keep their codes as they frame every major
+* frame.
+*
+* @author Vincent Nigro
+* @version 0.0.2
+*/
+
+#define DICTIONARY_LINE 512
+
+int dictionaryLoad(const char*);
+int dictionaryParse(const char*, int, char*, struct command**, unsigned int*, unsigned int*);
+int dictionarySeverity(const char*, int*);
+const struct command *dictionaryFind(const char*);
+unsigned long dictionaryCode(const char*, unsigned long);
+
+/**
+* Parses a severity name or number.
+*
+* @param text
+* @param severity
+* @return int
+*/
+int dictionarySeverity(const char *text, int *severity)
+{
+    char *end;
+
+    if (strcmp(text, "NOMINAL") == 0)
+        *severity = SEVERITY_NOMINAL;
+    else if (strcmp(text, "CAUTION") == 0)
+        *severity = SEVERITY_CAUTION;
+    else if (strcmp(text, "ALARM") == 0)
+        *severity = SEVERITY_ALARM;
+    else if ((*severity = strtol(text, &end, 10)) < SEVERITY_NOMINAL || *severity > SEVERITY_ALARM || *end)
+        return 0;
+
+    return 1;
+}
+
+/**
+* Returns the command of a name in the dictionary, or NULL.
+*
+* @param name
+* @return const struct command*
+*/
+const struct command *dictionaryFind(const char *name)
+{
+    for (unsigned int i = 0; i < commandCount; i++)
+    {
+        if (strcmp(commandTable[i].name, name) == 0)
+            return &commandTable[i];
+    }
+    return NULL;
+}
+
+/**
+* Returns the code of a named command in the dictionary, or fallback when the
+* dictionary does not hold it.
+*
+* @param name
+* @param fallback
+* @return unsigned long
+*/
+unsigned long dictionaryCode(const char *name, unsigned long fallback)
+{
+    const struct command *command = dictionaryFind(name);
+
+    return command != NULL ? command->code : fallback;
+}
+
+/**
+* Parses one dictionary line into the commands, replacing the command of the
+* same name or code or appending a new one. Prints the problem and returns -1
+* for an invalid line.
+*
+* @param path
+* @param lineNumber
+* @param line
+* @param commands
+* @param count
+* @param capacity
+* @return int
+*/
+int dictionaryParse(const char *path, int lineNumber, char *line, struct command **commands,
+    unsigned int *count, unsigned int *capacity)
+{
+    int severity;
+    unsigned int i;
+    struct command parsed, *grown, *table = *commands;
+    char *name, *code, *fields[3], *label, *save, *end;
+
+    line[strcspn(line, "\r\n")] = '\0';
+
+    if ((name = strtok_r(line, " \t", &save)) == NULL || name[0] == '#')
+        return 0;
+
+    code = strtok_r(NULL, " \t", &save);
+    for (i = 0; i < 3; i++)
+        fields[i] = strtok_r(NULL, " \t", &save);
+
+    // The label is the remainder of the line
+    label = save + strspn(save, " \t");
+
+    errno = 0;
+    parsed.code = code != NULL ? strtoul(code, &end, 0) : 0;
+
+    if (code == NULL || *end || errno || fields[2] == NULL || !dictionarySeverity(fields[0], &severity) ||
+        (strcmp(fields[1], "0") != 0 && strcmp(fields[1], "1") != 0) ||
+        (parsed.operands = strtol(fields[2], &end, 10)) < 0 || *end)
+    {
+        printf("Dictionary %s line %d: expected NAME CODE SEVERITY TERMINAL OPERANDS [LABEL].\n",
+            path, lineNumber);
+        return -1;
+    }
+
+    if (parsed.code == 0 || parsed.code == H1 || parsed.code == H2)
+    {
+        printf("Dictionary %s line %d: %s uses a reserved word.\n", path, lineNumber, name);
+        return -1;
+    }
+
+    for (i = 0; i < *count; i++)
+    {
+        if (strcmp(table[i].name, name) == 0 || table[i].code == parsed.code)
+            break;
+    }
+
+    if (i < *count && table[i].code != parsed.code && (table[i].code == END || table[i].code == KILL ||
+        parsed.code == END || parsed.code == KILL))
+    {
+        printf("Dictionary %s line %d: END and KILL keep their codes.\n", path, lineNumber);
+        return -1;
+    }
+
+    // A replacement must not collide with a further command
+    for (unsigned int j = i + 1; j < *count; j++)
+    {
+        if (strcmp(table[j].name, name) == 0 || table[j].code == parsed.code)
+        {
+            printf("Dictionary %s line %d: %s clashes with %s.\n", path, lineNumber, name, table[j].name);
+            return -1;
+        }
+    }
+
+    parsed.severity = severity;
+    parsed.terminal = fields[1][0] == '1';
+    parsed.name = strdup(name);
+    parsed.label = strdup(*label ? label : name);
+
+    if (parsed.name == NULL || parsed.label == NULL)
+    {
+        printf("Unable to allocate dictionary %s.\n", path);
+        return -1;
+    }
+
+    if (i == *count)
+    {
+        if (*count == *capacity)
+        {
+            if ((grown = realloc(table, 2 * *capacity * sizeof(*table))) == NULL)
+            {
+                printf("Unable to allocate dictionary %s.\n", path);
+                return -1;
+            }
+            *commands = table = grown;
+            *capacity *= 2;
+        }
+        (*count)++;
+    }
+    table[i] = parsed;
+
+    return 0;
+}
+
+/**
+* Loads a dictionary file over the built-in commands and makes it the command
+* table. Returns -1 when the file cannot be read or holds an invalid command,
+* leaving the command table unchanged.
+*
+* @param path
+* @return int
+*/
+int dictionaryLoad(const char *path)
+{
+    FILE *file;
+    int lineNumber = 0, status = 0;
+    unsigned int count = BUILTIN_COMMAND_COUNT, capacity = BUILTIN_COMMAND_COUNT;
+    char line[DICTIONARY_LINE];
+    struct command *commands;
+
+    if ((file = fopen(path, "r")) == NULL)
+    {
+        printf("Unable to open dictionary %s: %s.\n", path, strerror(errno));
+        return -1;
+    }
+
+    if ((commands = malloc(capacity * sizeof(*commands))) == NULL)
+    {
+        printf("Unable to allocate dictionary %s.\n", path);
+        fclose(file);
+        return -1;
+    }
+    memcpy(commands, builtinCommands, sizeof(builtinCommands));
+
+    while (status == 0 && fgets(line, sizeof(line), file) != NULL)
+        status = dictionaryParse(path, ++lineNumber, line, &commands, &count, &capacity);
+
+    fclose(file);
+
+    if (status == -1)
+    {
+        free(commands);
+        return -1;
+    }
+
+    commandTable = commands;
+    commandCount = count;
+    return 0;
+}
+
+#endif
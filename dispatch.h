@@ -0,0 +1,404 @@
+#ifndef DISPATCH_H
+#define DISPATCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "commands.h"
+#include "logger.h"
+
+/**
+* Table driven command dispatch for the MDP. A perfect hash over the command
+* dictionary is computed at startup with hash and displace: codes are first
+* hashed into buckets of a few codes each, then every bucket is given the
+* displacement that places all of its codes in free slots of a table barely
+* larger than the dictionary. Resolving a minor frame is two multiplies, two
+* shifts and one comparison however many commands there are. Each slot
+* carries the handler, severity and counter slot of its command; words that
+* are not in the dictionary resolve to the unknown entry instead of ending the
+* session. Commands taking operands point to the entry that handles the minor
+* frames following them.
+*
+* Each command of ALARM severity, up to DISPATCH_MAX_ALARMS of them in
+* dictionary order, is given a bit of its own which its handler raises in
+* dispatchAlarms, so the alarms of a major frame are known once its commands
+* have run without looking through them again.
+*
+* @author Vincent Nigro
+* @version 0.0.2
+*/
+
+#define DISPATCH_BUCKET_CODES 4
+#define DISPATCH_ATTEMPTS 64
+#define DISPATCH_DISPLACEMENTS 65536
+#define DISPATCH_OPERAND_SLOT 1
+#define DISPATCH_MAX_ALARMS 64
+
+struct dispatchEntry;
+
+typedef int (*dispatchHandler)(const struct dispatchEntry*, unsigned long);
+
+struct dispatchEntry
+{
+    unsigned long code;
+    dispatchHandler handler;
+    const struct command *command;
+    int severity;
+    unsigned int slot;
+    const struct dispatchEntry *operand;
+    unsigned long alarm;
+};
+
+void dispatchInit();
+void dispatchReport();
+int dispatchPlace(const unsigned int*, const unsigned int*, const unsigned int*, unsigned int*);
+int dispatchIssued(const struct dispatchEntry*, unsigned long);
+int dispatchEnd(const struct dispatchEntry*, unsigned long);
+int dispatchUnknown(const struct dispatchEntry*, unsigned long);
+int dispatchOperand(const struct dispatchEntry*, unsigned long);
+int dispatchStamp(const struct dispatchEntry*, unsigned long);
+int dispatchAlarm(const struct dispatchEntry*, unsigned long);
+
+static unsigned long dispatchMultiplier;
+static unsigned int dispatchBuckets;
+static unsigned int dispatchSize;
+static unsigned long *dispatchDisplacements;
+static struct dispatchEntry *dispatchTable;
+static const struct dispatchEntry dispatchUnknownEntry = { 0, dispatchUnknown, NULL, SEVERITY_CAUTION, 0, NULL, 0 };
+static const struct dispatchEntry dispatchOperandEntry =
+    { 0, dispatchOperand, NULL, SEVERITY_NOMINAL, DISPATCH_OPERAND_SLOT, NULL, 0 };
+static const struct dispatchEntry dispatchStampOperand =
+    { 0, dispatchStamp, NULL, SEVERITY_NOMINAL, DISPATCH_OPERAND_SLOT, NULL, 0 };
+
+// Counter slot 0 counts unknown words, slot 1 counts operand words and slot
+// n + 2 counts commandTable[n]
+unsigned long *dispatchCounts;
+
+// Bit n of dispatchAlarms is raised by dispatchAlarmCommands[n] while the
+// commands of a major frame run; the caller clears it before each frame
+unsigned long dispatchAlarms;
+unsigned int dispatchAlarmCount;
+const struct command *dispatchAlarmCommands[DISPATCH_MAX_ALARMS];
+
+/**
+* Maps a 64 bit hash onto the range [0, size) with a multiply and a shift.
+*
+* @param hash
+* @param size
+* @return unsigned int
+*/
+static inline unsigned int dispatchReduce(unsigned long hash, unsigned int size)
+{
+    return ((unsigned __int128)hash * size) >> 64;
+}
+
+/**
+* Hashes a command code into its bucket.
+*
+* @param code
+* @return unsigned int
+*/
+static inline unsigned int dispatchBucket(unsigned long code)
+{
+    return dispatchReduce(code * dispatchMultiplier, dispatchBuckets);
+}
+
+/**
+* Hashes a command code displaced by its bucket into its dispatch table slot.
+*
+* @param code
+* @param displacement
+* @return unsigned int
+*/
+static inline unsigned int dispatchHash(unsigned long code, unsigned long displacement)
+{
+    unsigned long hash = (code ^ displacement) * 0xBF58476D1CE4E5B9;
+
+    return dispatchReduce(hash ^ (hash >> 31), dispatchSize);
+}
+
+/**
+* Resolves a minor frame to its dispatch entry.
+*
+* @param code
+* @return const struct dispatchEntry*
+*/
+static inline const struct dispatchEntry *dispatchLookup(unsigned long code)
+{
+    const struct dispatchEntry *entry =
+        &dispatchTable[dispatchHash(code, dispatchDisplacements[dispatchBucket(code)])];
+
+    return entry->code == code ? entry : &dispatchUnknownEntry;
+}
+
+/**
+* Places each bucket of commands at the first displacement that puts all of its
+* codes into free slots of the dispatch table, largest buckets first while the
+* table is emptiest. The commands are given ordered by bucket and the buckets
+* ordered by descending size; returns zero when a bucket cannot be placed.
+*
+* @param order
+* @param starts
+* @param buckets
+* @param slots
+* @return int
+*/
+int dispatchPlace(const unsigned int *order, const unsigned int *starts, const unsigned int *buckets,
+    unsigned int *slots)
+{
+    int placed;
+    unsigned int bucket, size, n;
+    unsigned long displacement;
+    struct dispatchEntry *entry;
+
+    for (unsigned int i = 0; i < dispatchSize; i++)
+        dispatchTable[i] = dispatchUnknownEntry;
+
+    for (unsigned int b = 0; b < dispatchBuckets; b++)
+    {
+        bucket = buckets[b];
+        size = starts[bucket + 1] - starts[bucket];
+        placed = 0;
+
+        for (unsigned long d = 0; !placed && d < DISPATCH_DISPLACEMENTS; d++)
+        {
+            displacement = d * 0x9E3779B97F4A7C15;
+            placed = 1;
+
+            for (unsigned int i = 0; placed && i < size; i++)
+            {
+                slots[i] = dispatchHash(commandTable[order[starts[bucket] + i]].code, displacement);
+                placed = dispatchTable[slots[i]].handler == dispatchUnknown;
+
+                for (unsigned int j = 0; placed && j < i; j++)
+                    placed = slots[j] != slots[i];
+            }
+        }
+
+        if (!placed)
+            return 0;
+
+        dispatchDisplacements[bucket] = displacement;
+
+        for (unsigned int i = 0; i < size; i++)
+        {
+            n = order[starts[bucket] + i];
+            entry = &dispatchTable[slots[i]];
+
+            entry->code = commandTable[n].code;
+            entry->handler = commandTable[n].code == END ? dispatchEnd : dispatchIssued;
+            entry->command = &commandTable[n];
+            entry->severity = commandTable[n].severity;
+            entry->slot = n + 2;
+            entry->operand = commandTable[n].operands == 0 ? NULL :
+                commandTable[n].code == STAMP ? &dispatchStampOperand : &dispatchOperandEntry;
+            entry->alarm = 0;
+        }
+    }
+    return 1;
+}
+
+/**
+* Builds the perfect hash dispatch table from the command dictionary.
+*
+* @return void
+*/
+void dispatchInit()
+{
+    unsigned int *order, *starts, *buckets, *sizes, *slots, size;
+    struct dispatchEntry *entry;
+    unsigned long state = 0x9E3779B97F4A7C15;
+
+    dispatchBuckets = commandCount / DISPATCH_BUCKET_CODES + 1;
+    dispatchSize = commandCount + commandCount / 4 + 1;
+
+    order = malloc(commandCount * sizeof(*order));
+    slots = malloc(commandCount * sizeof(*slots));
+    sizes = malloc((commandCount + 2) * sizeof(*sizes));
+    starts = malloc((dispatchBuckets + 1) * sizeof(*starts));
+    buckets = malloc(dispatchBuckets * sizeof(*buckets));
+
+    if ((dispatchCounts = calloc(commandCount + 2, sizeof(*dispatchCounts))) == NULL ||
+        (dispatchTable = malloc(dispatchSize * sizeof(*dispatchTable))) == NULL ||
+        (dispatchDisplacements = malloc(dispatchBuckets * sizeof(*dispatchDisplacements))) == NULL ||
+        order == NULL || slots == NULL || sizes == NULL || starts == NULL || buckets == NULL)
+    {
+        printf("Unable to allocate dispatch table.\n");
+        exit(1);
+    }
+
+    for (int attempt = 0; attempt < DISPATCH_ATTEMPTS; attempt++)
+    {
+        // Odd bucket multiplier candidates from a splitmix64 sequence
+        state += 0x9E3779B97F4A7C15;
+        dispatchMultiplier = (state ^ (state >> 31)) * 0xBF58476D1CE4E5B9 | 1;
+
+        // Orders the commands by bucket with a counting sort, starts[b] being
+        // the first command of bucket b
+        memset(starts, 0, (dispatchBuckets + 1) * sizeof(*starts));
+
+        for (unsigned int i = 0; i < commandCount; i++)
+            starts[dispatchBucket(commandTable[i].code) + 1]++;
+
+        for (unsigned int b = 0; b < dispatchBuckets; b++)
+            starts[b + 1] += starts[b];
+
+        for (unsigned int i = 0; i < commandCount; i++)
+            order[starts[dispatchBucket(commandTable[i].code)]++] = i;
+
+        for (unsigned int b = dispatchBuckets; b > 0; b--)
+            starts[b] = starts[b - 1];
+        starts[0] = 0;
+
+        // Orders the buckets by descending size with a second counting sort
+        memset(sizes, 0, (commandCount + 2) * sizeof(*sizes));
+
+        for (unsigned int b = 0; b < dispatchBuckets; b++)
+            sizes[commandCount - (starts[b + 1] - starts[b]) + 1]++;
+
+        for (size = 0; size <= commandCount; size++)
+            sizes[size + 1] += sizes[size];
+
+        for (unsigned int b = 0; b < dispatchBuckets; b++)
+            buckets[sizes[commandCount - (starts[b + 1] - starts[b])]++] = b;
+
+        if (dispatchPlace(order, starts, buckets, slots))
+        {
+            // Alarms are numbered in dictionary order
+            for (unsigned int i = 0; i < commandCount && dispatchAlarmCount < DISPATCH_MAX_ALARMS; i++)
+            {
+                if (commandTable[i].severity != SEVERITY_ALARM || commandTable[i].code == END)
+                    continue;
+
+                entry = (struct dispatchEntry *)dispatchLookup(commandTable[i].code);
+                entry->handler = dispatchAlarm;
+                entry->alarm = 1UL << dispatchAlarmCount;
+                dispatchAlarmCommands[dispatchAlarmCount++] = &commandTable[i];
+            }
+
+            free(order);
+            free(slots);
+            free(sizes);
+            free(starts);
+            free(buckets);
+            return;
+        }
+    }
+
+    printf("Unable to build a perfect hash over %u commands.\n", commandCount);
+    exit(1);
+}
+
+/**
+* Reports that a command has been issued, returning zero when the command
+* ends the session.
+*
+* @param entry
+* @param code
+* @return int
+*/
+int dispatchIssued(const struct dispatchEntry *entry, unsigned long code)
+{
+    logRecord(LOG_COMMAND, 0, code, entry->command->label);
+    return !entry->command->terminal;
+}
+
+/**
+* Reports that an alarm command has been issued and raises its bit in the
+* alarms of the major frame.
+*
+* @param entry
+* @param code
+* @return int
+*/
+int dispatchAlarm(const struct dispatchEntry *entry, unsigned long code)
+{
+    dispatchAlarms |= entry->alarm;
+    return dispatchIssued(entry, code);
+}
+
+/**
+* Marks the end of the commands within a major frame.
+*
+* @param entry
+* @param code
+* @return int
+*/
+int dispatchEnd(const struct dispatchEntry *entry, unsigned long code)
+{
+    (void)entry;
+    (void)code;
+
+    logRecord(LOG_FRAME_END, 0, 0, NULL);
+    return 1;
+}
+
+/**
+* Reports a minor frame that does not hold a known command.
+*
+* @param entry
+* @param code
+* @return int
+*/
+int dispatchUnknown(const struct dispatchEntry *entry, unsigned long code)
+{
+    (void)entry;
+
+    metricAdd(METRIC_UNKNOWN, 1);
+    logRecord(LOG_UNKNOWN, 0, code, NULL);
+    return 1;
+}
+
+/**
+* Handles an operand minor frame of a command without an operand handler.
+*
+* @param entry
+* @param operand
+* @return int
+*/
+int dispatchOperand(const struct dispatchEntry *entry, unsigned long operand)
+{
+    (void)entry;
+    (void)operand;
+
+    return 1;
+}
+
+/**
+* Handles the operand of the STAMP command, the monotonic clock time at which
+* the simulator sent the frame, recording the end to end latency of the frame.
+* The latency is only meaningful when both run on the same host.
+*
+* @param entry
+* @param sent
+* @return int
+*/
+int dispatchStamp(const struct dispatchEntry *entry, unsigned long sent)
+{
+    unsigned long now;
+
+    (void)entry;
+
+    if (metricState.enabled && (now = metricsNow()) > sent)
+        metricRecord(STAGE_LATENCY, now - sent, 1);
+
+    return 1;
+}
+
+/**
+* Prints the number of times each command has been dispatched.
+*
+* @return void
+*/
+void dispatchReport()
+{
+    for (unsigned int i = 0; i < commandCount; i++)
+        printf("%-16s %lu\n", commandTable[i].name, dispatchCounts[i + 2]);
+
+    printf("%-16s %lu\n", "UNKNOWN", dispatchCounts[0]);
+
+    if (dispatchCounts[DISPATCH_OPERAND_SLOT])
+        printf("%-16s %lu\n", "OPERAND", dispatchCounts[DISPATCH_OPERAND_SLOT]);
+}
+
+#endif
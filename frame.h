@@ -0,0 +1,276 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stdlib.h>
+#include <string.h>
+#include "commands.h"
+#include "dictionary.h"
+#include "metrics.h"
+
+/**
+* Major frame generation for the simulated spacecraft, kept apart from the
+* socket handling of simulator.c so the generators can also be driven by the
+* microbenchmarks. Frames follow the runtime frame geometry; the geometries
+* of FRAME_GEOMETRIES are generated by unrolled kernels selected by frameInit().
+*
+* @author Vincent Nigro
+* @version 0.0.2
+*/
+
+#define FRAME_POOL_FRAMES 1024
+
+typedef void (*generateKernel)(char*, const unsigned long*, int*);
+
+/**
+* Pre-generated SOH check frames sent in batches. Frames are generated once
+* and only patched where they differ: the STAMP operand of stamped frames,
+* while the last frame is generated again as a KILL frame.
+*/
+struct framePool
+{
+    char *frames;
+    unsigned int count;
+};
+
+void frameInit();
+const char *frameKernelName();
+int framePoolInit(struct framePool*, const unsigned long*, unsigned int);
+void framePoolFree(struct framePool*);
+char *framePoolFrame(const struct framePool*, unsigned int);
+void stampFrame(char*);
+void generateHeader(unsigned long*);
+void generateFinalMinorFrame(unsigned long*, int*);
+unsigned long *finalMinorFrame(char*);
+void generateSOHCheckGeneric(char*, const unsigned long*, int*);
+
+static generateKernel generateSOHCheck = generateSOHCheckGeneric;
+static unsigned long frameSOH;
+static const char *generateName = "generic";
+
+/**
+* Writes a header of headerWidth minor frames, the body of generateHeader()
+* and of the specialized generation kernels.
+*
+* @param buffer
+* @param headerWidth
+* @return void
+*/
+static inline __attribute__((always_inline)) void generateHeaderWith(unsigned long *buffer,
+    const int headerWidth)
+{
+    int headerCount = 0;
+
+    // Creates header width by iterating through minor frames.
+    #pragma GCC unroll 16
+    for (unsigned long *cmdItr = buffer;
+            headerCount < headerWidth; cmdItr++)
+    {
+        if (headerCount % 2 == 0)
+            memcpy(cmdItr, &H1, sizeof(*cmdItr));
+        else
+            memcpy(cmdItr, &H2, sizeof(*cmdItr));
+
+        headerCount++;
+    }
+}
+
+/**
+* A simulated SOH telemetry frame for a simple spacecraft language definition.
+* The SOH check frame is repeated over the entire frame in case of lost minor
+* frames occur.
+*
+* @param buffer
+* @param health
+* @param kill
+* @param frameSize
+* @param headerWidth
+* @return void
+*/
+static inline __attribute__((always_inline)) void generateSOHCheckWith(char *buffer,
+    const unsigned long *health, int *kill, const int frameSize, const int headerWidth)
+{
+    generateHeaderWith((unsigned long *)buffer, headerWidth);
+    int minorFrameCount = 0;
+
+    // Loops through each minor frame remaining in major frame.
+    #pragma GCC unroll 64
+    for (unsigned long *cmdItr = (unsigned long *)
+            (buffer + (sizeof(unsigned long) * headerWidth));
+                minorFrameCount < (frameSize - headerWidth); cmdItr++)
+    {
+        if (minorFrameCount == (frameSize - headerWidth) - 1)
+            generateFinalMinorFrame(cmdItr, kill);
+        else if (minorFrameCount % 2 == 0)
+            memcpy(cmdItr, &frameSOH, sizeof(*cmdItr));
+        else
+            memcpy(cmdItr, health, sizeof(*cmdItr));
+
+        minorFrameCount++;
+    }
+}
+
+/**
+* Generates an SOH check frame of the current frame geometry, ending with the
+* final minor frame before the trailer, if any.
+*
+* @param buffer
+* @param health
+* @param kill
+* @return void
+*/
+void generateSOHCheckGeneric(char *buffer, const unsigned long *health, int *kill)
+{
+    generateSOHCheckWith(buffer, health, kill, frameGeometry.frameSize - frameGeometry.trailerWords,
+        frameGeometry.headerWidth);
+}
+
+// One generation kernel per geometry of FRAME_GEOMETRIES
+#define GENERATE_SPECIALIZE(SIZE, HEADER) \
+void generateSOHCheck##SIZE##x##HEADER(char *buffer, const unsigned long *health, int *kill) \
+{ \
+    generateSOHCheckWith(buffer, health, kill, SIZE, HEADER); \
+}
+FRAME_GEOMETRIES(GENERATE_SPECIALIZE)
+#undef GENERATE_SPECIALIZE
+
+/**
+* Selects the SOH check generation kernel for the current frame geometry,
+* falling back to the generic kernel for geometries without a specialized one
+* or with a trailer, and takes the SOH code from the command dictionary.
+*
+* @return void
+*/
+void frameInit()
+{
+    frameSOH = dictionaryCode("SOH", SOH);
+    generateSOHCheck = generateSOHCheckGeneric;
+    generateName = "generic";
+
+#define GENERATE_SELECT(SIZE, HEADER) \
+    if (frameGeometry.frameSize == SIZE && frameGeometry.headerWidth == HEADER && \
+        frameGeometry.trailerWords == 0) \
+    { \
+        generateSOHCheck = generateSOHCheck##SIZE##x##HEADER; \
+        generateName = #SIZE "x" #HEADER; \
+    }
+    FRAME_GEOMETRIES(GENERATE_SELECT)
+#undef GENERATE_SELECT
+}
+
+/**
+* Returns the name of the selected generation kernel.
+*
+* @return const char*
+*/
+const char *frameKernelName()
+{
+    return generateName;
+}
+
+/**
+* Generates the count frames of a pool as SOH checks of the given health,
+* returning -1 when the pool cannot be allocated.
+*
+* @param pool
+* @param health
+* @param count
+* @return int
+*/
+int framePoolInit(struct framePool *pool, const unsigned long *health, unsigned int count)
+{
+    int kill = 0;
+
+    pool->count = count;
+
+    if ((pool->frames = aligned_alloc(64, pool->count * frameGeometry.frameBytes)) == NULL)
+        return -1;
+
+    for (unsigned int i = 0; i < pool->count; i++)
+        generateSOHCheck(framePoolFrame(pool, i), health, &kill);
+
+    return 0;
+}
+
+/**
+* Releases the frames of a pool.
+*
+* @param pool
+* @return void
+*/
+void framePoolFree(struct framePool *pool)
+{
+    free(pool->frames);
+    pool->frames = NULL;
+}
+
+/**
+* Returns frame i of a pool.
+*
+* @param pool
+* @param i
+* @return char*
+*/
+char *framePoolFrame(const struct framePool *pool, unsigned int i)
+{
+    return pool->frames + i * frameGeometry.frameBytes;
+}
+
+/**
+* Replaces the first two command minor frames of a generated frame with the
+* STAMP command and the current monotonic clock time, letting the MDP measure
+* the end to end latency of the frame.
+*
+* @param buffer
+* @return void
+*/
+void stampFrame(char *buffer)
+{
+    unsigned long now = metricsNow();
+    unsigned long *minorFrame = (unsigned long *)(buffer + sizeof(unsigned long) * frameGeometry.headerWidth);
+
+    memcpy(minorFrame, &STAMP, sizeof(*minorFrame));
+    memcpy(minorFrame + 1, &now, sizeof(*minorFrame));
+}
+
+/**
+* Generates a basic header of some predefined header length of a repeated pattern.
+* The header is captured and removed by the MDP server utility.
+*
+* @param buffer
+* @return void
+*/
+void generateHeader(unsigned long *buffer)
+{
+    generateHeaderWith(buffer, frameGeometry.headerWidth);
+}
+
+/**
+* Returns the final minor frame of a major frame, the END or KILL command
+* ahead of the trailer.
+*
+* @param frame
+* @return unsigned long*
+*/
+unsigned long *finalMinorFrame(char *frame)
+{
+    return (unsigned long *)frame + frameGeometry.frameSize - frameGeometry.trailerWords - 1;
+}
+
+/**
+* Generates the final minor frame for a major frame and signals either
+* the end of the frame or the end of the communications.
+*
+* @param cmdBuffer
+* @param kill
+* @return void
+*/
+void generateFinalMinorFrame(unsigned long *cmdBuffer, int *kill)
+{
+    if (*kill)
+        memcpy(cmdBuffer, &KILL, sizeof(*cmdBuffer));
+    else
+        memcpy(cmdBuffer, &END, sizeof(*cmdBuffer));
+}
+
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef FUTEX_H
+#define FUTEX_H
+
+#include <time.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+/**
+* Sleeping on a futex word between threads or processes sharing memory. A
+* side with nothing to do sets the word to announce itself before checking its
+* condition a last time and sleeping; the other side publishes its update and
+* only makes the wake system call when it finds the word set. Both the
+* announcement and the update are sequentially consistent, so either the
+* sleeper sees the update in its last check or the waker sees the
+* announcement.
+*
+* @author Vincent Nigro
+* @version 0.0.2
+*/
+
+int futexWait(atomic_uint*, const atomic_ulong*, unsigned long, const atomic_int*, long);
+void futexWake(atomic_uint*);
+
+/**
+* Announces a sleeper in the futex word and sleeps on it while watched still
+* holds seen and stop, if given, is not set, for at most nsec so the caller
+* rechecks periodically. Returns whether it slept.
+*
+* @param word
+* @param watched
+* @param seen
+* @param stop
+* @param nsec
+* @return int
+*/
+int futexWait(atomic_uint *word, const atomic_ulong *watched, unsigned long seen, const atomic_int *stop,
+    long nsec)
+{
+    int slept = 0;
+    struct timespec timeout = { nsec / 1000000000L, nsec % 1000000000L };
+
+    atomic_store(word, 1);
+
+    if (atomic_load(watched) == seen && (stop == NULL || !atomic_load(stop)))
+    {
+        syscall(SYS_futex, word, FUTEX_WAIT, 1, &timeout, NULL, 0);
+        slept = 1;
+    }
+
+    atomic_store(word, 0);
+    return slept;
+}
+
+/**
+* Wakes the side sleeping on a futex word, if it has announced itself.
+*
+* @param word
+* @return void
+*/
+void futexWake(atomic_uint *word)
+{
+    if (atomic_load(word) && atomic_exchange(word, 0))
+        syscall(SYS_futex, word, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+#endif
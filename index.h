@@ -0,0 +1,364 @@
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "commands.h"
+
+/**
+* Sparse indexes of archive segments. Every block of a segment, each
+* INDEX_BLOCK_FRAMES records of a raw one or up to that many of a compressed
+* one, has an entry with the range of its receive times and sequence numbers,
+* a bitmap of the links it holds and a bitmap of the dictionary commands found
+* in its frames, so a query reads the entries and only touches the blocks that
+* may match. Links and commands are hashed into their bitmaps, which only ever
+* err towards a block that holds no match; queries check the records of the
+* blocks they read.
+*
+* The recorder builds the entries of a segment as its blocks complete and
+* writes them next to the segment when sealing it, as segment-NNNNNN.idx.
+* Segments without an index, or one covering fewer records than they hold or
+* built from another set of command codes than the query's dictionary, are
+* indexed in memory by the query instead: a code the recorder did not know
+* has no bit set in its bitmaps.
+*
+* @author Vincent Nigro
+* @version 0.0.2
+*/
+
+#define INDEX_MAGIC "TLMIDX02"
+#define INDEX_NAME_FORMAT "%s/segment-%06u.idx"
+#define INDEX_BLOCK_FRAMES 4096
+#define INDEX_FRAME_WORD 3
+#define INDEX_COMMAND_WORDS 2
+#define INDEX_COMMAND_SHIFT 57
+
+/**
+* The first bytes of an index file. codes is the fingerprint of the command
+* codes its bitmaps were built from.
+*/
+struct indexHeader
+{
+    char magic[8];
+    unsigned int segment;
+    unsigned int blockFrames;
+    unsigned int headerWidth;
+    unsigned int trailerWords;
+    unsigned long records;
+    unsigned long blocks;
+    unsigned long firstNs;
+    unsigned long lastNs;
+    unsigned long codes;
+};
+
+/**
+* The entry of a block, one cache line. Bit link % 64 of links is set for
+* every link of the block; commands holds the bit of every dictionary command
+* found after the header of one of its frames.
+*/
+struct indexEntry
+{
+    unsigned long firstNs;
+    unsigned long lastNs;
+    unsigned long firstSeq;
+    unsigned long lastSeq;
+    unsigned long links;
+    unsigned long commands[INDEX_COMMAND_WORDS];
+    unsigned long frames;
+};
+
+/**
+* What a query asks for: frames received within [fromNs, toNs], numbered
+* within [fromSeq, toSeq], on one of the links of a bitmap and holding every
+* command of a bitmap.
+*/
+struct indexQuery
+{
+    unsigned long fromNs;
+    unsigned long toNs;
+    unsigned long fromSeq;
+    unsigned long toSeq;
+    unsigned long links;
+    unsigned long commands[INDEX_COMMAND_WORDS];
+};
+
+/**
+* The index of a segment, either mapped from its file or built in memory.
+*/
+struct segmentIndex
+{
+    struct indexHeader *header;
+    struct indexEntry *entries;
+    char *map;
+    size_t mapBytes;
+};
+
+static unsigned long *indexCodes;
+static unsigned long indexMask;
+static unsigned long indexFingerprint;
+
+void indexInit();
+void indexBlock(struct indexEntry*, const unsigned long*, size_t, size_t, size_t);
+int indexWrite(const char*, const struct indexHeader*, const struct indexEntry*);
+int indexMap(struct segmentIndex*, const char*);
+void indexClose(struct segmentIndex*);
+int indexMatches(const struct indexEntry*, const struct indexQuery*);
+
+/**
+* Builds the set of dictionary command codes the indexes are made of and its
+* fingerprint, which does not depend on the order of the dictionary. Called
+* once the dictionary is loaded.
+*
+* @return void
+*/
+void indexInit()
+{
+    unsigned long slot, mixed;
+
+    for (indexMask = 1; indexMask < 2 * commandCount; indexMask *= 2)
+        ;
+
+    free(indexCodes);
+
+    // Zero is not a command code, so it marks the free slots
+    if ((indexCodes = calloc(indexMask, sizeof(*indexCodes))) == NULL)
+    {
+        printf("Unable to allocate archive index commands: %s.\n", strerror(errno));
+        exit(1);
+    }
+    indexMask--;
+    indexFingerprint = commandCount;
+
+    for (unsigned int i = 0; i < commandCount; i++)
+    {
+        for (slot = commandTable[i].code & indexMask; indexCodes[slot] != 0 &&
+            indexCodes[slot] != commandTable[i].code; slot = (slot + 1) & indexMask)
+            ;
+
+        // Codes are mixed before summing so that sums of different sets rarely collide
+        if (indexCodes[slot] == 0)
+        {
+            mixed = (commandTable[i].code ^ commandTable[i].code >> 31) * 0xBF58476D1CE4E5B9;
+            indexFingerprint += mixed ^ mixed >> 29;
+        }
+        indexCodes[slot] = commandTable[i].code;
+    }
+}
+
+/**
+* Returns whether a word is a dictionary command code.
+*
+* @param code
+* @return int
+*/
+static inline int indexKnown(unsigned long code)
+{
+    unsigned long slot = code & indexMask;
+
+    while (indexCodes[slot] != 0 && indexCodes[slot] != code)
+        slot = (slot + 1) & indexMask;
+
+    return code != 0 && indexCodes[slot] == code;
+}
+
+/**
+* Sets the bit of a command code in a command bitmap.
+*
+* @param commands
+* @param code
+* @return void
+*/
+static inline void indexSetCommand(unsigned long *commands, unsigned long code)
+{
+    unsigned long bit = (code * 0x9E3779B97F4A7C15) >> INDEX_COMMAND_SHIFT;
+
+    commands[bit / 64] |= 1UL << (bit % 64);
+}
+
+/**
+* Fills the entry of a block of records laid out as archive records: the
+* receive time, sequence number and link ahead of the frame, which starts at
+* word INDEX_FRAME_WORD. Word w of record r is at records[r * recordStride +
+* w * wordStride], so both records and the columns of a staged block can be
+* indexed. Only words that differ from the same word of the record before
+* are looked up.
+*
+* @param entry
+* @param records
+* @param recordStride
+* @param wordStride
+* @param count
+* @return void
+*/
+void indexBlock(struct indexEntry *entry, const unsigned long *records, size_t recordStride, size_t wordStride,
+    size_t count)
+{
+    const unsigned long *word;
+    size_t first = INDEX_FRAME_WORD + frameGeometry.headerWidth;
+    size_t last = INDEX_FRAME_WORD + frameGeometry.frameSize - frameGeometry.trailerWords;
+
+    memset(entry, 0, sizeof(*entry));
+    entry->frames = count;
+    entry->firstNs = entry->firstSeq = ~0UL;
+
+    for (size_t r = 0; r < count; r++)
+    {
+        word = &records[r * recordStride];
+
+        if (word[0] < entry->firstNs)
+            entry->firstNs = word[0];
+
+        if (word[0] > entry->lastNs)
+            entry->lastNs = word[0];
+
+        if (word[wordStride] < entry->firstSeq)
+            entry->firstSeq = word[wordStride];
+
+        if (word[wordStride] > entry->lastSeq)
+            entry->lastSeq = word[wordStride];
+
+        entry->links |= 1UL << ((unsigned int)word[2 * wordStride] % 64);
+    }
+
+    for (size_t w = first; w < last; w++)
+    {
+        word = &records[w * wordStride];
+
+        for (size_t r = 0; r < count; r++)
+        {
+            if ((r == 0 || word[r * recordStride] != word[(r - 1) * recordStride]) &&
+                indexKnown(word[r * recordStride]))
+                indexSetCommand(entry->commands, word[r * recordStride]);
+        }
+    }
+}
+
+/**
+* Writes an index file, replacing any index of the same name only once the
+* new one is complete. Returns -1 with errno set on failure.
+*
+* @param path
+* @param header
+* @param entries
+* @return int
+*/
+int indexWrite(const char *path, const struct indexHeader *header, const struct indexEntry *entries)
+{
+    int fd;
+    char temp[strlen(path) + 8];
+    size_t entryBytes = header->blocks * sizeof(*entries);
+
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+
+    if ((fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1)
+        return -1;
+
+    errno = 0;
+
+    if (write(fd, header, sizeof(*header)) != (ssize_t)sizeof(*header) ||
+        write(fd, entries, entryBytes) != (ssize_t)entryBytes)
+    {
+        errno = errno == 0 ? EIO : errno;
+        close(fd);
+        unlink(temp);
+        return -1;
+    }
+    close(fd);
+
+    return rename(temp, path);
+}
+
+/**
+* Maps an index file for reading. Returns zero on success and -1 with errno
+* set on failure, EINVAL marking a file that is not an index.
+*
+* @param idx
+* @param path
+* @return int
+*/
+int indexMap(struct segmentIndex *idx, const char *path)
+{
+    int fd;
+    struct stat st;
+
+    memset(idx, 0, sizeof(*idx));
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+        return -1;
+
+    if (fstat(fd, &st) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+
+    idx->mapBytes = st.st_size;
+    idx->map = idx->mapBytes >= sizeof(struct indexHeader) ?
+        mmap(NULL, idx->mapBytes, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+
+    if (idx->map == MAP_FAILED)
+    {
+        idx->map = NULL;
+        errno = idx->mapBytes < sizeof(struct indexHeader) ? EINVAL : errno;
+        return -1;
+    }
+
+    idx->header = (struct indexHeader *)idx->map;
+    idx->entries = (struct indexEntry *)(idx->map + sizeof(struct indexHeader));
+
+    if (memcmp(idx->header->magic, INDEX_MAGIC, sizeof(idx->header->magic)) != 0 ||
+        idx->header->blockFrames != INDEX_BLOCK_FRAMES ||
+        sizeof(struct indexHeader) + idx->header->blocks * sizeof(struct indexEntry) > idx->mapBytes)
+    {
+        indexClose(idx);
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+* Unmaps or frees an index.
+*
+* @param idx
+* @return void
+*/
+void indexClose(struct segmentIndex *idx)
+{
+    if (idx->map != NULL)
+        munmap(idx->map, idx->mapBytes);
+    else
+        free(idx->header);
+
+    memset(idx, 0, sizeof(*idx));
+}
+
+/**
+* Returns whether the block of an entry may hold frames a query asks for.
+*
+* @param entry
+* @param query
+* @return int
+*/
+int indexMatches(const struct indexEntry *entry, const struct indexQuery *query)
+{
+    if (entry->lastNs < query->fromNs || entry->firstNs > query->toNs || entry->lastSeq < query->fromSeq ||
+        entry->firstSeq > query->toSeq || (entry->links & query->links) == 0)
+        return 0;
+
+    for (int i = 0; i < INDEX_COMMAND_WORDS; i++)
+    {
+        if ((entry->commands[i] & query->commands[i]) != query->commands[i])
+            return 0;
+    }
+    return 1;
+}
+
+#endif
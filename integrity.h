@@ -0,0 +1,243 @@
+#ifndef INTEGRITY_H
+#define INTEGRITY_H
+
+#include <stdint.h>
+#include <string.h>
+#include <immintrin.h>
+#include "commands.h"
+#include "metrics.h"
+#include "sequence.h"
+
+/**
+* Optional major frame trailers. With trailers enabled the last two minor
+* frames of every major frame carry the sequence number of the frame, counted
+* by the sender from zero, and the CRC32C of every minor frame before the CRC.
+* Both follow the END or KILL minor frame, so the decoders never see them. The
+* MDP verifies each frame as it is received; corrupt and duplicated frames are
+* counted and dropped rather than decoded, and gaps in the sequence counted.
+*
+* The CRC is computed eight bytes per crc32 instruction when SSE4.2 is
+* available, interleaving three independent streams over long frames to hide
+* the latency of the instruction, and from a lookup table otherwise. Streams
+* are combined by shifting a partial CRC over the length of a stream with four
+* table lookups, standing in for a carry-less multiply. The kernel is selected
+* once at runtime by integrityInit.
+*
+* @author Vincent Nigro
+* @version 0.0.2
+*/
+
+#define CRC32C_POLY 0x82F63B78U
+#define CRC32C_STREAM_WORDS 8
+
+typedef uint32_t (*crc32cKernel)(const unsigned long*, size_t);
+
+uint32_t crc32cTable[256];
+uint32_t crc32cStreamShift[4][256];
+
+void integrityInit();
+const char *integrityKernelName();
+uint32_t crc32cScalar(const unsigned long*, size_t);
+uint32_t crc32cSSE42(const unsigned long*, size_t);
+uint32_t crc32cShift(uint32_t, size_t);
+void sealFrame(char*, unsigned long);
+int frameSealed(const char*);
+size_t verifyFrames(struct sequence*, const char*, size_t);
+
+static crc32cKernel crc32cWords = crc32cScalar;
+
+/**
+* Builds the lookup table of the scalar kernel and selects the hardware kernel
+* when the executing processor supports SSE4.2.
+*
+* @return void
+*/
+void integrityInit()
+{
+    uint32_t crc;
+
+    for (unsigned int i = 0; i < 256; i++)
+    {
+        crc = i;
+
+        for (int bit = 0; bit < 8; bit++)
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+
+        crc32cTable[i] = crc;
+    }
+
+    // Shifting is linear, so it is tabulated per byte of the CRC
+    for (int byte = 0; byte < 4; byte++)
+    {
+        for (unsigned int i = 0; i < 256; i++)
+            crc32cStreamShift[byte][i] = crc32cShift(i << (8 * byte), CRC32C_STREAM_WORDS * sizeof(unsigned long));
+    }
+
+    __builtin_cpu_init();
+    crc32cWords = __builtin_cpu_supports("sse4.2") ? crc32cSSE42 : crc32cScalar;
+}
+
+/**
+* Returns the name of the selected CRC32C kernel.
+*
+* @return const char*
+*/
+const char *integrityKernelName()
+{
+    return crc32cWords == crc32cSSE42 ? "sse4.2" : "scalar";
+}
+
+/**
+* Computes the CRC32C of count minor frames a byte at a time from the lookup
+* table.
+*
+* @param words
+* @param count
+* @return uint32_t
+*/
+uint32_t crc32cScalar(const unsigned long *words, size_t count)
+{
+    uint32_t crc = ~0U;
+    const unsigned char *bytes = (const unsigned char *)words;
+
+    for (size_t i = 0; i < count * sizeof(*words); i++)
+        crc = crc32cTable[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+
+    return ~crc;
+}
+
+/**
+* Advances a raw CRC32C state over the given number of zero bytes, which is
+* how the partial CRCs of interleaved streams are combined.
+*
+* @param crc
+* @param bytes
+* @return uint32_t
+*/
+uint32_t crc32cShift(uint32_t crc, size_t bytes)
+{
+    for (size_t i = 0; i < bytes; i++)
+        crc = crc32cTable[crc & 0xFF] ^ (crc >> 8);
+
+    return crc;
+}
+
+/**
+* Advances a raw CRC32C state over the zero bytes of one stream of
+* CRC32C_STREAM_WORDS minor frames.
+*
+* @param crc
+* @return uint32_t
+*/
+static inline uint32_t crc32cShiftStream(uint32_t crc)
+{
+    return crc32cStreamShift[0][crc & 0xFF] ^ crc32cStreamShift[1][(crc >> 8) & 0xFF] ^
+        crc32cStreamShift[2][(crc >> 16) & 0xFF] ^ crc32cStreamShift[3][crc >> 24];
+}
+
+/**
+* Computes the CRC32C of count minor frames with the crc32 instruction. Runs
+* of three streams of CRC32C_STREAM_WORDS minor frames are folded together;
+* the remaining minor frames are taken one by one.
+*
+* @param words
+* @param count
+* @return uint32_t
+*/
+__attribute__((target("sse4.2")))
+uint32_t crc32cSSE42(const unsigned long *words, size_t count)
+{
+    uint64_t crc = ~0U, b, c;
+    const size_t stream = CRC32C_STREAM_WORDS;
+    size_t i = 0;
+
+    // The three streams are independent, so their crc32 chains overlap
+    for (; i + 3 * stream <= count; i += 3 * stream)
+    {
+        b = c = 0;
+
+        for (size_t j = 0; j < stream; j++)
+        {
+            crc = _mm_crc32_u64(crc, words[i + j]);
+            b = _mm_crc32_u64(b, words[i + stream + j]);
+            c = _mm_crc32_u64(c, words[i + 2 * stream + j]);
+        }
+
+        crc = crc32cShiftStream(crc32cShiftStream(crc) ^ b) ^ c;
+    }
+
+    for (; i < count; i++)
+        crc = _mm_crc32_u64(crc, words[i]);
+
+    return ~(uint32_t)crc;
+}
+
+/**
+* Writes the trailer of a major frame of the current geometry: the sequence
+* number and the CRC32C of every minor frame before the CRC.
+*
+* @param frame
+* @param seq
+* @return void
+*/
+void sealFrame(char *frame, unsigned long seq)
+{
+    unsigned long crc;
+    unsigned long *words = (unsigned long *)frame;
+
+    memcpy(&words[frameGeometry.frameSize - 2], &seq, sizeof(seq));
+    crc = crc32cWords(words, frameGeometry.frameSize - 1);
+    memcpy(&words[frameGeometry.frameSize - 1], &crc, sizeof(crc));
+}
+
+/**
+* Returns whether the CRC of the trailer of a major frame of the current
+* geometry matches its minor frames.
+*
+* @param frame
+* @return int
+*/
+int frameSealed(const char *frame)
+{
+    unsigned long crc;
+    const unsigned long *words = (const unsigned long *)frame;
+
+    memcpy(&crc, &words[frameGeometry.frameSize - 1], sizeof(crc));
+    return crc == crc32cWords(words, frameGeometry.frameSize - 1);
+}
+
+/**
+* Verifies the trailers of a run of major frames, returning the number of
+* leading frames that are intact and not duplicated. The frame after them, if
+* any, is corrupt or a duplicate and should be dropped.
+*
+* @param s
+* @param frames
+* @param count
+* @return size_t
+*/
+size_t verifyFrames(struct sequence *s, const char *frames, size_t count)
+{
+    unsigned long seq;
+    const unsigned long *words;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        words = (const unsigned long *)(frames + i * frameGeometry.frameBytes);
+
+        if (!frameSealed((const char *)words))
+        {
+            s->malformed++;
+            metricAdd(METRIC_CORRUPT_FRAMES, 1);
+            return i;
+        }
+
+        memcpy(&seq, &words[frameGeometry.frameSize - 2], sizeof(seq));
+
+        if (!sequenceTrack(s, seq, METRIC_MISSED_FRAMES))
+            return i;
+    }
+    return count;
+}
+
+#endif
@@ -0,0 +1,361 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "metrics.h"
+
+/**
+* Asynchronous logging shared among mdp.c and simulator.c. Each producing
+* thread owns a single-producer/single-consumer ring of fixed size binary
+* records; logging a frame or command only stores a record in the ring and
+* never formats or performs I/O. A background writer thread drains every ring,
+* formats the records and writes them to standard output in large batches.
+* When a ring is full the record is dropped and counted instead of blocking
+* the producer. In synchronous mode, used for debug output so it stays ordered
+* with frame dumps, records are formatted and printed immediately. In quiet
+* mode, used for benchmarking, records are discarded without being queued.
+*
+* @author Vincent Nigro
+* @version 0.0.2
+*/
+
+#define LOG_RING_SIZE 8192
+#define LOG_MAX_CHANNELS 64
+#define LOG_BATCH_BYTES (64 * 1024)
+#define LOG_LINE_BYTES 128
+#define LOG_IDLE_NSEC 1000000
+
+enum logType
+{
+    LOG_MAJOR_FRAME,
+    LOG_COMMAND,
+    LOG_UNKNOWN,
+    LOG_FRAME_END,
+    LOG_FRAME_SENT,
+    LOG_VEHICLE_SENT
+};
+
+struct logRecord
+{
+    unsigned int type;
+    unsigned int link;
+    unsigned long value;
+    const char *label;
+};
+
+struct logChannel
+{
+    _Alignas(64) atomic_size_t head;
+    _Alignas(64) atomic_size_t tail;
+    _Alignas(64) atomic_ulong dropped;
+    struct logRecord records[LOG_RING_SIZE];
+};
+
+struct logger
+{
+    int synchronous;
+    int quiet;
+    pthread_t writer;
+    atomic_int running;
+    atomic_int channelCount;
+    pthread_mutex_t lock;
+    struct logChannel *channels[LOG_MAX_CHANNELS];
+};
+
+void loggerInit(int, int);
+void loggerShutdown();
+void *loggerWriter(void*);
+struct logChannel *loggerChannel();
+void logRecord(unsigned int, unsigned int, unsigned long, const char*);
+int logFormat(char*, size_t, const struct logRecord*);
+size_t loggerDrain(char*, size_t*, int);
+void loggerFlush(char*, size_t*, int);
+unsigned long loggerDropped();
+
+static struct logger logState = { .lock = PTHREAD_MUTEX_INITIALIZER };
+static __thread struct logChannel *logLocal = NULL;
+
+/**
+* Starts the background writer thread, or configures immediate formatting when
+* synchronous is set. Quiet discards every record.
+*
+* @param synchronous
+* @param quiet
+* @return void
+*/
+void loggerInit(int synchronous, int quiet)
+{
+    logState.synchronous = synchronous;
+    logState.quiet = quiet;
+
+    if (synchronous || quiet)
+        return;
+
+    atomic_store(&logState.running, 1);
+
+    if (pthread_create(&logState.writer, NULL, loggerWriter, NULL) != 0)
+    {
+        printf("Unable to start logging thread, logging synchronously.\n");
+        atomic_store(&logState.running, 0);
+        logState.synchronous = 1;
+    }
+}
+
+/**
+* Stops the writer thread once every ring has been drained and reports the
+* records that were dropped because a ring was full.
+*
+* @return void
+*/
+void loggerShutdown()
+{
+    unsigned long dropped;
+
+    if (atomic_exchange(&logState.running, 0))
+        pthread_join(logState.writer, NULL);
+
+    fflush(stdout);
+
+    if ((dropped = loggerDropped()) > 0)
+        printf("Logger dropped %lu records.\n", dropped);
+}
+
+/**
+* Returns the ring of the calling thread, registering one on first use.
+*
+* @return struct logChannel*
+*/
+struct logChannel *loggerChannel()
+{
+    int index;
+    struct logChannel *channel;
+
+    if (logLocal != NULL)
+        return logLocal;
+
+    if ((channel = calloc(1, sizeof(*channel))) == NULL)
+    {
+        printf("Unable to allocate logging channel.\n");
+        exit(1);
+    }
+
+    pthread_mutex_lock(&logState.lock);
+
+    if ((index = atomic_load(&logState.channelCount)) == LOG_MAX_CHANNELS)
+    {
+        pthread_mutex_unlock(&logState.lock);
+        printf("Too many logging threads, at most %d are supported.\n", LOG_MAX_CHANNELS);
+        exit(1);
+    }
+
+    logState.channels[index] = channel;
+    atomic_store_explicit(&logState.channelCount, index + 1, memory_order_release);
+
+    pthread_mutex_unlock(&logState.lock);
+
+    return logLocal = channel;
+}
+
+/**
+* Queues a log record from the calling thread, dropping it if the ring of the
+* thread is full.
+*
+* @param type
+* @param link
+* @param value
+* @param label
+* @return void
+*/
+void logRecord(unsigned int type, unsigned int link, unsigned long value, const char *label)
+{
+    char line[LOG_LINE_BYTES];
+    struct logRecord *record;
+    struct logChannel *channel;
+    size_t head, tail;
+
+    if (logState.quiet)
+        return;
+
+    if (logState.synchronous)
+    {
+        struct logRecord immediate = { type, link, value, label };
+
+        logFormat(line, sizeof(line), &immediate);
+        fputs(line, stdout);
+        return;
+    }
+
+    channel = loggerChannel();
+    head = atomic_load_explicit(&channel->head, memory_order_relaxed);
+    tail = atomic_load_explicit(&channel->tail, memory_order_acquire);
+
+    if (head - tail == LOG_RING_SIZE)
+    {
+        atomic_fetch_add_explicit(&channel->dropped, 1, memory_order_relaxed);
+        metricAdd(METRIC_LOG_DROPPED, 1);
+        return;
+    }
+
+    record = &channel->records[head % LOG_RING_SIZE];
+    record->type = type;
+    record->link = link;
+    record->value = value;
+    record->label = label;
+
+    atomic_store_explicit(&channel->head, head + 1, memory_order_release);
+}
+
+/**
+* Formats a log record into text, returning the number of bytes written.
+*
+* @param out
+* @param size
+* @param record
+* @return int
+*/
+int logFormat(char *out, size_t size, const struct logRecord *record)
+{
+    switch (record->type)
+    {
+        case LOG_MAJOR_FRAME:
+            return snprintf(out, size, "Spacecraft %u Major Frame %lu\n", record->link, record->value);
+        case LOG_COMMAND:
+            return snprintf(out, size, "%s command %lX has been issued.\n", record->label, record->value);
+        case LOG_UNKNOWN:
+            return snprintf(out, size, "Unknown command %lX has been issued.\n", record->value);
+        case LOG_FRAME_END:
+            return snprintf(out, size, "\n");
+        case LOG_FRAME_SENT:
+            return snprintf(out, size, "Major Frame %lu has been sent to MDP.\n", record->value);
+        case LOG_VEHICLE_SENT:
+            return snprintf(out, size, "Vehicle %u Major Frame %lu has been sent to MDP.\n", record->link,
+                record->value);
+        default:
+            return snprintf(out, size, "Unknown log record %u.\n", record->type);
+    }
+}
+
+/**
+* Formats the pending records of every ring into the batch buffer, writing the
+* buffer out whenever it fills. Returns the number of records formatted.
+*
+* @param batch
+* @param used
+* @param fd
+* @return size_t
+*/
+size_t loggerDrain(char *batch, size_t *used, int fd)
+{
+    int length;
+    size_t head, tail, drained = 0;
+    struct logChannel *channel;
+    int channels = atomic_load_explicit(&logState.channelCount, memory_order_acquire);
+
+    for (int i = 0; i < channels; i++)
+    {
+        channel = logState.channels[i];
+        tail = atomic_load_explicit(&channel->tail, memory_order_relaxed);
+        head = atomic_load_explicit(&channel->head, memory_order_acquire);
+
+        for (; tail != head; tail++, drained++)
+        {
+            if (LOG_BATCH_BYTES - *used < LOG_LINE_BYTES)
+            {
+                loggerFlush(batch, used, fd);
+            }
+            // Lines longer than LOG_LINE_BYTES are truncated by snprintf
+            length = logFormat(batch + *used, LOG_LINE_BYTES, &channel->records[tail % LOG_RING_SIZE]);
+            *used += length < LOG_LINE_BYTES ? length : LOG_LINE_BYTES - 1;
+        }
+
+        atomic_store_explicit(&channel->tail, tail, memory_order_release);
+    }
+    return drained;
+}
+
+/**
+* Writes out the formatted batch as one output stage, after anything printed
+* directly through stdio.
+*
+* @param batch
+* @param used
+* @param fd
+* @return void
+*/
+void loggerFlush(char *batch, size_t *used, int fd)
+{
+    unsigned long start;
+
+    fflush(stdout);
+
+    start = metricStart();
+    write(fd, batch, *used);
+    metricStop(STAGE_OUTPUT, start, 1);
+
+    *used = 0;
+}
+
+/**
+* Background writer draining the rings of every producing thread. Output is
+* written once per drain pass; an idle pass sleeps briefly so producers never
+* have to wake the writer.
+*
+* @param arg
+* @return void*
+*/
+void *loggerWriter(void *arg)
+{
+    size_t used = 0;
+    char *batch;
+    struct timespec idle = { 0, LOG_IDLE_NSEC };
+
+    (void)arg;
+
+    if ((batch = malloc(LOG_BATCH_BYTES)) == NULL)
+    {
+        printf("Unable to allocate logging buffer.\n");
+        exit(1);
+    }
+
+    while (atomic_load(&logState.running))
+    {
+        if (loggerDrain(batch, &used, STDOUT_FILENO) == 0)
+            nanosleep(&idle, NULL);
+
+        if (used > 0)
+            loggerFlush(batch, &used, STDOUT_FILENO);
+    }
+
+    // Final pass for records queued before shutdown
+    loggerDrain(batch, &used, STDOUT_FILENO);
+
+    if (used > 0)
+        loggerFlush(batch, &used, STDOUT_FILENO);
+
+    free(batch);
+    return NULL;
+}
+
+/**
+* Returns the total number of records dropped across every ring.
+*
+* @return unsigned long
+*/
+unsigned long loggerDropped()
+{
+    unsigned long dropped = 0;
+    int channels = atomic_load_explicit(&logState.channelCount, memory_order_acquire);
+
+    for (int i = 0; i < channels; i++)
+        dropped += atomic_load_explicit(&logState.channels[i]->dropped, memory_order_relaxed);
+
+    return dropped;
+}
+
+#endif
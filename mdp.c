@@ -1,25 +1,151 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
 #include "commands.h"
+#include "reassembler.h"
+#include "scan.h"
+#include "dictionary.h"
+#include "dispatch.h"
+#include "decode.h"
+#include "logger.h"
+#include "pipeline.h"
+#include "recv.h"
+#include "archive.h"
+#include "metrics.h"
+#include "datagram.h"
+#include "shm.h"
+#include "integrity.h"
+#include "alarms.h"
+#include "priority.h"
+#include "publish.h"
+#include <stdint.h>
+#include <sys/resource.h>
+#include <signal.h>
 #include <sys/errno.h>
+#include <sys/epoll.h>
 #include <netinet/in.h>
 
 #define SOCKADDR struct sockaddr
+#define MAX_EVENTS 256
+#define MAX_PEERS 256
+#define PEER_LINGER_NS 5000000000UL
 
-static unsigned long frameCount = 1;
+/**
+* Per connection state for a single spacecraft link. Each link keeps its own
+* frame reassembler and frame counter so many vehicles can be ingested by one
+* mdp process without sharing framing state. The received counter numbers
+* frames on the receiving thread for the archive, ahead of the decode pipeline,
+* and the handed counter numbers the frames handed on for handling there, as
+* the handler will number them, for the priority lane. Open links are chained
+* so the event loops can close those still connected when they stop.
+*/
+struct link
+{
+    struct link *prev;
+    struct link *next;
+    int fd;
+    int killed;
+    unsigned int id;
+    unsigned long frameCount;
+    unsigned long received;
+    unsigned long handed;
+    struct sequence integrity;
+    struct reassembler ra;
+};
+
+/**
+* A datagram sender, identified by its source address. The link of a peer is
+* closed once it has issued the KILL command; the peer is kept for
+* PEER_LINGER_NS after so late copies of its datagrams are recognized and
+* dropped, and its slot can be taken by a new sender after that.
+*/
+struct peer
+{
+    struct sockaddr_storage address;
+    socklen_t length;
+    struct sequence sequence;
+    struct link *lnk;
+    unsigned long endedNs;
+};
+
+/**
+* Command line configuration of the mdp server utility.
+*/
+struct options
+{
+    char *protocol;
+    int port;
+    int debug;
+    int multiplex;
+    int workers;
+    int backend;
+    char *recordDir;
+    unsigned long segmentMB;
+    unsigned long segmentSeconds;
+    int compress;
+    char *dictionary;
+    char *statsFile;
+    char *statsSocket;
+    double statsInterval;
+    int quiet;
+    int frameSize;
+    int headerWidth;
+    int udp;
+    char *shm;
+    int trailer;
+    double alarmWindow;
+    int priority;
+    double prioritySlo;
+    char *publishPath;
+};
+
+static int pipelineDebug = 0;
+static int recvBackend = RECV_READ;
+static unsigned int linkCount = 0;
+static struct link *openLinks = NULL;
+static struct pipeline *decodePipeline = NULL;
+static struct recorder *archive = NULL;
+static struct priorityLane priorityState;
+static struct priorityLane *priority = NULL;
+static volatile sig_atomic_t serving = 1;
+static int socketType = SOCK_STREAM;
+static unsigned int peerCount = 0;
+static struct peer peers[MAX_PEERS];
+static unsigned long peersRefused = 0;
 
 void argumentError();
+void recvReport();
+void stopServing(int);
+void catchStopSignals();
+void serveLinks(int*, int*);
+int serveLinksUring(int*, int*);
+void serveDatagrams(int*, int*);
+void serveShm(struct shmRing*, int*);
+struct peer *findPeer(const struct sockaddr_storage*, socklen_t);
+struct peer *openPeer(struct peer*, const struct sockaddr_storage*, socklen_t, unsigned long);
+void peerReport(const struct peer*);
+void postAccept(struct uring*, int);
+void postRecv(struct uring*, struct link*);
+struct io_uring_sqe *nextSqe(struct uring*);
+int drainLink(struct link*, int*);
 int establishClient(int*);
-int removeHeader(unsigned long*);
-void extractTelmetry(int*, int*);
-int handleMajorFrame(char*, int*);
-int commandHandler(unsigned long*);
+struct link *openLink(int);
+void closeLink(struct link*);
+void closeLinks();
+void freeLink(void*);
+int readLink(struct link*, int*);
+void extractTelmetry(struct link*, int*);
+int processFrames(struct link*, char*, size_t, int*);
+int handleFrames(struct link*, char*, size_t, int*);
+int applyMajorFrame(struct link*, char*, const struct decodedFrame*, int*);
+int applyPipelined(void*, char*, const struct decodedFrame*);
 void ipv6ServerStartup(int*, int*);
 void setSockAddr(struct sockaddr_in*, int*);
 void setSock6Addr(struct sockaddr_in6*, int*);
-void argumentHandler(int*, char**, char**, int*, int*);
+void argumentHandler(int*, char**, struct options*);
 void ipv4ServerStartup(struct sockaddr_in*, int*, int*);
 void startServer(struct sockaddr_in*, int*, int*, char*);
 
@@ -43,24 +169,192 @@ void startServer(struct sockaddr_in*, int*, int*, char*);
 */
 int main(int argc, char **argv)
 {
-    char *PROTOCOL = "";
+    int socket_fd = -1;
+    struct link *client;
+    struct shmRing *ring;
     struct sockaddr_in servaddr;
-    int socket_fd, conn_fd, PORT = -1, debug = 0;
+    struct recorder recorder;
+    struct options opts = { "", -1, 0, 0, 0, RECV_READ, NULL, ARCHIVE_SEGMENT_BYTES >> 20, 0, 0,
+        NULL, NULL, NULL, 1, 0, FRAME_SIZE, HEADER_WIDTH, 0, NULL, 0, ALARM_DEFAULT_WINDOW, 0,
+        PRIORITY_DEFAULT_SLO_US, NULL };
 
     // Processes and populates command line argument fields
-    argumentHandler(&argc, argv, &PROTOCOL, &PORT, &debug);
+    argumentHandler(&argc, argv, &opts);
+
+    // Fixes the frame geometry shared with the simulator
+    if (!geometrySet(opts.frameSize, opts.headerWidth))
+    {
+        printf("Frame size must exceed a header width of at least 2 and be at most %d.\n", FRAME_MAX_SIZE);
+        exit(1);
+    }
+
+    // Frame trailers are verified against their sequence number and CRC32C
+    if (!geometryTrailer(opts.trailer))
+    {
+        printf("Frame trailers need %d minor frames after the header and final minor frame.\n",
+            FRAME_TRAILER_WORDS);
+        exit(1);
+    }
+    integrityInit();
+
+    // Selects the minor frame scanning kernel for this processor
+    scanInit();
+
+    // Selects the major frame decoding kernel for the frame geometry
+    decodeInit();
+
+    // Loads the telemetry dictionary over the built-in commands
+    if (opts.dictionary != NULL && dictionaryLoad(opts.dictionary) == -1)
+        exit(1);
+
+    // Builds the command dispatch table, the scanning kernels take its alarm codes
+    dispatchInit();
+    scanAlarms();
+
+    // Correlates the alarms of every vehicle over a sliding window
+    alarmInit(opts.alarmWindow);
+
+    // Debug output is logged synchronously to stay ordered with frame dumps
+    loggerInit(opts.debug, opts.quiet);
+
+    // Exports throughput counters and stage latencies when requested
+    metricsInit("mdp", opts.statsFile, opts.statsSocket, opts.statsInterval);
+
+    if (opts.debug)
+    {
+        printf("Using %s minor frame scanning kernel.\n", scanKernelName());
+        printf("Using %s major frame decoding kernel for %d word frames.\n", decodeKernelName(),
+            frameGeometry.frameSize);
+
+        if (frameGeometry.trailerWords)
+            printf("Using %s CRC32C kernel for frame trailers.\n", integrityKernelName());
+    }
+
+    // Records every received major frame into mapped archive segments
+    if (opts.recordDir != NULL)
+    {
+        // Compressed segments are encoded with the column kernels of this processor
+        columnarInit();
+
+        // Segment indexes record which dictionary commands each block holds
+        indexInit();
+
+        if (recorderOpen(&recorder, opts.recordDir, opts.segmentMB << 20, opts.segmentSeconds,
+            opts.compress) == -1)
+        {
+            printf("Unable to open archive in %s: %s.\n", opts.recordDir, strerror(errno));
+            exit(1);
+        }
+
+        if (opts.debug && opts.compress)
+            printf("Using %s column kernels for compressed archive segments.\n", columnarKernelName());
+
+        archive = &recorder;
+    }
+
+    // Hands alarms picked out of received frames to a handler of their own
+    if (opts.priority)
+    {
+        priorityStart(&priorityState, opts.prioritySlo, opts.quiet);
+        priority = &priorityState;
+    }
+
+    // Publishes decoded frames and commands to local subscribers
+    if (opts.publishPath != NULL)
+        publishInit(opts.publishPath);
+
+    // Decodes frames on a pool of worker threads when requested
+    if (opts.workers > 0)
+    {
+        pipelineDebug = opts.debug;
+        decodePipeline = pipelineCreate(opts.workers, applyPipelined, freeLink);
+    }
+
+    if (opts.shm != NULL)
+    {
+        // Takes the frames of a co-located sim from a shared memory ring
+        if ((ring = shmCreate(opts.shm, MAJOR_FRAME_BYTES)) == NULL)
+        {
+            printf("Unable to create shared memory ring %s: %s.\n", opts.shm, strerror(errno));
+            exit(1);
+        }
+
+        recvBackend = RECV_SHM;
+        serveShm(ring, &opts.debug);
+        shmDestroy(opts.shm, ring);
+    }
+    else
+    {
+        // Starts up server utility based on cmd line protocol assignment
+        socketType = opts.udp ? SOCK_DGRAM : SOCK_STREAM;
+        startServer(&servaddr, &socket_fd, &opts.port, opts.protocol);
+
+        recvBackend = opts.backend;
 
-    // Starts up server utility based on cmd line protocol assignment
-    startServer(&servaddr, &socket_fd, &PORT, PROTOCOL);
+        if (opts.udp)
+        {
+            // Receives datagrams of every spacecraft on the one socket
+            recvBackend = RECV_RECVMMSG;
+            serveDatagrams(&socket_fd, &opts.debug);
+        }
+        else if (recvBackend == RECV_URING)
+        {
+            // Services every spacecraft link from io_uring completions when supported
+            if (serveLinksUring(&socket_fd, &opts.debug) == -1)
+            {
+                printf("io_uring is unavailable: %s, falling back to recvmmsg.\n", strerror(errno));
+                recvBackend = RECV_RECVMMSG;
+                serveLinks(&socket_fd, &opts.debug);
+            }
+        }
+        else if (opts.multiplex)
+        {
+            // Services every spacecraft link from a single epoll event loop
+            serveLinks(&socket_fd, &opts.debug);
+        }
+        else
+        {
+            // Establishes client connection returning file descriptor
+            client = openLink(establishClient(&socket_fd));
 
-    // Establishes client connection returning file descriptor
-    conn_fd = establishClient(&socket_fd);
+            // Handling incoming telemetry from socket
+            extractTelmetry(client, &opts.debug);
+            closeLink(client);
+        }
+    }
 
-    // Handling incoming telemetry from socket
-    extractTelmetry(&conn_fd, &debug);
+    // Handles every frame still in flight through the decode pipeline
+    if (decodePipeline != NULL)
+        pipelineDestroy(decodePipeline);
+
+    if (priority != NULL)
+        priorityStop(priority);
+
+    if (opts.publishPath != NULL)
+        publishShutdown();
+
+    // Flushes all telemetry output still queued for the writer thread
+    loggerShutdown();
+    metricsShutdown();
+    recvReport();
+    alarmReport();
+
+    if (priority != NULL)
+        priorityReport(priority);
+
+    if (archive != NULL)
+    {
+        recorderClose(archive);
+        printf("Recorded %lu frames into %u archive segments in %s.\n",
+            archive->recorded, archive->segments, opts.recordDir);
+    }
+
+    if (opts.debug)
+        dispatchReport();
 
     // close socket descriptor
-    close(socket_fd);
+    if (socket_fd != -1)
+        close(socket_fd);
 
     return 0;
 }
@@ -70,144 +364,903 @@ int main(int argc, char **argv)
 * simulation client and halts once the simulated spacecraft send the KILL command
 * within a major frame packet.
 *
-* @param fd
+* @param lnk
 * @param debug_mode
 * @return void
 */
-void extractTelmetry(int *fd, int *debug_mode)
+void extractTelmetry(struct link *lnk, int *debug_mode)
 {
-    int headerSize = -1, executing = 1;
-    char buff[FRAME_SIZE * sizeof(unsigned long)];
+    char *frames;
+    size_t count;
+    int executing = 1;
 
     while (executing)
     {
-        bzero(buff, sizeof(buff));
-        read(*fd, buff, sizeof(buff));
+        // Blocks until more of the telemetry stream has arrived
+        if (recvFill(recvBackend, &lnk->ra, lnk->fd) <= 0)
+            break;
+
+        // Handles every complete major frame the read has provided
+        while (executing && (frames = reassemblerNextBatch(&lnk->ra, &count)) != NULL)
+            executing = processFrames(lnk, frames, count, debug_mode);
+    }
+}
+
+/**
+* Event loop servicing any number of simultaneous spacecraft links. The server
+* socket and every accepted link are non-blocking and registered with a single
+* epoll instance; each readable link is drained into its own frame buffer and
+* complete major frames are handled as they become available. Runs until the
+* process is interrupted or terminated, then closes the links still connected.
+*
+* @param sock_fd
+* @param debug_mode
+* @return void
+*/
+void serveLinks(int *sock_fd, int *debug_mode)
+{
+    int epoll_fd, ready, cli_fd;
+    struct link *lnk;
+    struct epoll_event ev, events[MAX_EVENTS];
+
+    // Interrupts epoll_wait so the event loop can return and flush its output
+    catchStopSignals();
+
+    if ((listen(*sock_fd, SOMAXCONN)) == -1)
+    {
+        printf("BSD listen call failed: %s.\n", strerror(errno));
+        exit(1);
+    }
+
+    if ((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+    {
+        printf("epoll_create1 call failed: %s.\n", strerror(errno));
+        exit(1);
+    }
+
+    fcntl(*sock_fd, F_SETFL, fcntl(*sock_fd, F_GETFL) | O_NONBLOCK);
+
+    // The server socket is identified by a NULL link pointer
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, *sock_fd, &ev) == -1)
+    {
+        printf("epoll_ctl call failed: %s.\n", strerror(errno));
+        exit(1);
+    }
+
+    printf("Waiting for spacecraft connections on epoll event loop...\n");
+
+    while (serving)
+    {
+        recvCounters.waits++;
+
+        if ((ready = epoll_wait(epoll_fd, events, MAX_EVENTS, -1)) == -1)
+        {
+            if (errno == EINTR)
+                continue;
+
+            printf("epoll_wait call failed: %s.\n", strerror(errno));
+            exit(1);
+        }
+
+        for (int i = 0; i < ready; i++)
+        {
+            lnk = events[i].data.ptr;
+
+            if (lnk == NULL)
+            {
+                // Accept every pending connection request
+                while ((cli_fd = accept4(*sock_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1)
+                {
+                    lnk = openLink(cli_fd);
+                    ev.events = EPOLLIN | EPOLLRDHUP;
+                    ev.data.ptr = lnk;
+
+                    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, cli_fd, &ev) == -1)
+                    {
+                        printf("epoll_ctl call failed: %s.\n", strerror(errno));
+                        closeLink(lnk);
+                        continue;
+                    }
+                    printf("Spacecraft %u has connected to MDP.\n", lnk->id);
+                }
+
+                if (errno != EAGAIN && errno != EWOULDBLOCK)
+                    printf("BSD accept call has failed: %s.\n", strerror(errno));
+            }
+            else if (!readLink(lnk, debug_mode))
+            {
+                // Closing the descriptor also removes it from the epoll set
+                printf("Spacecraft %u has disconnected from MDP.\n", lnk->id);
+                closeLink(lnk);
+            }
+        }
+    }
+    close(epoll_fd);
+    closeLinks();
+}
+
+/**
+* Receives the datagrams of any number of spacecraft on a single datagram
+* socket, up to DATAGRAM_VLEN per recvmmsg call. Each sender gets a link on its
+* first datagram; sequence numbers are tracked per sender, duplicates dropped
+* and the frames of every other well formed datagram handled in arrival order.
+* Runs until the process is interrupted or terminated, then reports the
+* sequence accounting of every sender.
+*
+* @param sock_fd
+* @param debug_mode
+* @return void
+*/
+void serveDatagrams(int *sock_fd, int *debug_mode)
+{
+    int received, size = DATAGRAM_RCVBUF;
+    char *frames;
+    unsigned int count;
+    unsigned long seq, start, now;
+    struct peer *p;
+    struct iovec iov[DATAGRAM_VLEN];
+    struct mmsghdr msgs[DATAGRAM_VLEN];
+    struct sockaddr_storage addresses[DATAGRAM_VLEN];
+    static _Alignas(64) char buffers[DATAGRAM_VLEN][DATAGRAM_MAX_BYTES + 1];
+
+    // Interrupts recvmmsg so the receive loop can return and flush its output
+    catchStopSignals();
+
+    // A deep receive buffer absorbs bursts while frames are handled
+    setsockopt(*sock_fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+    printf("Waiting for spacecraft datagrams...\n");
+
+    while (serving)
+    {
+        for (int i = 0; i < DATAGRAM_VLEN; i++)
+        {
+            iov[i].iov_base = buffers[i];
+            iov[i].iov_len = sizeof(buffers[i]);
+            memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &addresses[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(addresses[i]);
+        }
+
+        recvCounters.calls++;
+        start = metricStart();
+
+        // Blocks for the first datagram at most, the rest only take queued ones
+        if ((received = recvmmsg(*sock_fd, msgs, DATAGRAM_VLEN, MSG_WAITFORONE, NULL)) == -1)
+        {
+            if (errno == EINTR)
+                continue;
+
+            printf("recvmmsg call failed: %s.\n", strerror(errno));
+            exit(1);
+        }
+
+        metricStop(STAGE_RECEIVE, start, received);
+        metricAdd(METRIC_DATAGRAMS, received);
+        now = metricsNow();
+
+        for (int i = 0; i < received; i++)
+        {
+            recvCounters.bytes += msgs[i].msg_len;
+            metricAdd(METRIC_BYTES, msgs[i].msg_len);
+
+            p = findPeer(&addresses[i], msgs[i].msg_hdr.msg_namelen);
+
+            // Malformed datagrams are counted against a known sender but never given a peer
+            if ((frames = datagramFrames(buffers[i], msgs[i].msg_len, MAJOR_FRAME_BYTES, &count, &seq)) == NULL)
+            {
+                if (p != NULL)
+                    p->sequence.malformed++;
+                continue;
+            }
+
+            if ((p == NULL || (p->lnk == NULL && now - p->endedNs >= PEER_LINGER_NS)) &&
+                (p = openPeer(p, &addresses[i], msgs[i].msg_hdr.msg_namelen, now)) == NULL)
+                continue;
+
+            if (!sequenceTrack(&p->sequence, seq, METRIC_MISSED_DATAGRAMS) || p->lnk == NULL)
+                continue;
+
+            if (!processFrames(p->lnk, frames, count, debug_mode))
+            {
+                printf("Spacecraft %u has disconnected from MDP.\n", p->lnk->id);
+                peerReport(p);
+                closeLink(p->lnk);
+                p->lnk = NULL;
+                p->endedNs = now;
+            }
+        }
+    }
+
+    if (peersRefused > 0)
+        printf("Refused %lu datagrams of new senders with all %d peers in use.\n", peersRefused, MAX_PEERS);
+
+    for (unsigned int i = 0; i < peerCount; i++)
+    {
+        if (peers[i].lnk != NULL)
+        {
+            peerReport(&peers[i]);
+            closeLink(peers[i].lnk);
+        }
+    }
+}
+
+/**
+* Takes the major frames of co-located sims from a shared memory ring, one sim
+* at a time. Each run of published frames is handled in place and released
+* once handled, so the ring is read without a system call per frame. A sim
+* gets a link on its first frame, which is closed when it issues the KILL
+* command, detaches, exits without detaching or is taken over by another sim.
+* Runs until the process is interrupted or terminated.
+*
+* @param ring
+* @param debug_mode
+* @return void
+*/
+void serveShm(struct shmRing *ring, int *debug_mode)
+{
+    char *frames;
+    size_t count;
+    int producer = 0;
+    struct link *lnk = NULL;
+
+    // Interrupts the futex wait so the loop can return and flush its output
+    catchStopSignals();
+
+    printf("Waiting for spacecraft frames on shared memory ring of %lu frames...\n", ring->capacity);
+
+    while (serving)
+    {
+        if ((frames = shmPeek(ring, &count)) == NULL)
+        {
+            // A sim detaching or exiting without KILL ends its link once its frames are handled
+            if (!shmAwait(ring) && lnk != NULL && (atomic_load(&ring->closed) || shmOrphaned(ring)))
+            {
+                printf("Spacecraft %u has disconnected from MDP.\n", lnk->id);
+                closeLink(lnk);
+                lnk = NULL;
+            }
+            continue;
+        }
+
+        // A sim taking over from one that exited without detaching gets a link of its own
+        if (lnk != NULL && atomic_load(&ring->attached) != 0 && atomic_load(&ring->attached) != producer)
+        {
+            printf("Spacecraft %u has disconnected from MDP.\n", lnk->id);
+            closeLink(lnk);
+            lnk = NULL;
+        }
+
+        if (lnk == NULL)
+        {
+            lnk = openLink(-1);
+            producer = atomic_load(&ring->attached);
+            printf("Spacecraft %u has connected to MDP.\n", lnk->id);
+        }
+
+        recvCounters.calls++;
+        recvCounters.bytes += count * MAJOR_FRAME_BYTES;
+        metricAdd(METRIC_BYTES, count * MAJOR_FRAME_BYTES);
+
+        if (!processFrames(lnk, frames, count, debug_mode))
+        {
+            printf("Spacecraft %u has disconnected from MDP.\n", lnk->id);
+            closeLink(lnk);
+            lnk = NULL;
+        }
+        shmRelease(ring, count);
+    }
+
+    recvCounters.waits = shmCounters.waits;
+
+    if (lnk != NULL)
+        closeLink(lnk);
+}
+
+/**
+* Returns the peer of a source address, or NULL for an unknown sender.
+*
+* @param address
+* @param length
+* @return struct peer*
+*/
+struct peer *findPeer(const struct sockaddr_storage *address, socklen_t length)
+{
+    for (unsigned int i = 0; i < peerCount; i++)
+    {
+        if (peers[i].length == length && memcmp(&peers[i].address, address, length) == 0)
+            return &peers[i];
+    }
+    return NULL;
+}
+
+/**
+* Opens a link for a sender, in its own peer when it has lingered past its
+* last link, otherwise in a free slot or the slot of a peer whose link ended
+* PEER_LINGER_NS ago. Returns NULL, logging the first refusal of a run, when
+* every peer is in use.
+*
+* @param p
+* @param address
+* @param length
+* @param now
+* @return struct peer*
+*/
+struct peer *openPeer(struct peer *p, const struct sockaddr_storage *address, socklen_t length, unsigned long now)
+{
+    static int refusing = 0;
+
+    for (unsigned int i = 0; p == NULL && i < MAX_PEERS; i++)
+    {
+        if (i == peerCount)
+            p = &peers[peerCount++];
+        else if (peers[i].lnk == NULL && now - peers[i].endedNs >= PEER_LINGER_NS)
+            p = &peers[i];
+    }
+
+    if (p == NULL)
+    {
+        if (!refusing)
+            printf("Refusing datagrams of new senders: all %d peers are in use.\n", MAX_PEERS);
+
+        refusing = 1;
+        peersRefused++;
+        return NULL;
+    }
+
+    memset(p, 0, sizeof(*p));
+    memcpy(&p->address, address, length);
+    p->length = length;
+    p->lnk = openLink(-1);
+    printf("Spacecraft %u has connected to MDP.\n", p->lnk->id);
+    refusing = 0;
+
+    return p;
+}
+
+/**
+* Prints the sequence accounting of a datagram sender.
+*
+* @param p
+* @return void
+*/
+void peerReport(const struct peer *p)
+{
+    const struct sequence *s = &p->sequence;
+
+    printf("Spacecraft %u received %lu datagrams: %lu missing in %lu gaps, %lu reordered, %lu duplicated, "
+        "%lu malformed.\n", p->lnk->id, s->received, s->missing, s->gaps, s->reordered, s->duplicates,
+        s->malformed);
+}
+
+/**
+* Event loop servicing any number of simultaneous spacecraft links through
+* io_uring. An accept and one receive per link are kept posted; each receive
+* targets the free space of the link reassembler so data lands directly in the
+* ring, and a single io_uring_enter call both submits new requests and reaps
+* every available completion. Returns -1 with errno set when io_uring is not
+* supported, otherwise runs until the process is interrupted or terminated and
+* then closes the links still connected.
+*
+* @param sock_fd
+* @param debug_mode
+* @return int
+*/
+int serveLinksUring(int *sock_fd, int *debug_mode)
+{
+    int res;
+    struct uring ring;
+    struct link *lnk;
+    struct io_uring_cqe *cqe;
+    unsigned int links = 0;
+
+    if (uringInit(&ring, URING_ENTRIES) == -1)
+        return -1;
+
+    catchStopSignals();
+
+    if ((listen(*sock_fd, SOMAXCONN)) == -1)
+    {
+        printf("BSD listen call failed: %s.\n", strerror(errno));
+        exit(1);
+    }
 
-        if (*debug_mode)
+    printf("Waiting for spacecraft connections on io_uring event loop...\n");
+
+    postAccept(&ring, *sock_fd);
+
+    while (serving)
+    {
+        if (uringSubmit(&ring, 1) == -1)
         {
-            printf("\nMajor Frame %lu Dump\n", frameCount);
-            printBits(sizeof(buff), &buff);
+            if (errno == EINTR)
+                continue;
+
+            printf("io_uring_enter call failed: %s.\n", strerror(errno));
+            exit(1);
         }
 
-        // Counts minor frames consumed by header
-        headerSize = removeHeader((unsigned long *)buff);
+        while ((cqe = uringPeekCqe(&ring)) != NULL)
+        {
+            lnk = (struct link *)(uintptr_t)cqe->user_data;
+            res = cqe->res;
+            uringSeenCqe(&ring);
+
+            if (lnk == NULL)
+            {
+                // Kernels without accept support report it on the first request
+                if (res < 0 && links == 0 && (res == -EINVAL || res == -EOPNOTSUPP))
+                {
+                    uringFree(&ring);
+                    errno = -res;
+                    return -1;
+                }
+
+                if (res < 0)
+                {
+                    printf("io_uring accept has failed: %s.\n", strerror(-res));
+                }
+                else
+                {
+                    lnk = openLink(res);
+                    links++;
+                    printf("Spacecraft %u has connected to MDP.\n", lnk->id);
+                    postRecv(&ring, lnk);
+                }
+                postAccept(&ring, *sock_fd);
+            }
+            else if (res > 0)
+            {
+                recvCounters.bytes += res;
+                metricAdd(METRIC_BYTES, res);
+                lnk->ra.head += res;
+
+                if (drainLink(lnk, debug_mode))
+                {
+                    postRecv(&ring, lnk);
+                    continue;
+                }
+                printf("Spacecraft %u has disconnected from MDP.\n", lnk->id);
+                closeLink(lnk);
+            }
+            else
+            {
+                printf("Spacecraft %u has disconnected from MDP.\n", lnk->id);
+                closeLink(lnk);
+            }
+        }
+    }
+
+    // Receives still posted into the links are cancelled with the ring
+    uringFree(&ring);
+    closeLinks();
+
+    return 0;
+}
+
+/**
+* Returns a submission queue entry, submitting the queued entries first when
+* the submission queue is full.
+*
+* @param ring
+* @return struct io_uring_sqe*
+*/
+struct io_uring_sqe *nextSqe(struct uring *ring)
+{
+    struct io_uring_sqe *sqe;
+
+    while ((sqe = uringGetSqe(ring)) == NULL)
+    {
+        if (uringSubmit(ring, 0) == -1 && errno != EINTR)
+        {
+            printf("io_uring_enter call failed: %s.\n", strerror(errno));
+            exit(1);
+        }
+    }
+    return sqe;
+}
+
+/**
+* Posts an accept request for the server socket, identified by a zero tag.
+*
+* @param ring
+* @param sock_fd
+* @return void
+*/
+void postAccept(struct uring *ring, int sock_fd)
+{
+    struct io_uring_sqe *sqe = nextSqe(ring);
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = sock_fd;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = 0;
+}
+
+/**
+* Posts a receive request covering the free space of the link reassembler.
+*
+* @param ring
+* @param lnk
+* @return void
+*/
+void postRecv(struct uring *ring, struct link *lnk)
+{
+    struct io_uring_sqe *sqe = nextSqe(ring);
+
+    recvCounters.calls++;
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = lnk->fd;
+    sqe->addr = (uintptr_t)(lnk->ra.base + (lnk->ra.head % lnk->ra.capacity));
+    sqe->len = lnk->ra.capacity - (lnk->ra.head - lnk->ra.tail);
+    sqe->user_data = (uintptr_t)lnk;
+}
 
-        printf("Major Frame %lu\n", frameCount);
+/**
+* Installs the handlers that end the server event loops on SIGINT or SIGTERM.
+*
+* @return void
+*/
+void catchStopSignals()
+{
+    struct sigaction sa;
 
-        // Handles the major frame commands
-        executing = handleMajorFrame(buff, &headerSize);
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stopServing;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+}
+
+/**
+* Signal handler ending the server event loops.
+*
+* @param signum
+* @return void
+*/
+void stopServing(int signum)
+{
+    (void)signum;
+    serving = 0;
+}
+
+/**
+* Prints the receive backend counters per received major frame along with the
+* processor time spent per frame.
+*
+* @return void
+*/
+void recvReport()
+{
+    double cpu;
+    struct rusage usage;
+
+    if (recvCounters.frames == 0)
+        return;
+
+    getrusage(RUSAGE_SELF, &usage);
+    cpu = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+        (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+
+    printf("Received %lu frames (%lu bytes) with the %s backend: %.3f receive calls and "
+        "%.3f waits per frame, %.3f us CPU per frame.\n",
+        recvCounters.frames, recvCounters.bytes, recvBackendName(recvBackend),
+        (double)recvCounters.calls / recvCounters.frames,
+        (double)recvCounters.waits / recvCounters.frames,
+        cpu * 1e6 / recvCounters.frames);
+}
+
+/**
+* Drains a non-blocking link of all currently available data in large reads,
+* handling each major frame once it has been completely reassembled. Returns
+* zero when the link should be closed, either from the KILL command, end of
+* stream or an error.
+*
+* @param lnk
+* @param debug_mode
+* @return int
+*/
+int readLink(struct link *lnk, int *debug_mode)
+{
+    ssize_t received;
+    unsigned long start;
+
+    for (;;)
+    {
+        start = metricStart();
+        received = recvFill(recvBackend, &lnk->ra, lnk->fd);
+
+        if (received == 0)
+            return 0;
+
+        if (received == -1)
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+
+        metricStop(STAGE_RECEIVE, start, 1);
+
+        if (!drainLink(lnk, debug_mode))
+            return 0;
+    }
+}
+
+/**
+* Handles every complete major frame buffered in the reassembler of a link,
+* returning zero once a frame has issued the KILL command.
+*
+* @param lnk
+* @param debug_mode
+* @return int
+*/
+int drainLink(struct link *lnk, int *debug_mode)
+{
+    char *frames;
+    size_t count;
 
-        frameCount++;
+    while ((frames = reassemblerNextBatch(&lnk->ra, &count)) != NULL)
+    {
+        if (!processFrames(lnk, frames, count, debug_mode))
+            return 0;
     }
+    return 1;
 }
 
 /**
-* Processes a single major frame and runs the commands within each minor frame.
+* Handles a contiguous run of complete major frames received on a link. Frames
+* are first copied straight from the reassembler into the archive when
+* recording. With frame trailers, the frames are verified and the runs of
+* intact frames between corrupt or duplicated ones handled. The alarms of the
+* handled frames are picked out for the priority lane, if any, before they are
+* queued. Returns zero once a frame has issued the KILL command.
 *
-* @param buffer
-* @param size
+* @param lnk
+* @param frames
+* @param count
+* @param debug_mode
 * @return int
 */
-int handleMajorFrame(char *buffer, int *size)
+int processFrames(struct link *lnk, char *frames, size_t count, int *debug_mode)
 {
+    size_t intact;
     int executing = 1;
-    unsigned long command;
 
-    /*
-        Loops through buffer pointer by the size of unsigned long
-        and starts at the beginning of the buffer but past the header.
-    */
-    for (unsigned long *minorFrame = (unsigned long *)
-        (buffer + (sizeof(unsigned long) * (*size))); *minorFrame; minorFrame++)
+    recvCounters.frames += count;
+    metricAdd(METRIC_FRAMES, count);
+
+    if (archive != NULL)
+        recorderAppend(archive, lnk->id, lnk->received, frames, count);
+
+    lnk->received += count;
+
+    if (!frameGeometry.trailerWords)
     {
-        memcpy(&command, minorFrame, sizeof(*minorFrame));
+        if (priority != NULL)
+            priorityScan(priority, lnk->id, lnk->handed, frames, count);
 
-        executing = commandHandler(&command);
+        lnk->handed += count;
+        return handleFrames(lnk, frames, count, debug_mode);
+    }
 
-        if (!executing || command == END)
-            break;
+    // Each run of intact frames ends at a dropped frame or the end of the batch
+    for (size_t done = 0; executing && done < count; done += intact + 1)
+    {
+        intact = verifyFrames(&lnk->integrity, frames + done * MAJOR_FRAME_BYTES, count - done);
+
+        if (intact > 0 && priority != NULL)
+            priorityScan(priority, lnk->id, lnk->handed, frames + done * MAJOR_FRAME_BYTES, intact);
+
+        lnk->handed += intact;
+
+        if (intact > 0)
+            executing = handleFrames(lnk, frames + done * MAJOR_FRAME_BYTES, intact, debug_mode);
     }
     return executing;
 }
 
 /**
-* Counts the header minor frames from the simulated major frame
-* and returns the minor frame count that is consumed by the header
-* in order to jump over during processing of commands.
+* Handles a run of intact major frames of a link, either decoding and handling
+* them on the receiving thread or submitting them to the decode pipeline.
+* Inline handling stops early once a frame has issued the KILL command;
+* pipelined frames are handled by the sink in receive order.
 *
-* @param buffer
+* @param lnk
+* @param frames
+* @param count
+* @param debug_mode
 * @return int
 */
-int removeHeader(unsigned long *buffer)
+int handleFrames(struct link *lnk, char *frames, size_t count, int *debug_mode)
 {
-    int headerSize = 0;
-    unsigned long minorFrame;
+    size_t batch, handled;
+    int executing = 1;
+    unsigned long start;
+    // Sized for the largest geometry, only the receiving thread decodes here
+    static _Alignas(64) char decodedBuffer[DECODE_BATCH * DECODED_FRAME_BYTES(FRAME_MAX_SIZE)];
+    struct decodedFrame *decoded = (struct decodedFrame *)decodedBuffer;
 
-    // Loops through buffer pointer by the size of unsigned long
-    for (unsigned long *p = buffer; *p; p++)
+    if (decodePipeline != NULL)
     {
-        memcpy(&minorFrame, p, sizeof(unsigned long));
+        pipelineSubmit(decodePipeline, lnk, frames, count);
+        return 1;
+    }
 
-        if (minorFrame == H1 || minorFrame == H2)
-            headerSize++;
-        else
-            break;
+    for (size_t done = 0; executing && done < count; done += batch)
+    {
+        batch = count - done < DECODE_BATCH ? count - done : DECODE_BATCH;
+
+        start = metricStart();
+        decodeFrames(frames + done * MAJOR_FRAME_BYTES, batch, decoded);
+        metricStop(STAGE_STRIP, start, batch);
+
+        start = metricStart();
+
+        for (handled = 0; executing && handled < batch; handled++)
+            executing = applyMajorFrame(lnk, frames + (done + handled) * MAJOR_FRAME_BYTES,
+                decodedFrameAt(decoded, handled), debug_mode);
+
+        metricStop(STAGE_DISPATCH, start, handled);
     }
-    return headerSize;
+    return executing;
 }
 
 /**
-* Handles the commands coming into the MDP and simply prints out what command
-* has been issued.
+* Handles one decoded major frame received on a link: runs the contained
+* commands and advances the frame counter of the link.
 *
-* @param command
+* @param lnk
+* @param frame
+* @param decoded
+* @param debug_mode
 * @return int
 */
-int commandHandler(unsigned long *command)
+int applyMajorFrame(struct link *lnk, char *frame, const struct decodedFrame *decoded, int *debug_mode)
 {
-    switch (*command)
+    int executing;
+
+    if (*debug_mode)
     {
-        case KILL:
-            printf("KILL command %lX has been issued.\n", KILL);
-            return 0;
-        case SOH:
-            printf("SOH command %lX has been issued.\n", SOH);
-            return 1;
-        case GOOD:
-            printf("GOOD Health command %lX has been issued.\n", GOOD);
-            return 1;
-        case BAD:
-            printf("BAD Health command %lX has been issued.\n", BAD);
-            return 1;
-        case END:
-            printf("\n");
-            return 1;
-        case ICING_ALARM:
-            printf("ICING command %lX has been issued.\n", ICING_ALARM);
-            return 1;
-        case OVERHEAT_ALARM:
-            printf("OVERHEAT command %lX has been issued.\n", OVERHEAT_ALARM);
-            return 1;
-        case SENSOR_1_ALARM:
-            printf("SENSOR_1_ALARM command %lX has been issued.\n", SENSOR_1_ALARM);
-            return 1;
-        case SENSOR_2_ALARM:
-            printf("SENSOR_2_ALARM command %lX has been issued.\n", SENSOR_2_ALARM);
-            return 1;
-        case SENSOR_3_ALARM:
-            printf("SENSOR_3_ALARM command %lX has been issued.\n", SENSOR_3_ALARM);
-            return 1;
-        case SENSOR_4_ALARM:
-            printf("SENSOR_4_ALARM command %lX has been issued.\n", SENSOR_4_ALARM);
-            return 1;
-        case SENSOR_5_ALARM:
-            printf("SENSOR_5_ALARM command %lX has been issued.\n", SENSOR_5_ALARM);
-            return 1;
-        default:
-            printf("Default case\n");
-            return 0;
+        printf("\nSpacecraft %u Major Frame %lu Dump\n", lnk->id, lnk->frameCount);
+        printBits(MAJOR_FRAME_BYTES, frame);
+    }
+
+    logRecord(LOG_MAJOR_FRAME, lnk->id, lnk->frameCount, NULL);
+
+    // Handles the major frame commands, then correlates the alarms they raised
+    dispatchAlarms = 0;
+    executing = handleMajorFrame(frame, decoded);
+    alarmUpdate(lnk->id, dispatchAlarms);
+    publishFrame(lnk->id, lnk->frameCount, frame, decoded);
+
+    lnk->frameCount++;
+
+    return executing;
+}
+
+/**
+* Decode pipeline sink callback handling a decoded frame of a link. Frames that
+* arrive after the link issued the KILL command are ignored.
+*
+* @param owner
+* @param frame
+* @param decoded
+* @return int
+*/
+int applyPipelined(void *owner, char *frame, const struct decodedFrame *decoded)
+{
+    struct link *lnk = owner;
+
+    if (lnk->killed)
+        return 0;
+
+    lnk->killed = !applyMajorFrame(lnk, frame, decoded, &pipelineDebug);
+
+    return !lnk->killed;
+}
+
+/**
+* Allocates the state for a newly accepted spacecraft link.
+*
+* @param fd
+* @return struct link*
+*/
+struct link *openLink(int fd)
+{
+    struct link *lnk;
+
+    if ((lnk = calloc(1, sizeof(*lnk))) == NULL)
+    {
+        printf("Unable to allocate link state: %s.\n", strerror(errno));
+        exit(1);
     }
+
+    if (reassemblerInit(&lnk->ra, REASSEMBLER_CAPACITY) == -1)
+    {
+        printf("Unable to map link reassembler: %s.\n", strerror(errno));
+        exit(1);
+    }
+
+    lnk->fd = fd;
+    lnk->id = ++linkCount;
+    lnk->frameCount = 1;
+    lnk->received = 1;
+    lnk->handed = 1;
+
+    lnk->next = openLinks;
+
+    if (openLinks != NULL)
+        openLinks->prev = lnk;
+
+    openLinks = lnk;
+
+    return lnk;
+}
+
+/**
+* Closes the socket of a spacecraft link and releases its state, once any of
+* its frames still in the decode pipeline have been handled.
+*
+* @param lnk
+* @return void
+*/
+void closeLink(struct link *lnk)
+{
+    if (lnk->prev != NULL)
+        lnk->prev->next = lnk->next;
+    else
+        openLinks = lnk->next;
+
+    if (lnk->next != NULL)
+        lnk->next->prev = lnk->prev;
+
+    if (lnk->ra.syncLosses)
+        printf("Spacecraft %u lost frame sync %lu times, discarding %lu bytes.\n",
+            lnk->id, lnk->ra.syncLosses, lnk->ra.discarded);
+
+    if (frameGeometry.trailerWords)
+        printf("Spacecraft %u verified %lu frames: %lu corrupt, %lu missing in %lu gaps, %lu reordered, "
+            "%lu duplicated.\n", lnk->id, lnk->integrity.received, lnk->integrity.malformed,
+            lnk->integrity.missing, lnk->integrity.gaps, lnk->integrity.reordered, lnk->integrity.duplicates);
+
+    reassemblerFree(&lnk->ra);
+
+    // Datagram links share the server socket
+    if (lnk->fd != -1)
+        close(lnk->fd);
+
+    if (decodePipeline != NULL)
+        pipelineRetire(decodePipeline, lnk);
+    else
+        freeLink(lnk);
+}
+
+/**
+* Closes every link still connected when an event loop stops, reporting each
+* as closeLink does for links that disconnect.
+*
+* @return void
+*/
+void closeLinks()
+{
+    while (openLinks != NULL)
+    {
+        printf("Spacecraft %u was still connected when MDP stopped.\n", openLinks->id);
+        closeLink(openLinks);
+    }
+}
+
+/**
+* Frees the state of a closed spacecraft link.
+*
+* @param lnk
+* @return void
+*/
+void freeLink(void *lnk)
+{
+    free(lnk);
 }
 
 /**
@@ -240,7 +1293,7 @@ int establishClient(int *sock_fd)
         printf("BSD accept call has failed: %s.\n", strerror(errno));
         exit(1);
     }
-    printf("Spacecraft has connected to MDP.");
+    printf("Spacecraft has connected to MDP.\n");
     return cli_fd;
 }
 
@@ -276,26 +1329,80 @@ void startServer(struct sockaddr_in *adr, int *sock_fd, int *port, char *protoco
 *
 * @param argc
 * @param argv
-* @param protocol
-* @param port
-* @param dbg
+* @param opts
 * @return void
 */
-void argumentHandler(int *argc, char **argv, char **protocol, int *port, int *dbg)
+void argumentHandler(int *argc, char **argv, struct options *opts)
 {
     // Must pass a parameter containing port to open socket interface.
     if (*argc < 3)
         argumentError();
 
-    // If a third argument is passed handle the argument
-    if (*argc == 4)
+    // Handle any optional arguments following the protocol
+    for (int i = 3; i < *argc; i++)
     {
-        if (strcmp(argv[3], "--debug") == 0)
-            *dbg = 1;
+        if (strcmp(argv[i], "--debug") == 0)
+            opts->debug = 1;
+        else if (strcmp(argv[i], "--epoll") == 0)
+            opts->multiplex = 1;
+        else if (strcmp(argv[i], "--workers") == 0 && i + 1 < *argc)
+            opts->workers = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--recv") == 0 && i + 1 < *argc)
+        {
+            if (!recvParseBackend(argv[++i], &opts->backend))
+                argumentError();
+        }
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < *argc)
+            opts->recordDir = argv[++i];
+        else if (strcmp(argv[i], "--segment-mb") == 0 && i + 1 < *argc)
+        {
+            if ((opts->segmentMB = strtoul(argv[++i], NULL, 10)) == 0)
+                argumentError();
+        }
+        else if (strcmp(argv[i], "--segment-seconds") == 0 && i + 1 < *argc)
+            opts->segmentSeconds = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--compress") == 0)
+            opts->compress = 1;
+        else if (strcmp(argv[i], "--stats") == 0 && i + 1 < *argc)
+            opts->statsFile = argv[++i];
+        else if (strcmp(argv[i], "--stats-socket") == 0 && i + 1 < *argc)
+            opts->statsSocket = argv[++i];
+        else if (strcmp(argv[i], "--stats-interval") == 0 && i + 1 < *argc)
+            opts->statsInterval = atof(argv[++i]);
+        else if (strcmp(argv[i], "--quiet") == 0)
+            opts->quiet = 1;
+        else if (strcmp(argv[i], "--dictionary") == 0 && i + 1 < *argc)
+            opts->dictionary = argv[++i];
+        else if (strcmp(argv[i], "--frame-size") == 0 && i + 1 < *argc)
+            opts->frameSize = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--header-width") == 0 && i + 1 < *argc)
+            opts->headerWidth = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--udp") == 0)
+            opts->udp = 1;
+        else if (strcmp(argv[i], "--shm") == 0 && i + 1 < *argc)
+            opts->shm = argv[++i];
+        else if (strcmp(argv[i], "--trailer") == 0)
+            opts->trailer = 1;
+        else if (strcmp(argv[i], "--priority") == 0)
+            opts->priority = 1;
+        else if (strcmp(argv[i], "--priority-slo") == 0 && i + 1 < *argc)
+        {
+            if ((opts->prioritySlo = atof(argv[++i])) <= 0)
+                argumentError();
+        }
+        else if (strcmp(argv[i], "--publish") == 0 && i + 1 < *argc)
+            opts->publishPath = argv[++i];
+        else if (strcmp(argv[i], "--alarm-window") == 0 && i + 1 < *argc)
+        {
+            if ((opts->alarmWindow = atof(argv[++i])) <= 0)
+                argumentError();
+        }
+        else
+            argumentError();
     }
 
-    *port = atoi(argv[1]);
-    *protocol = argv[2];
+    opts->port = atoi(argv[1]);
+    opts->protocol = argv[2];
 }
 
 /**
@@ -324,7 +1431,7 @@ void setSockAddr(struct sockaddr_in *adr, int *port)
 void ipv4ServerStartup(struct sockaddr_in *adr, int *sock_fd, int *port)
 {
     // socket creation with IPV4  & SOCK_STREAM (TCP)
-    if ((*sock_fd = socket(AF_INET, SOCK_STREAM, 0)) == -1)
+    if ((*sock_fd = socket(AF_INET, socketType, 0)) == -1)
     {
         printf("BSD socket call failed: %s.\n", strerror(errno));
         exit(1);
@@ -371,7 +1478,7 @@ void ipv6ServerStartup(int *sock_fd, int *port)
     struct sockaddr_in6 adr;
 
     // socket creation with IPV4  & SOCK_STREAM (TCP)
-    if ((*sock_fd = socket(AF_INET6, SOCK_STREAM, 0)) == -1)
+    if ((*sock_fd = socket(AF_INET6, socketType, 0)) == -1)
     {
         printf("BSD socket call failed: %s.\n", strerror(errno));
         exit(1);
@@ -403,5 +1510,19 @@ void argumentError()
     printf("./mdp 8080 --INET\n");
     printf("./mdp 8080 --INET6\n");
     printf("./mdp 8080 --INET --debug\n");
+    printf("./mdp 8080 --INET --epoll\n");
+    printf("./mdp 8080 --INET --epoll --workers 4\n");
+    printf("./mdp 8080 --INET --epoll --recv read|recvmmsg|uring\n");
+    printf("./mdp 8080 --INET --epoll --record DIR [--segment-mb 64] [--segment-seconds 60] [--compress]\n");
+    printf("./mdp 8080 --INET --epoll --stats FILE [--stats-socket PATH] [--stats-interval 1]\n");
+    printf("./mdp 8080 --INET --epoll --quiet\n");
+    printf("./mdp 8080 --INET --epoll --frame-size 32 [--header-width 4]\n");
+    printf("./mdp 8080 --INET --epoll --dictionary FILE\n");
+    printf("./mdp 8080 --INET --udp\n");
+    printf("./mdp 8080 --INET --shm NAME\n");
+    printf("./mdp 8080 --INET --epoll --trailer\n");
+    printf("./mdp 8080 --INET --epoll --alarm-window 10\n");
+    printf("./mdp 8080 --INET --epoll --workers 2 --priority [--priority-slo 100]\n");
+    printf("./mdp 8080 --INET --epoll --publish PATH\n");
     exit(1);
 }
@@ -0,0 +1,592 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/un.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+/**
+* Lightweight runtime metrics shared among mdp.c and simulator.c. Every thread
+* updates its own block of counters and stage latency histograms; a block has
+* a single writer, so updates are plain relaxed loads and stores without locked
+* instructions. Histograms are log-linear in the manner of HDR histograms: each
+* power of two is split into METRIC_SUB_BUCKETS linear buckets, bounding the
+* recording error to about 6%. An exporter thread merges the blocks into a JSON
+* snapshot, written periodically to a stats file and served to every client of
+* a local UNIX socket. Stage timing is taken only when metrics are exported.
+*
+* @author Vincent Nigro
+* @version 0.0.2
+*/
+
+#define METRIC_MAX_THREADS 64
+#define METRIC_SUB_BITS 4
+#define METRIC_SUB_BUCKETS (1 << METRIC_SUB_BITS)
+#define METRIC_BUCKETS ((64 - METRIC_SUB_BITS) * METRIC_SUB_BUCKETS)
+#define METRIC_JSON_BYTES 8192
+
+enum metricCounter
+{
+    METRIC_FRAMES,
+    METRIC_BYTES,
+    METRIC_COMMANDS,
+    METRIC_UNKNOWN,
+    METRIC_SYNC_LOSSES,
+    METRIC_DISCARDED,
+    METRIC_LOG_DROPPED,
+    METRIC_LATE_TICKS,
+    METRIC_DATAGRAMS,
+    METRIC_MISSED_DATAGRAMS,
+    METRIC_REORDERED_DATAGRAMS,
+    METRIC_DUPLICATE_DATAGRAMS,
+    METRIC_CORRUPT_FRAMES,
+    METRIC_MISSED_FRAMES,
+    METRIC_REORDERED_FRAMES,
+    METRIC_DUPLICATE_FRAMES,
+    METRIC_ALARM_RAISES,
+    METRIC_ALARM_FLAPS,
+    METRIC_PRIORITY_ALARMS,
+    METRIC_PRIORITY_OVERFLOWS,
+    METRIC_PRIORITY_SLO_MISSES,
+    METRIC_PUBLISHED_EVENTS,
+    METRIC_DROPPED_EVENTS,
+    METRIC_PUBLISH_WAITS,
+    METRIC_COUNTERS
+};
+
+enum metricStage
+{
+    STAGE_RECEIVE,
+    STAGE_STRIP,
+    STAGE_DISPATCH,
+    STAGE_OUTPUT,
+    STAGE_GENERATE,
+    STAGE_WRITE,
+    STAGE_LATENCY,
+    STAGE_JITTER,
+    STAGE_ALARM,
+    METRIC_STAGES
+};
+
+static const char *metricCounterNames[METRIC_COUNTERS] =
+{
+    "frames", "bytes", "commands", "unknown_commands",
+    "sync_losses", "discarded_bytes", "log_dropped", "late_ticks",
+    "datagrams", "missed_datagrams", "reordered_datagrams", "duplicate_datagrams",
+    "corrupt_frames", "missed_frames", "reordered_frames", "duplicate_frames",
+    "alarm_raises", "alarm_flaps", "priority_alarms", "priority_overflows", "priority_slo_misses",
+    "published_events", "dropped_events", "publish_waits"
+};
+
+static const char *metricStageNames[METRIC_STAGES] =
+{
+    "receive", "strip", "dispatch", "output", "generate", "write", "latency", "jitter", "alarm"
+};
+
+/**
+* The counters and histograms updated by one thread.
+*/
+struct metricBlock
+{
+    atomic_ulong counters[METRIC_COUNTERS];
+    atomic_ulong maxima[METRIC_STAGES];
+    atomic_ulong buckets[METRIC_STAGES][METRIC_BUCKETS];
+};
+
+/**
+* The merged state of every block at one point in time.
+*/
+struct metricSnapshot
+{
+    unsigned long takenNs;
+    unsigned long counters[METRIC_COUNTERS];
+    unsigned long maxima[METRIC_STAGES];
+    unsigned long buckets[METRIC_STAGES][METRIC_BUCKETS];
+};
+
+struct metrics
+{
+    int enabled;
+    int listenFd;
+    const char *process;
+    const char *statsFile;
+    const char *socketPath;
+    unsigned long intervalNs;
+    unsigned long startNs;
+    pthread_t exporter;
+    atomic_int running;
+    atomic_int blockCount;
+    pthread_mutex_t lock;
+    struct metricBlock *blocks[METRIC_MAX_THREADS];
+    struct metricSnapshot previous;
+    struct metricSnapshot current;
+};
+
+void metricsInit(const char*, const char*, const char*, double);
+void metricsShutdown();
+struct metricBlock *metricsBlock();
+unsigned long metricsNow();
+void metricsSnapshot(struct metricSnapshot*);
+unsigned long metricsPercentile(const struct metricSnapshot*, int, double);
+unsigned long metricsBucketPercentile(const unsigned long*, unsigned long, unsigned long, double);
+int metricsFormat(char*, size_t);
+void metricsWriteFile();
+void metricsServe();
+void *metricsExporter(void*);
+
+static struct metrics metricState = { .listenFd = -1, .lock = PTHREAD_MUTEX_INITIALIZER };
+static __thread struct metricBlock *metricLocal = NULL;
+
+/**
+* Returns the monotonic clock in nanoseconds.
+*
+* @return unsigned long
+*/
+unsigned long metricsNow()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000UL + now.tv_nsec;
+}
+
+/**
+* Adds to a counter of the calling thread.
+*
+* @param counter
+* @param amount
+* @return void
+*/
+static inline void metricAdd(int counter, unsigned long amount)
+{
+    atomic_ulong *value = &metricsBlock()->counters[counter];
+
+    atomic_store_explicit(value, atomic_load_explicit(value, memory_order_relaxed) + amount,
+        memory_order_relaxed);
+}
+
+/**
+* Returns the histogram bucket of a value: values below METRIC_SUB_BUCKETS have
+* a bucket each, larger ones share a bucket with their top METRIC_SUB_BITS + 1
+* significant bits.
+*
+* @param value
+* @return unsigned int
+*/
+static inline unsigned int metricBucket(unsigned long value)
+{
+    int shift;
+
+    if (value < METRIC_SUB_BUCKETS)
+        return value;
+
+    shift = 63 - __builtin_clzl(value) - METRIC_SUB_BITS;
+
+    return (shift + 1) * METRIC_SUB_BUCKETS + ((value >> shift) & (METRIC_SUB_BUCKETS - 1));
+}
+
+/**
+* Returns the largest value recorded into a histogram bucket.
+*
+* @param bucket
+* @return unsigned long
+*/
+static inline unsigned long metricBucketValue(unsigned int bucket)
+{
+    unsigned int shift;
+
+    if (bucket < METRIC_SUB_BUCKETS)
+        return bucket;
+
+    shift = bucket / METRIC_SUB_BUCKETS - 1;
+
+    return ((METRIC_SUB_BUCKETS + bucket % METRIC_SUB_BUCKETS + 1UL) << shift) - 1;
+}
+
+/**
+* Returns the start time of a timed stage, or zero when metrics are not being
+* exported so untimed runs never read the clock.
+*
+* @return unsigned long
+*/
+static inline unsigned long metricStart()
+{
+    return metricState.enabled ? metricsNow() : 0;
+}
+
+/**
+* Records a latency into a stage histogram count times.
+*
+* @param stage
+* @param latency
+* @param count
+* @return void
+*/
+static inline void metricRecord(int stage, unsigned long latency, unsigned long count)
+{
+    atomic_ulong *bucket, *maximum;
+    struct metricBlock *block = metricsBlock();
+
+    bucket = &block->buckets[stage][metricBucket(latency)];
+    maximum = &block->maxima[stage];
+
+    atomic_store_explicit(bucket, atomic_load_explicit(bucket, memory_order_relaxed) + count,
+        memory_order_relaxed);
+
+    if (latency > atomic_load_explicit(maximum, memory_order_relaxed))
+        atomic_store_explicit(maximum, latency, memory_order_relaxed);
+}
+
+/**
+* Records the latency of a stage started at start. A stage covering a batch of
+* count items records the per item latency count times.
+*
+* @param stage
+* @param start
+* @param count
+* @return void
+*/
+static inline void metricStop(int stage, unsigned long start, unsigned long count)
+{
+    if (start == 0 || count == 0)
+        return;
+
+    metricRecord(stage, (metricsNow() - start) / count, count);
+}
+
+/**
+* Starts exporting metrics for the named process when a stats file or socket
+* path is given, snapshotting every interval seconds.
+*
+* @param process
+* @param statsFile
+* @param socketPath
+* @param interval
+* @return void
+*/
+void metricsInit(const char *process, const char *statsFile, const char *socketPath, double interval)
+{
+    struct sockaddr_un addr;
+
+    metricState.process = process;
+    metricState.statsFile = statsFile;
+    metricState.socketPath = socketPath;
+    metricState.intervalNs = (interval > 0 ? interval : 1) * 1e9;
+    metricState.startNs = metricsNow();
+    metricState.previous.takenNs = metricState.startNs;
+
+    if (statsFile == NULL && socketPath == NULL)
+        return;
+
+    if (socketPath != NULL)
+    {
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socketPath);
+        unlink(socketPath);
+
+        if ((metricState.listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1 ||
+            bind(metricState.listenFd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+            listen(metricState.listenFd, 8) == -1)
+        {
+            printf("Unable to open stats socket %s: %s.\n", socketPath, strerror(errno));
+            exit(1);
+        }
+    }
+
+    metricState.enabled = 1;
+    atomic_store(&metricState.running, 1);
+
+    if (pthread_create(&metricState.exporter, NULL, metricsExporter, NULL) != 0)
+    {
+        printf("Unable to start metrics thread.\n");
+        exit(1);
+    }
+}
+
+/**
+* Stops the exporter thread after writing a final snapshot.
+*
+* @return void
+*/
+void metricsShutdown()
+{
+    if (!metricState.enabled || !atomic_exchange(&metricState.running, 0))
+        return;
+
+    pthread_join(metricState.exporter, NULL);
+
+    if (metricState.listenFd != -1)
+    {
+        close(metricState.listenFd);
+        unlink(metricState.socketPath);
+    }
+}
+
+/**
+* Returns the block of the calling thread, registering one on first use.
+*
+* @return struct metricBlock*
+*/
+struct metricBlock *metricsBlock()
+{
+    int index;
+    struct metricBlock *block;
+
+    if (metricLocal != NULL)
+        return metricLocal;
+
+    if ((block = calloc(1, sizeof(*block))) == NULL)
+    {
+        printf("Unable to allocate metrics block.\n");
+        exit(1);
+    }
+
+    pthread_mutex_lock(&metricState.lock);
+
+    if ((index = atomic_load(&metricState.blockCount)) == METRIC_MAX_THREADS)
+    {
+        pthread_mutex_unlock(&metricState.lock);
+        printf("Too many metric threads, at most %d are supported.\n", METRIC_MAX_THREADS);
+        exit(1);
+    }
+
+    metricState.blocks[index] = block;
+    atomic_store_explicit(&metricState.blockCount, index + 1, memory_order_release);
+
+    pthread_mutex_unlock(&metricState.lock);
+
+    return metricLocal = block;
+}
+
+/**
+* Merges the blocks of every thread into a snapshot.
+*
+* @param snap
+* @return void
+*/
+void metricsSnapshot(struct metricSnapshot *snap)
+{
+    struct metricBlock *block;
+    unsigned long maximum;
+    int blocks = atomic_load_explicit(&metricState.blockCount, memory_order_acquire);
+
+    memset(snap, 0, sizeof(*snap));
+    snap->takenNs = metricsNow();
+
+    for (int b = 0; b < blocks; b++)
+    {
+        block = metricState.blocks[b];
+
+        for (int c = 0; c < METRIC_COUNTERS; c++)
+            snap->counters[c] += atomic_load_explicit(&block->counters[c], memory_order_relaxed);
+
+        for (int s = 0; s < METRIC_STAGES; s++)
+        {
+            maximum = atomic_load_explicit(&block->maxima[s], memory_order_relaxed);
+
+            if (maximum > snap->maxima[s])
+                snap->maxima[s] = maximum;
+
+            for (int i = 0; i < METRIC_BUCKETS; i++)
+                snap->buckets[s][i] += atomic_load_explicit(&block->buckets[s][i], memory_order_relaxed);
+        }
+    }
+}
+
+/**
+* Returns the value at the given quantile of a stage histogram.
+*
+* @param snap
+* @param stage
+* @param quantile
+* @return unsigned long
+*/
+unsigned long metricsPercentile(const struct metricSnapshot *snap, int stage, double quantile)
+{
+    unsigned long total = 0;
+
+    for (int i = 0; i < METRIC_BUCKETS; i++)
+        total += snap->buckets[stage][i];
+
+    return metricsBucketPercentile(snap->buckets[stage], total, snap->maxima[stage], quantile);
+}
+
+/**
+* Returns the value at the given quantile of a histogram of METRIC_BUCKETS
+* buckets holding total values, none above max. Histograms kept outside the
+* metrics, such as the scheduler and priority lane ones, share it.
+*
+* @param buckets
+* @param total
+* @param max
+* @param quantile
+* @return unsigned long
+*/
+unsigned long metricsBucketPercentile(const unsigned long *buckets, unsigned long total, unsigned long max,
+    double quantile)
+{
+    unsigned long seen = 0, rank = quantile * total;
+
+    if (total == 0)
+        return 0;
+
+    for (int i = 0; i < METRIC_BUCKETS; i++)
+    {
+        if ((seen += buckets[i]) > rank)
+            return metricBucketValue(i) < max ? metricBucketValue(i) : max;
+    }
+    return max;
+}
+
+/**
+* Takes a snapshot and formats it as JSON, with rates computed against the
+* previous periodic snapshot. Returns the number of bytes written.
+*
+* @param out
+* @param size
+* @return int
+*/
+int metricsFormat(char *out, size_t size)
+{
+    size_t used;
+    unsigned long count;
+    struct rusage usage;
+    struct metricSnapshot *now = &metricState.current, *then = &metricState.previous;
+    double seconds;
+
+    metricsSnapshot(now);
+    seconds = (now->takenNs - then->takenNs) / 1e9;
+
+    getrusage(RUSAGE_SELF, &usage);
+
+    used = snprintf(out, size, "{\"process\":\"%s\",\"uptime_s\":%.3f,\"cpu_s\":%.3f",
+        metricState.process, (now->takenNs - metricState.startNs) / 1e9,
+        usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6);
+
+    for (int c = 0; c < METRIC_COUNTERS && used < size; c++)
+        used += snprintf(out + used, size - used, ",\"%s\":%lu", metricCounterNames[c], now->counters[c]);
+
+    if (used < size)
+        used += snprintf(out + used, size - used, ",\"frames_per_s\":%.1f,\"bytes_per_s\":%.1f,\"stages\":{",
+            seconds > 0 ? (now->counters[METRIC_FRAMES] - then->counters[METRIC_FRAMES]) / seconds : 0,
+            seconds > 0 ? (now->counters[METRIC_BYTES] - then->counters[METRIC_BYTES]) / seconds : 0);
+
+    for (int s = 0, first = 1; s < METRIC_STAGES && used < size; s++)
+    {
+        count = 0;
+
+        for (int i = 0; i < METRIC_BUCKETS; i++)
+            count += now->buckets[s][i];
+
+        if (count == 0)
+            continue;
+
+        used += snprintf(out + used, size - used,
+            "%s\"%s\":{\"count\":%lu,\"p50_ns\":%lu,\"p99_ns\":%lu,\"p999_ns\":%lu,\"max_ns\":%lu}",
+            first ? "" : ",", metricStageNames[s], count, metricsPercentile(now, s, 0.5),
+            metricsPercentile(now, s, 0.99), metricsPercentile(now, s, 0.999), now->maxima[s]);
+        first = 0;
+    }
+
+    if (used < size)
+        used += snprintf(out + used, size - used, "}}\n");
+
+    return used < size ? used : size - 1;
+}
+
+/**
+* Writes a snapshot to the stats file, replacing it atomically so readers never
+* see a partial snapshot, and makes it the base of the next rates.
+*
+* @return void
+*/
+void metricsWriteFile()
+{
+    int length;
+    FILE *file;
+    char json[METRIC_JSON_BYTES], path[4096];
+
+    length = metricsFormat(json, sizeof(json));
+
+    if (metricState.statsFile != NULL)
+    {
+        snprintf(path, sizeof(path), "%s.tmp", metricState.statsFile);
+
+        if ((file = fopen(path, "w")) != NULL)
+        {
+            fwrite(json, 1, length, file);
+            fclose(file);
+            rename(path, metricState.statsFile);
+        }
+    }
+
+    memcpy(&metricState.previous, &metricState.current, sizeof(metricState.previous));
+}
+
+/**
+* Sends a snapshot to each pending client of the stats socket.
+*
+* @return void
+*/
+void metricsServe()
+{
+    int client, length;
+    char json[METRIC_JSON_BYTES];
+
+    while ((client = accept(metricState.listenFd, NULL, NULL)) != -1)
+    {
+        length = metricsFormat(json, sizeof(json));
+        send(client, json, length, MSG_NOSIGNAL);
+        close(client);
+    }
+}
+
+/**
+* Exporter thread taking a snapshot every interval and answering stats socket
+* clients in between.
+*
+* @param arg
+* @return void*
+*/
+void *metricsExporter(void *arg)
+{
+    int timeout;
+    unsigned long next = metricsNow() + metricState.intervalNs, now;
+    struct pollfd pfd = { metricState.listenFd, POLLIN, 0 };
+
+    (void)arg;
+
+    while (atomic_load(&metricState.running))
+    {
+        now = metricsNow();
+
+        if (now >= next)
+        {
+            metricsWriteFile();
+            next += metricState.intervalNs;
+            continue;
+        }
+
+        // Wakes at least every 100ms so shutdown is noticed promptly
+        timeout = (next - now) / 1000000 + 1;
+        timeout = timeout < 100 ? timeout : 100;
+
+        if (poll(&pfd, metricState.listenFd != -1, timeout) > 0)
+            metricsServe();
+    }
+
+    metricsWriteFile();
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,389 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <immintrin.h>
+#include "decode.h"
+
+/**
+* A staged decode pipeline for the MDP. The receiving thread copies runs of
+* reassembled major frames into batch slots, numbers each slot and hands it to
+* decode worker (seq % workers) over a lock-free single-producer/single-consumer
+* queue. Workers decode their slots independently and pass them on to the sink
+* over a queue of their own. The sink takes slots strictly by sequence number,
+* which restores the receive order, handles the decoded commands and returns
+* the slot to the receiver. The pool of slots bounds the work in flight and
+* applies backpressure to the receiver.
+*
+* @author Vincent Nigro
+* @version 0.0.2
+*/
+
+#define PIPELINE_BATCH DECODE_BATCH
+#define PIPELINE_SLOTS 256
+#define PIPELINE_MAX_WORKERS 32
+#define PIPELINE_SPINS 64
+#define PIPELINE_YIELDS 64
+#define PIPELINE_NAP_NSEC 50000
+
+enum pipelineKind
+{
+    SLOT_FRAMES,
+    SLOT_RETIRE,
+    SLOT_STOP
+};
+
+/**
+* A bounded lock-free queue with a single producer and a single consumer. Its
+* capacity covers every slot of the pool, so a push never finds it full.
+*/
+struct spscQueue
+{
+    _Alignas(64) atomic_size_t head;
+    _Alignas(64) atomic_size_t tail;
+    _Alignas(64) void *items[PIPELINE_SLOTS];
+};
+
+struct pipelineSlot
+{
+    unsigned long seq;
+    int kind;
+    void *owner;
+    size_t count;
+    char *frames;
+    struct decodedFrame *decoded;
+};
+
+typedef int (*pipelineApply)(void*, char*, const struct decodedFrame*);
+typedef void (*pipelineRelease)(void*);
+
+struct pipeline;
+
+struct pipelineWorker
+{
+    int index;
+    pthread_t thread;
+    struct pipeline *owner;
+};
+
+struct pipeline
+{
+    int workers;
+    unsigned long nextSeq;
+    pipelineApply apply;
+    pipelineRelease release;
+    pthread_t sink;
+    struct pipelineSlot *slots;
+    char *frames;
+    char *decoded;
+    struct spscQueue freeSlots;
+    struct spscQueue toWorker[PIPELINE_MAX_WORKERS];
+    struct spscQueue toSink[PIPELINE_MAX_WORKERS];
+    struct pipelineWorker pool[PIPELINE_MAX_WORKERS];
+};
+
+void spscPush(struct spscQueue*, void*);
+void *spscPop(struct spscQueue*);
+void *spscWait(struct spscQueue*);
+struct pipeline *pipelineCreate(int, pipelineApply, pipelineRelease);
+void pipelineSubmit(struct pipeline*, void*, const char*, size_t);
+void pipelineRetire(struct pipeline*, void*);
+void pipelineDestroy(struct pipeline*);
+void *pipelineWorkerMain(void*);
+void *pipelineSinkMain(void*);
+
+/**
+* Publishes an item to the consumer of the queue.
+*
+* @param q
+* @param item
+* @return void
+*/
+void spscPush(struct spscQueue *q, void *item)
+{
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+
+    q->items[head % PIPELINE_SLOTS] = item;
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+}
+
+/**
+* Takes the oldest item from the queue, or returns NULL when it is empty.
+*
+* @param q
+* @return void*
+*/
+void *spscPop(struct spscQueue *q)
+{
+    void *item;
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+
+    if (tail == atomic_load_explicit(&q->head, memory_order_acquire))
+        return NULL;
+
+    item = q->items[tail % PIPELINE_SLOTS];
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+
+    return item;
+}
+
+/**
+* Takes the oldest item from the queue, waiting for one to be published. The
+* wait spins briefly, then yields the processor, then naps between checks.
+*
+* @param q
+* @return void*
+*/
+void *spscWait(struct spscQueue *q)
+{
+    void *item;
+    struct timespec nap = { 0, PIPELINE_NAP_NSEC };
+
+    for (unsigned int attempt = 0; (item = spscPop(q)) == NULL; attempt++)
+    {
+        if (attempt < PIPELINE_SPINS)
+            _mm_pause();
+        else if (attempt < PIPELINE_SPINS + PIPELINE_YIELDS)
+            sched_yield();
+        else
+            nanosleep(&nap, NULL);
+    }
+    return item;
+}
+
+/**
+* Allocates the slot pool and starts the decode workers and the sink. The
+* apply callback handles one decoded frame of an owner in receive order and
+* returns zero once the owner has ended its session; release is called for an
+* owner after every slot submitted before its retirement has been handled.
+*
+* @param workers
+* @param apply
+* @param release
+* @return struct pipeline*
+*/
+struct pipeline *pipelineCreate(int workers, pipelineApply apply, pipelineRelease release)
+{
+    struct pipeline *p;
+
+    if (workers < 1 || workers > PIPELINE_MAX_WORKERS)
+    {
+        printf("Decode worker count must be between 1 and %d.\n", PIPELINE_MAX_WORKERS);
+        exit(1);
+    }
+
+    // Slot buffers are sized for the frame geometry in use
+    if ((p = calloc(1, sizeof(*p))) == NULL ||
+        (p->slots = calloc(PIPELINE_SLOTS, sizeof(*p->slots))) == NULL ||
+        (p->frames = calloc(PIPELINE_SLOTS * PIPELINE_BATCH, frameGeometry.frameBytes)) == NULL ||
+        (p->decoded = calloc(PIPELINE_SLOTS * PIPELINE_BATCH, decodedFrameBytes())) == NULL)
+    {
+        printf("Unable to allocate decode pipeline.\n");
+        exit(1);
+    }
+
+    p->workers = workers;
+    p->apply = apply;
+    p->release = release;
+
+    for (int i = 0; i < PIPELINE_SLOTS; i++)
+    {
+        p->slots[i].frames = p->frames + i * PIPELINE_BATCH * frameGeometry.frameBytes;
+        p->slots[i].decoded = (struct decodedFrame *)(p->decoded + i * PIPELINE_BATCH * decodedFrameBytes());
+        spscPush(&p->freeSlots, &p->slots[i]);
+    }
+
+    for (int i = 0; i < workers; i++)
+    {
+        p->pool[i].index = i;
+        p->pool[i].owner = p;
+
+        if (pthread_create(&p->pool[i].thread, NULL, pipelineWorkerMain, &p->pool[i]) != 0)
+        {
+            printf("Unable to start decode worker %d.\n", i);
+            exit(1);
+        }
+    }
+
+    if (pthread_create(&p->sink, NULL, pipelineSinkMain, p) != 0)
+    {
+        printf("Unable to start decode sink.\n");
+        exit(1);
+    }
+    return p;
+}
+
+/**
+* Numbers a slot and hands it to the worker responsible for its sequence number.
+*
+* @param p
+* @param slot
+* @return void
+*/
+static void pipelineDispatch(struct pipeline *p, struct pipelineSlot *slot)
+{
+    slot->seq = p->nextSeq++;
+    spscPush(&p->toWorker[slot->seq % p->workers], slot);
+}
+
+/**
+* Copies a run of received major frames of an owner into batch slots and feeds
+* them into the pipeline. Blocks while every slot is in flight.
+*
+* @param p
+* @param owner
+* @param frames
+* @param count
+* @return void
+*/
+void pipelineSubmit(struct pipeline *p, void *owner, const char *frames, size_t count)
+{
+    size_t batch;
+    struct pipelineSlot *slot;
+
+    for (size_t done = 0; done < count; done += batch)
+    {
+        batch = count - done < PIPELINE_BATCH ? count - done : PIPELINE_BATCH;
+        slot = spscWait(&p->freeSlots);
+
+        slot->kind = SLOT_FRAMES;
+        slot->owner = owner;
+        slot->count = batch;
+        memcpy(slot->frames, frames + done * frameGeometry.frameBytes, batch * frameGeometry.frameBytes);
+
+        pipelineDispatch(p, slot);
+    }
+}
+
+/**
+* Queues the release of an owner behind every slot already submitted for it.
+*
+* @param p
+* @param owner
+* @return void
+*/
+void pipelineRetire(struct pipeline *p, void *owner)
+{
+    struct pipelineSlot *slot = spscWait(&p->freeSlots);
+
+    slot->kind = SLOT_RETIRE;
+    slot->owner = owner;
+    slot->count = 0;
+
+    pipelineDispatch(p, slot);
+}
+
+/**
+* Drains the pipeline, stops its threads and frees it.
+*
+* @param p
+* @return void
+*/
+void pipelineDestroy(struct pipeline *p)
+{
+    struct pipelineSlot *slot;
+
+    // One stop slot per worker, numbered after all outstanding work
+    for (int i = 0; i < p->workers; i++)
+    {
+        slot = spscWait(&p->freeSlots);
+        slot->kind = SLOT_STOP;
+        slot->owner = NULL;
+        slot->count = 0;
+        pipelineDispatch(p, slot);
+    }
+
+    for (int i = 0; i < p->workers; i++)
+        pthread_join(p->pool[i].thread, NULL);
+
+    pthread_join(p->sink, NULL);
+
+    free(p->decoded);
+    free(p->frames);
+    free(p->slots);
+    free(p);
+}
+
+/**
+* Decode worker: decodes the frames of each slot it is handed and forwards
+* every slot to the sink in the order received.
+*
+* @param arg
+* @return void*
+*/
+void *pipelineWorkerMain(void *arg)
+{
+    unsigned long start;
+    struct pipelineSlot *slot;
+    struct pipelineWorker *worker = arg;
+    struct pipeline *p = worker->owner;
+
+    do
+    {
+        slot = spscWait(&p->toWorker[worker->index]);
+
+        if (slot->kind == SLOT_FRAMES)
+        {
+            start = metricStart();
+            decodeFrames(slot->frames, slot->count, slot->decoded);
+            metricStop(STAGE_STRIP, start, slot->count);
+        }
+
+        spscPush(&p->toSink[worker->index], slot);
+    }
+    while (slot->kind != SLOT_STOP);
+
+    return NULL;
+}
+
+/**
+* Ordered sink: takes slots by ascending sequence number, handles decoded
+* frames and owner releases, and recycles every slot to the receiver.
+*
+* @param arg
+* @return void*
+*/
+void *pipelineSinkMain(void *arg)
+{
+    int stopped = 0;
+    unsigned long start;
+    struct pipeline *p = arg;
+    struct pipelineSlot *slot;
+
+    for (unsigned long seq = 0; stopped < p->workers; seq++)
+    {
+        // Worker seq % workers handles its slots in order, so its next is seq
+        slot = spscWait(&p->toSink[seq % p->workers]);
+
+        if (slot->kind == SLOT_FRAMES)
+        {
+            start = metricStart();
+
+            for (size_t i = 0; i < slot->count; i++)
+            {
+                if (!p->apply(slot->owner, slot->frames + i * frameGeometry.frameBytes,
+                    decodedFrameAt(slot->decoded, i)))
+                    break;
+            }
+            metricStop(STAGE_DISPATCH, start, slot->count);
+        }
+        else if (slot->kind == SLOT_RETIRE)
+        {
+            p->release(slot->owner);
+        }
+        else
+        {
+            stopped++;
+        }
+
+        spscPush(&p->freeSlots, slot);
+    }
+    return NULL;
+}
+
+#endif
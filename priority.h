@@ -0,0 +1,359 @@
+#ifndef PRIORITY_H
+#define PRIORITY_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <immintrin.h>
+#include "commands.h"
+#include "scan.h"
+#include "decode.h"
+#include "dispatch.h"
+#include "futex.h"
+#include "metrics.h"
+
+/**
+* A priority lane for safety alarms in the MDP. The receiving thread scans
+* every run of received major frames for alarm commands with the minor frame
+* scanning kernel, before the frames are queued for decoding, and hands each
+* alarm to a dedicated handler thread over a single-producer/single-consumer
+* ring. The handler reports alarms straight to standard output, bypassing the
+* logger and the decode pipeline, and keeps the latency from the scan to the
+* report against its own SLO. Routine processing of the frames, alarms
+* included, carries on unchanged behind it.
+*
+* The handler runs under SCHED_FIFO when the process is allowed to, spins
+* briefly once the ring is empty and then sleeps on a futex the receiving
+* thread only wakes when the handler has announced itself. A full ring drops
+* the alarm from the lane and counts it; it is still handled in order by the
+* routine path.
+*
+* @author Vincent Nigro
+* @version 0.0.2
+*/
+
+#define PRIORITY_RING 4096
+#define PRIORITY_SPINS 256
+#define PRIORITY_WAIT_NSEC 100000000L
+#define PRIORITY_DEFAULT_SLO_US 100
+#define PRIORITY_LINE_BYTES 128
+#define PRIORITY_BATCH 64
+
+/**
+* An alarm picked out of a major frame, with the time of the scan.
+*/
+struct priorityAlarm
+{
+    unsigned int link;
+    unsigned long frame;
+    unsigned long code;
+    unsigned long scanned;
+};
+
+/**
+* The ring indices live on cache lines of their own, the head next to the
+* futex word the handler sleeps on. The picked and overflow counts belong to
+* the receiving thread, the rest to the handler.
+*/
+struct priorityLane
+{
+    _Alignas(64) atomic_ulong head;
+    atomic_uint waiting;
+    _Alignas(64) atomic_ulong tail;
+    atomic_int stopping;
+    int quiet;
+    int realtime;
+    unsigned long slo;
+    pthread_t thread;
+    unsigned long picked;
+    unsigned long overflows;
+    unsigned long handled;
+    unsigned long missed;
+    unsigned long maxLatency;
+    double sumLatency;
+    unsigned long buckets[METRIC_BUCKETS];
+    struct priorityAlarm alarms[PRIORITY_RING];
+};
+
+void priorityStart(struct priorityLane*, double, int);
+void priorityStop(struct priorityLane*);
+void priorityScan(struct priorityLane*, unsigned int, unsigned long, const char*, size_t);
+int priorityPush(struct priorityLane*, const struct priorityAlarm*);
+void priorityWake(struct priorityLane*);
+void priorityHandle(struct priorityLane*, const struct priorityAlarm*, char*, size_t*);
+void *priorityMain(void*);
+void priorityReport(const struct priorityLane*);
+
+/**
+* Starts the handler of a lane with a latency SLO in microseconds, reporting
+* alarms unless quiet. The handler is given the lowest SCHED_FIFO priority,
+* which still preempts every normal thread, when the process may use it.
+*
+* @param lane
+* @param sloUs
+* @param quiet
+* @return void
+*/
+void priorityStart(struct priorityLane *lane, double sloUs, int quiet)
+{
+    pthread_attr_t attr;
+    struct sched_param param = { sched_get_priority_min(SCHED_FIFO) };
+
+    memset(lane, 0, sizeof(*lane));
+
+    lane->slo = sloUs * 1e3;
+    lane->quiet = quiet;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+    pthread_attr_setschedparam(&attr, &param);
+
+    lane->realtime = pthread_create(&lane->thread, &attr, priorityMain, lane) == 0;
+    pthread_attr_destroy(&attr);
+
+    // Unprivileged processes fall back to normal scheduling
+    if (!lane->realtime && pthread_create(&lane->thread, NULL, priorityMain, lane) != 0)
+    {
+        printf("Unable to start priority alarm handler.\n");
+        exit(1);
+    }
+}
+
+/**
+* Stops the handler of a lane once every queued alarm has been handled.
+*
+* @param lane
+* @return void
+*/
+void priorityStop(struct priorityLane *lane)
+{
+    atomic_store(&lane->stopping, 1);
+    priorityWake(lane);
+
+    pthread_join(lane->thread, NULL);
+}
+
+/**
+* Picks the alarm commands out of a run of received major frames of a link,
+* the first of which is numbered first, and queues them on the lane. Every
+* word the scan marks as an alarm is confirmed as a dictionary command of
+* ALARM severity. An alarm repeated within a major frame is queued once, and
+* alarm words after the END or KILL minor frame of their major frame are not
+* commands and are skipped. The handler is woken once per scanned batch of
+* frames.
+*
+* @param lane
+* @param link
+* @param first
+* @param frames
+* @param count
+* @return void
+*/
+void priorityScan(struct priorityLane *lane, unsigned int link, unsigned long first, const char *frames,
+    size_t count)
+{
+    int queued;
+    size_t batch, word, start, words;
+    unsigned long bits;
+    struct priorityAlarm alarm = { link, 0, 0, 0 };
+    const unsigned long *minorFrames;
+    // Only the receiving thread scans for the lane
+    static struct scanMasks masks[SCAN_BLOCKS(DECODE_BATCH * FRAME_MAX_SIZE)];
+
+    for (size_t done = 0; done < count; done += batch)
+    {
+        batch = count - done < DECODE_BATCH ? count - done : DECODE_BATCH;
+        minorFrames = (const unsigned long *)(frames + done * frameGeometry.frameBytes);
+        words = batch * frameGeometry.frameSize;
+
+        scanWords(minorFrames, words, masks);
+        alarm.scanned = 0;
+        queued = 0;
+
+        for (size_t block = 0; block < SCAN_BLOCKS(words); block++)
+        {
+            for (bits = masks[block].alarm; bits != 0; bits &= bits - 1)
+            {
+                word = block * SCAN_BLOCK_WORDS + __builtin_ctzl(bits);
+                start = word - word % frameGeometry.frameSize;
+
+                if ((size_t)scanNextSet(masks, offsetof(struct scanMasks, stop), start, word) != word ||
+                    dispatchLookup(minorFrames[word])->severity != SEVERITY_ALARM)
+                    continue;
+
+                if (alarm.scanned == 0)
+                    alarm.scanned = metricsNow();
+                else if (alarm.frame == first + done + word / frameGeometry.frameSize &&
+                    alarm.code == minorFrames[word])
+                    continue;
+
+                alarm.frame = first + done + word / frameGeometry.frameSize;
+                alarm.code = minorFrames[word];
+                queued |= priorityPush(lane, &alarm);
+            }
+        }
+
+        if (queued)
+            priorityWake(lane);
+    }
+}
+
+/**
+* Queues an alarm on the lane, returning zero when the ring is full and the
+* alarm is counted as overflowed instead.
+*
+* @param lane
+* @param alarm
+* @return int
+*/
+int priorityPush(struct priorityLane *lane, const struct priorityAlarm *alarm)
+{
+    unsigned long head = atomic_load_explicit(&lane->head, memory_order_relaxed);
+
+    if (head - atomic_load_explicit(&lane->tail, memory_order_acquire) == PRIORITY_RING)
+    {
+        lane->overflows++;
+        metricAdd(METRIC_PRIORITY_OVERFLOWS, 1);
+        return 0;
+    }
+
+    lane->alarms[head % PRIORITY_RING] = *alarm;
+    lane->picked++;
+
+    // Sequentially consistent so a handler announcing itself is not missed
+    atomic_store(&lane->head, head + 1);
+    return 1;
+}
+
+/**
+* Wakes the handler of a lane, if it has announced that it sleeps.
+*
+* @param lane
+* @return void
+*/
+void priorityWake(struct priorityLane *lane)
+{
+    futexWake(&lane->waiting);
+}
+
+/**
+* Handles one alarm: records its latency and appends its report to the batch
+* written out by the handler.
+*
+* @param lane
+* @param alarm
+* @param batch
+* @param used
+* @return void
+*/
+void priorityHandle(struct priorityLane *lane, const struct priorityAlarm *alarm, char *batch, size_t *used)
+{
+    int length;
+    const struct dispatchEntry *entry = dispatchLookup(alarm->code);
+    unsigned long now = metricsNow(), latency = now > alarm->scanned ? now - alarm->scanned : 0;
+
+    lane->handled++;
+    lane->sumLatency += latency;
+    lane->buckets[metricBucket(latency)]++;
+
+    if (latency > lane->maxLatency)
+        lane->maxLatency = latency;
+
+    if (latency > lane->slo)
+    {
+        lane->missed++;
+        metricAdd(METRIC_PRIORITY_SLO_MISSES, 1);
+    }
+
+    metricAdd(METRIC_PRIORITY_ALARMS, 1);
+
+    if (metricState.enabled)
+        metricRecord(STAGE_ALARM, latency, 1);
+
+    if (lane->quiet)
+        return;
+
+    length = snprintf(batch + *used, PRIORITY_LINE_BYTES, "PRIORITY Spacecraft %u Major Frame %lu raised %s.\n",
+        alarm->link, alarm->frame, entry->command != NULL ? entry->command->label : "an alarm");
+
+    *used += length < PRIORITY_LINE_BYTES ? length : PRIORITY_LINE_BYTES - 1;
+}
+
+/**
+* Handler thread of a lane. Handles queued alarms in batches, each batch
+* reported with a single write, and sleeps when the ring stays empty.
+*
+* @param arg
+* @return void*
+*/
+void *priorityMain(void *arg)
+{
+    size_t used;
+    unsigned long head, tail;
+    struct priorityLane *lane = arg;
+    char batch[PRIORITY_BATCH * PRIORITY_LINE_BYTES];
+
+    for (int spins = 0; ; )
+    {
+        tail = atomic_load_explicit(&lane->tail, memory_order_relaxed);
+        head = atomic_load_explicit(&lane->head, memory_order_acquire);
+
+        if (head != tail)
+        {
+            used = 0;
+
+            for (int n = 0; tail != head && n < PRIORITY_BATCH; n++, tail++)
+                priorityHandle(lane, &lane->alarms[tail % PRIORITY_RING], batch, &used);
+
+            atomic_store_explicit(&lane->tail, tail, memory_order_release);
+
+            if (used > 0)
+                write(STDOUT_FILENO, batch, used);
+
+            spins = 0;
+            continue;
+        }
+
+        if (atomic_load(&lane->stopping))
+            break;
+
+        if (++spins < PRIORITY_SPINS)
+        {
+            _mm_pause();
+            continue;
+        }
+
+        futexWait(&lane->waiting, &lane->head, tail, &lane->stopping, PRIORITY_WAIT_NSEC);
+        spins = 0;
+    }
+    return NULL;
+}
+
+/**
+* Prints the latency statistics of the alarms handled by a lane.
+*
+* @param lane
+* @return void
+*/
+void priorityReport(const struct priorityLane *lane)
+{
+    printf("Priority lane handled %lu alarms under %s scheduling", lane->handled,
+        lane->realtime ? "SCHED_FIFO" : "normal");
+
+    if (lane->handled > 0)
+        printf(", latency mean %.3f us, p50 %.3f us, p99 %.3f us, max %.3f us", lane->sumLatency / lane->handled / 1e3,
+            metricsBucketPercentile(lane->buckets, lane->handled, lane->maxLatency, 0.5) / 1e3,
+            metricsBucketPercentile(lane->buckets, lane->handled, lane->maxLatency, 0.99) / 1e3,
+            lane->maxLatency / 1e3);
+
+    printf(", %lu over the %.0f us SLO, %lu overflowed.\n", lane->missed, lane->slo / 1e3, lane->overflows);
+}
+
+#endif
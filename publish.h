@@ -0,0 +1,560 @@
+#ifndef PUBLISH_H
+#define PUBLISH_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/un.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include "commands.h"
+#include "decode.h"
+#include "dispatch.h"
+#include "metrics.h"
+
+/**
+* Fan-out of decoded telemetry to local subscribers of the MDP over a UNIX
+* domain socket. The thread handling decoded frames appends an event for each
+* frame and each command it ran to a broadcast ring in memory, publishing the
+* events of a frame with a single release store, and does nothing at all while
+* nobody subscribes. A publisher thread keeps a cursor into the ring for every
+* subscriber and sends each one the events it has not seen yet in batches of
+* up to PUBLISH_BATCH events per send call.
+*
+* A subscriber connects to the socket and first writes its policy, a line
+* reading drop or block, within PUBLISH_POLICY_NSEC. A dropping subscriber
+* that falls more than half the ring behind skips ahead and the events it
+* missed are counted; ingestion never waits for it. An event it was sent in
+* part is finished from a copy of its own, so skipping never splits an event,
+* and one whose events were overwritten while being sent is closed. A
+* blocking subscriber is never skipped: the handling thread waits for it once
+* the ring is full, pushing back on ingestion. Every subscriber receives the
+* events published from the moment it subscribed as a stream of
+* PUBLISH_EVENT_BYTES records, see struct publishEvent; the sequence numbers
+* of the events reveal any gap.
+*
+* @author Vincent Nigro
+* @version 0.0.2
+*/
+
+#define PUBLISH_RING 65536
+#define PUBLISH_BATCH 1024
+#define PUBLISH_MAX_SUBSCRIBERS 32
+#define PUBLISH_POLICY_BYTES 16
+#define PUBLISH_POLL_MS 100
+#define PUBLISH_POLICY_NSEC 5000000000UL
+#define PUBLISH_DRAIN_NSEC 1000000000UL
+#define PUBLISH_NAP_NSEC 50000
+#define PUBLISH_NO_BLOCKERS ~0UL
+#define PUBLISH_EVENT_BYTES sizeof(struct publishEvent)
+
+enum publishType
+{
+    PUBLISH_FRAME,
+    PUBLISH_COMMAND,
+    PUBLISH_UNKNOWN
+};
+
+enum publishPolicy
+{
+    PUBLISH_PENDING,
+    PUBLISH_DROP,
+    PUBLISH_BLOCK
+};
+
+/**
+* An event as sent to subscribers, in host byte order. A frame event carries
+* the number of command and unknown events following it for the frame as its
+* code; a command event carries the first operand of the command, if it takes
+* any. Time is the realtime clock in nanoseconds when the frame
+* was handled.
+*/
+struct publishEvent
+{
+    uint16_t type;
+    uint16_t severity;
+    uint32_t link;
+    uint64_t seq;
+    uint64_t frame;
+    uint64_t code;
+    uint64_t operand;
+    uint64_t time;
+};
+
+/**
+* A subscriber, which has been sent offset bytes of the event at its cursor;
+* partial holds that event meanwhile. Accepted is when it connected.
+*/
+struct subscriber
+{
+    int fd;
+    int policy;
+    unsigned long id;
+    unsigned long cursor;
+    size_t offset;
+    struct publishEvent partial;
+    unsigned long accepted;
+    unsigned long delivered;
+    unsigned long dropped;
+};
+
+/**
+* The ring head belongs to the handling thread and the blocking tail, the
+* lowest cursor of any blocking subscriber, to the publisher; each lives on a
+* cache line of its own.
+*/
+struct publisher
+{
+    _Alignas(64) atomic_ulong head;
+    atomic_uint subscribed;
+    _Alignas(64) atomic_ulong blockTail;
+    atomic_uint waiting;
+    atomic_int stopping;
+    int listenFd;
+    int wakeFd;
+    const char *path;
+    pthread_t thread;
+    unsigned int count;
+    unsigned long subscriptions;
+    struct subscriber subscribers[PUBLISH_MAX_SUBSCRIBERS];
+    struct publishEvent *events;
+};
+
+struct publisher publishState;
+
+void publishInit(const char*);
+void publishShutdown();
+void publishFrame(unsigned int, unsigned long, const char*, const struct decodedFrame*);
+void publishAccept();
+void publishPolicy(struct subscriber*);
+void publishDeliver(struct subscriber*, unsigned long);
+void publishClose(struct subscriber*);
+void *publishMain(void*);
+
+/**
+* Opens the subscriber socket at the given path and starts the publisher.
+*
+* @param path
+* @return void
+*/
+void publishInit(const char *path)
+{
+    struct sockaddr_un addr;
+
+    memset(&publishState, 0, sizeof(publishState));
+    publishState.path = path;
+    atomic_store(&publishState.blockTail, PUBLISH_NO_BLOCKERS);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    unlink(path);
+
+    if ((publishState.events = calloc(PUBLISH_RING, PUBLISH_EVENT_BYTES)) == NULL ||
+        (publishState.wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1 ||
+        (publishState.listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1 ||
+        bind(publishState.listenFd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        listen(publishState.listenFd, PUBLISH_MAX_SUBSCRIBERS) == -1)
+    {
+        printf("Unable to open subscriber socket %s: %s.\n", path, strerror(errno));
+        exit(1);
+    }
+
+    if (pthread_create(&publishState.thread, NULL, publishMain, NULL) != 0)
+    {
+        printf("Unable to start publisher thread.\n");
+        exit(1);
+    }
+}
+
+/**
+* Stops the publisher once its subscribers have been sent every published
+* event, or after PUBLISH_DRAIN_NSEC, and removes the subscriber socket.
+*
+* @return void
+*/
+void publishShutdown()
+{
+    uint64_t one = 1;
+
+    atomic_store(&publishState.stopping, 1);
+    write(publishState.wakeFd, &one, sizeof(one));
+    pthread_join(publishState.thread, NULL);
+
+    close(publishState.listenFd);
+    close(publishState.wakeFd);
+    unlink(publishState.path);
+    free(publishState.events);
+
+    printf("Published %lu events to %lu subscribers.\n", atomic_load(&publishState.head),
+        publishState.subscriptions);
+}
+
+/**
+* Publishes the events of a handled major frame of a link: the frame and each
+* command run, up to and including the command ending the session. Waits for
+* blocking subscribers while the ring is full.
+*
+* @param link
+* @param number
+* @param frame
+* @param decoded
+* @return void
+*/
+void publishFrame(unsigned int link, unsigned long number, const char *frame, const struct decodedFrame *decoded)
+{
+    int n;
+    unsigned long head, first, tail, operand;
+    struct timespec now, nap = { 0, PUBLISH_NAP_NSEC };
+    struct publishEvent *event, *frameEvent;
+    const struct dispatchEntry *entry;
+    const unsigned long *minorFrames = (const unsigned long *)frame + decoded->headerSize;
+    uint64_t one = 1;
+
+    if (atomic_load_explicit(&publishState.subscribed, memory_order_relaxed) == 0)
+        return;
+
+    head = first = atomic_load_explicit(&publishState.head, memory_order_relaxed);
+
+    // Room for the whole frame is waited for up front
+    while ((tail = atomic_load_explicit(&publishState.blockTail, memory_order_acquire)) != PUBLISH_NO_BLOCKERS &&
+        head + decoded->commands + 1 - tail > PUBLISH_RING)
+    {
+        metricAdd(METRIC_PUBLISH_WAITS, 1);
+        nanosleep(&nap, NULL);
+    }
+
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    frameEvent = &publishState.events[head % PUBLISH_RING];
+    frameEvent->type = PUBLISH_FRAME;
+    frameEvent->severity = SEVERITY_NOMINAL;
+    frameEvent->link = link;
+    frameEvent->seq = head++;
+    frameEvent->frame = number;
+    frameEvent->operand = 0;
+    frameEvent->time = now.tv_sec * 1000000000UL + now.tv_nsec;
+
+    for (int i = 0; i < decoded->commands; i += n)
+    {
+        entry = decoded->entries[i];
+        n = 1;
+
+        // Operand minor frames travel with their command and END with its frame
+        if (entry->command != NULL && entry->code == END)
+            continue;
+
+        operand = 0;
+
+        if (entry->command != NULL && entry->command->operands > 0)
+        {
+            n += entry->command->operands;
+
+            if (i + 1 < decoded->commands)
+                memcpy(&operand, minorFrames + i + 1, sizeof(operand));
+        }
+
+        event = &publishState.events[head % PUBLISH_RING];
+        event->type = entry->command != NULL ? PUBLISH_COMMAND : PUBLISH_UNKNOWN;
+        event->severity = entry->severity;
+        event->link = link;
+        event->seq = head++;
+        event->frame = number;
+        memcpy(&event->code, minorFrames + i, sizeof(event->code));
+        event->operand = operand;
+        event->time = now.tv_sec * 1000000000UL + now.tv_nsec;
+
+        if (entry->command != NULL && entry->command->terminal)
+            break;
+    }
+
+    // Counts the events written rather than the minor frames decoded
+    frameEvent->code = head - first - 1;
+
+    // Sequentially consistent so a publisher announcing its sleep is not missed
+    atomic_store(&publishState.head, head);
+    metricAdd(METRIC_PUBLISHED_EVENTS, head - first);
+
+    if (atomic_load(&publishState.waiting) && atomic_exchange(&publishState.waiting, 0))
+        write(publishState.wakeFd, &one, sizeof(one));
+}
+
+/**
+* Accepts every pending subscriber, which is sent events once it has given its
+* policy.
+*
+* @return void
+*/
+void publishAccept()
+{
+    int fd;
+
+    while ((fd = accept4(publishState.listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1)
+    {
+        if (publishState.count == PUBLISH_MAX_SUBSCRIBERS)
+        {
+            close(fd);
+            continue;
+        }
+
+        memset(&publishState.subscribers[publishState.count], 0, sizeof(struct subscriber));
+        publishState.subscribers[publishState.count].fd = fd;
+        publishState.subscribers[publishState.count].accepted = metricsNow();
+        publishState.subscribers[publishState.count++].policy = PUBLISH_PENDING;
+    }
+}
+
+/**
+* Reads the policy line of a pending subscriber, starting its cursor at the
+* head of the ring. Subscribers giving an unknown policy are closed.
+*
+* @param sub
+* @return void
+*/
+void publishPolicy(struct subscriber *sub)
+{
+    ssize_t length;
+    char line[PUBLISH_POLICY_BYTES];
+
+    if ((length = recv(sub->fd, line, sizeof(line) - 1, 0)) == -1 && (errno == EAGAIN || errno == EINTR))
+        return;
+
+    line[length > 0 ? length : 0] = '\0';
+    line[strcspn(line, "\r\n")] = '\0';
+
+    if (strcmp(line, "drop") == 0)
+        sub->policy = PUBLISH_DROP;
+    else if (strcmp(line, "block") == 0)
+        sub->policy = PUBLISH_BLOCK;
+    else
+    {
+        close(sub->fd);
+        sub->fd = -1;
+        return;
+    }
+
+    sub->cursor = atomic_load_explicit(&publishState.head, memory_order_acquire);
+    sub->id = ++publishState.subscriptions;
+    atomic_fetch_add(&publishState.subscribed, 1);
+
+    printf("Subscriber %lu has subscribed to MDP, %s policy.\n", sub->id, line);
+}
+
+/**
+* Sends a subscriber the events between its cursor and the head, one send call
+* per batch, until its socket is full. The rest of an event sent in part is
+* sent from the copy of the subscriber first. A dropping subscriber more than
+* half the ring behind skips ahead to half the ring behind before each batch,
+* and is closed when the handling thread may have overwritten a batch while
+* it was being sent.
+*
+* @param sub
+* @param head
+* @return void
+*/
+void publishDeliver(struct subscriber *sub, unsigned long head)
+{
+    ssize_t sent;
+    size_t events;
+    unsigned long first;
+
+    if (sub->offset != 0)
+    {
+        if ((sent = send(sub->fd, (char *)&sub->partial + sub->offset, PUBLISH_EVENT_BYTES - sub->offset,
+            MSG_NOSIGNAL)) == -1)
+        {
+            if (errno != EAGAIN && errno != EINTR)
+                publishClose(sub);
+            return;
+        }
+
+        if ((sub->offset += sent) < PUBLISH_EVENT_BYTES)
+            return;
+
+        sub->offset = 0;
+        sub->cursor++;
+        sub->delivered++;
+    }
+
+    while (sub->cursor != head)
+    {
+        if (sub->policy == PUBLISH_DROP && head - sub->cursor > PUBLISH_RING / 2)
+        {
+            sub->dropped += head - PUBLISH_RING / 2 - sub->cursor;
+            metricAdd(METRIC_DROPPED_EVENTS, head - PUBLISH_RING / 2 - sub->cursor);
+            sub->cursor = head - PUBLISH_RING / 2;
+        }
+
+        // Batches end at the end of the ring
+        first = sub->cursor;
+        events = head - first < PUBLISH_BATCH ? head - first : PUBLISH_BATCH;
+        events = events < PUBLISH_RING - first % PUBLISH_RING ? events : PUBLISH_RING - first % PUBLISH_RING;
+
+        if ((sent = send(sub->fd, &publishState.events[first % PUBLISH_RING], events * PUBLISH_EVENT_BYTES,
+            MSG_NOSIGNAL)) == -1)
+        {
+            if (errno != EAGAIN && errno != EINTR)
+                publishClose(sub);
+            return;
+        }
+
+        sub->cursor += sent / PUBLISH_EVENT_BYTES;
+        sub->delivered += sent / PUBLISH_EVENT_BYTES;
+
+        if ((sub->offset = sent % PUBLISH_EVENT_BYTES) != 0)
+            sub->partial = publishState.events[sub->cursor % PUBLISH_RING];
+
+        // The handling thread writes the events of a frame ahead of publishing them
+        if (sub->policy == PUBLISH_DROP &&
+            atomic_load_explicit(&publishState.head, memory_order_acquire) + FRAME_MAX_SIZE + 1 - first > PUBLISH_RING)
+        {
+            printf("Subscriber %lu fell a whole ring behind while being sent events.\n", sub->id);
+            publishClose(sub);
+            return;
+        }
+    }
+}
+
+/**
+* Closes a subscriber, reporting what it was sent.
+*
+* @param sub
+* @return void
+*/
+void publishClose(struct subscriber *sub)
+{
+    if (sub->policy != PUBLISH_PENDING)
+    {
+        atomic_fetch_sub(&publishState.subscribed, 1);
+        printf("Subscriber %lu has unsubscribed from MDP after %lu events, %lu dropped.\n", sub->id,
+            sub->delivered, sub->dropped);
+    }
+
+    close(sub->fd);
+    sub->fd = -1;
+}
+
+/**
+* Publisher thread. Delivers new events to every subscriber, recomputes the
+* tail blocking the handling thread and sleeps in poll until a subscriber
+* socket drains, a subscriber arrives or leaves, or new events are published
+* while it had announced itself waiting.
+*
+* @param arg
+* @return void*
+*/
+void *publishMain(void *arg)
+{
+    int behind;
+    unsigned int n;
+    unsigned long head, tail, deadline = 0;
+    uint64_t wakes;
+    struct subscriber *sub;
+    struct pollfd pfds[PUBLISH_MAX_SUBSCRIBERS + 2];
+
+    (void)arg;
+
+    while (1)
+    {
+        head = atomic_load_explicit(&publishState.head, memory_order_acquire);
+        tail = PUBLISH_NO_BLOCKERS;
+        behind = 0;
+
+        for (unsigned int i = 0; i < publishState.count; i++)
+        {
+            sub = &publishState.subscribers[i];
+
+            if (sub->fd != -1 && sub->policy != PUBLISH_PENDING)
+                publishDeliver(sub, head);
+
+            // A connection that never gives its policy does not keep its slot
+            if (sub->fd != -1 && sub->policy == PUBLISH_PENDING && metricsNow() - sub->accepted > PUBLISH_POLICY_NSEC)
+            {
+                printf("Closing a subscriber that gave no policy.\n");
+                publishClose(sub);
+            }
+
+            // Subscribers are kept packed
+            if (sub->fd == -1)
+            {
+                *sub = publishState.subscribers[--publishState.count];
+                i--;
+                continue;
+            }
+
+            if (sub->policy == PUBLISH_BLOCK && sub->cursor < tail)
+                tail = sub->cursor;
+
+            behind |= sub->policy != PUBLISH_PENDING && sub->cursor != head;
+        }
+
+        atomic_store_explicit(&publishState.blockTail, tail, memory_order_release);
+
+        if (atomic_load(&publishState.stopping))
+        {
+            if (deadline == 0)
+                deadline = metricsNow() + PUBLISH_DRAIN_NSEC;
+
+            if (!behind || metricsNow() > deadline)
+                break;
+        }
+
+        pfds[0] = (struct pollfd){ publishState.listenFd, POLLIN, 0 };
+        pfds[1] = (struct pollfd){ publishState.wakeFd, POLLIN, 0 };
+
+        for (n = 0; n < publishState.count; n++)
+        {
+            sub = &publishState.subscribers[n];
+            pfds[n + 2] = (struct pollfd){ sub->fd,
+                sub->policy == PUBLISH_PENDING ? POLLIN : sub->cursor != head ? POLLOUT : 0, 0 };
+        }
+
+        // Publishers only write the eventfd once waiting is set, so head is checked again after setting it
+        if (!behind)
+        {
+            atomic_store(&publishState.waiting, 1);
+
+            if (atomic_load(&publishState.head) != head)
+            {
+                atomic_store(&publishState.waiting, 0);
+                continue;
+            }
+        }
+
+        if (poll(pfds, n + 2, PUBLISH_POLL_MS) <= 0)
+            continue;
+
+        atomic_store(&publishState.waiting, 0);
+
+        if (pfds[1].revents & POLLIN)
+            read(publishState.wakeFd, &wakes, sizeof(wakes));
+
+        for (unsigned int i = 0; i < n; i++)
+        {
+            sub = &publishState.subscribers[i];
+
+            if (pfds[i + 2].revents & (POLLHUP | POLLERR))
+                publishClose(sub);
+            else if (sub->policy == PUBLISH_PENDING && (pfds[i + 2].revents & POLLIN))
+                publishPolicy(sub);
+        }
+
+        if (pfds[0].revents & POLLIN)
+            publishAccept();
+    }
+
+    for (unsigned int i = 0; i < publishState.count; i++)
+        publishClose(&publishState.subscribers[i]);
+
+    publishState.count = 0;
+    return NULL;
+}
+
+#endif
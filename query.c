@@ -0,0 +1,346 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libgen.h>
+#include "commands.h"
+#include "dictionary.h"
+#include "archive.h"
+#include "metrics.h"
+#include <time.h>
+#include <sys/errno.h>
+
+/**
+* Command line configuration of the query utility.
+*/
+struct options
+{
+    char *archive;
+    char *from;
+    char *to;
+    long vehicle;
+    char *command;
+    unsigned long fromSeq;
+    unsigned long toSeq;
+    char *dictionary;
+    int headerWidth;
+    int trailer;
+    int count;
+};
+
+/**
+* Totals of a query over every segment of an archive.
+*/
+struct queryTotals
+{
+    unsigned long matched;
+    unsigned long blocks;
+    unsigned long read;
+    size_t mapped;
+    size_t built;
+};
+
+unsigned long queryTime(const char*, unsigned long, unsigned long);
+void querySegment(struct archiveSegment*, const char*, const struct indexQuery*, unsigned long, const struct options*,
+    struct queryTotals*);
+int queryRecord(const struct archiveRecord*, const struct indexQuery*, unsigned long, long);
+void argumentHandler(int*, char**, struct options*);
+void argumentError();
+
+/**
+* Queries recorded telemetry through the sparse indexes of its archive
+* segments. Frames are selected by receive time, link sequence number, vehicle
+* and command; the index entries of every segment are read first and only the
+* blocks they match are mapped in, decoded if compressed, and checked frame by
+* frame.
+*
+* @author Vincent Nigro
+* @version 0.0.2
+*/
+
+/**
+* Main function of the query utility, printing every matching frame followed
+* by what the query touched.
+*/
+int main(int argc, char **argv)
+{
+    char *dir, path[ARCHIVE_PATH_BYTES];
+    struct stat st;
+    struct archiveSet set;
+    struct indexQuery query = { 0, ~0UL, 0, ~0UL, ~0UL, { 0 } };
+    struct queryTotals totals = { 0 };
+    const struct command *command = NULL;
+    unsigned long start, code = 0, firstNs = ~0UL;
+    struct options opts = { NULL, NULL, NULL, -1, NULL, 0, ~0UL, NULL, HEADER_WIDTH, 0, 0 };
+
+    // Processes and populates command line argument fields
+    argumentHandler(&argc, argv, &opts);
+
+    // Loads the telemetry dictionary the command names are taken from
+    if (opts.dictionary != NULL && dictionaryLoad(opts.dictionary) == -1)
+        exit(1);
+
+    if (opts.command != NULL && (command = dictionaryFind(opts.command)) == NULL)
+    {
+        printf("Command %s is not in the dictionary.\n", opts.command);
+        exit(1);
+    }
+
+    // Compressed blocks are decoded with the column kernels of this processor
+    columnarInit();
+
+    // Segments without an index file are indexed from the dictionary commands
+    indexInit();
+
+    if (archiveOpenSet(&set, opts.archive) == -1)
+    {
+        printf("Unable to open archive %s: %s.\n", opts.archive, strerror(errno));
+        exit(1);
+    }
+
+    // Index files live next to their segments
+    snprintf(path, sizeof(path), "%s", opts.archive);
+    dir = stat(opts.archive, &st) == 0 && S_ISDIR(st.st_mode) ? opts.archive : dirname(path);
+
+    for (size_t s = 0; s < set.count; s++)
+    {
+        if (set.segments[s].header->count > 0 && set.segments[s].header->firstNs < firstNs)
+            firstNs = set.segments[s].header->firstNs;
+    }
+
+    query.fromNs = queryTime(opts.from, firstNs, 0);
+    query.toNs = queryTime(opts.to, firstNs, ~0UL);
+    query.fromSeq = opts.fromSeq;
+    query.toSeq = opts.toSeq;
+
+    if (opts.vehicle >= 0)
+        query.links = 1UL << (opts.vehicle % 64);
+
+    if (command != NULL)
+    {
+        code = command->code;
+        indexSetCommand(query.commands, code);
+    }
+
+    start = metricsNow();
+
+    for (size_t s = 0; s < set.count; s++)
+        querySegment(&set.segments[s], dir, &query, code, &opts, &totals);
+
+    printf("Matched %lu frames in %lu of %lu blocks of %zu segments (%zu indexes mapped, %zu built) in %.3f ms.\n",
+        totals.matched, totals.read, totals.blocks, set.count, totals.mapped, totals.built,
+        (metricsNow() - start) / 1e6);
+
+    archiveCloseSet(&set);
+
+    return 0;
+}
+
+/**
+* Returns the time in nanoseconds of a time argument: UNIX seconds, or seconds
+* after the first recorded frame when prefixed with +. An absent argument
+* yields the fallback.
+*
+* @param arg
+* @param firstNs
+* @param fallback
+* @return unsigned long
+*/
+unsigned long queryTime(const char *arg, unsigned long firstNs, unsigned long fallback)
+{
+    if (arg == NULL)
+        return fallback;
+
+    if (arg[0] == '+')
+        return firstNs == ~0UL ? fallback : firstNs + (unsigned long)(atof(arg + 1) * 1e9);
+
+    return atof(arg) * 1e9;
+}
+
+/**
+* Runs a query over one segment: blocks whose index entry matches are read
+* and their frames checked, everything else is skipped without being touched.
+*
+* @param seg
+* @param dir
+* @param query
+* @param code
+* @param opts
+* @param totals
+* @return void
+*/
+void querySegment(struct archiveSegment *seg, const char *dir, const struct indexQuery *query, unsigned long code,
+    const struct options *opts, struct queryTotals *totals)
+{
+    struct segmentIndex idx;
+    struct archiveRecord *record;
+    unsigned long first = 0, frames;
+
+    if (seg->header->count == 0 || seg->header->lastNs < query->fromNs || seg->header->firstNs > query->toNs)
+        return;
+
+    // Segments are indexed with the geometry they were recorded with
+    if (!geometrySet(seg->header->frameBytes / sizeof(unsigned long), opts->headerWidth) ||
+        !geometryTrailer(opts->trailer))
+    {
+        printf("Skipping archive segment %u: unusable frame geometry.\n", seg->header->segment);
+        return;
+    }
+
+    if (archiveOpenIndex(&idx, seg, dir) == -1)
+    {
+        printf("Skipping archive segment %u: %s.\n", seg->header->segment, strerror(errno));
+        return;
+    }
+
+    if (idx.map != NULL)
+    {
+        totals->mapped++;
+        geometrySet(frameGeometry.frameSize, idx.header->headerWidth);
+        frameGeometry.trailerWords = idx.header->trailerWords;
+    }
+    else
+        totals->built++;
+
+    totals->blocks += idx.header->blocks;
+
+    // Blocks hold up to ARCHIVE_BLOCK_FRAMES records, so the first of each is counted
+    for (size_t b = 0; b < idx.header->blocks; b++, first += frames)
+    {
+        frames = idx.entries[b].frames;
+
+        if (!indexMatches(&idx.entries[b], query))
+            continue;
+
+        totals->read++;
+
+        for (unsigned long i = first; i < first + frames; i++)
+        {
+            if ((record = archiveRecordAt(seg, i)) == NULL)
+            {
+                printf("Skipping the rest of archive segment %u: %s.\n", seg->header->segment, strerror(errno));
+                indexClose(&idx);
+                return;
+            }
+
+            if (!queryRecord(record, query, code, opts->vehicle))
+                continue;
+
+            totals->matched++;
+
+            if (!opts->count)
+                printf("Spacecraft %u Major Frame %lu received at %lu.%09lu.\n", record->link, record->seq,
+                    record->timestampNs / 1000000000UL, record->timestampNs % 1000000000UL);
+        }
+    }
+    indexClose(&idx);
+}
+
+/**
+* Returns whether a record is asked for by a query: received and numbered
+* within its ranges, on the vehicle unless that is negative, and issuing the
+* command of the code unless that is zero.
+*
+* @param record
+* @param query
+* @param code
+* @param vehicle
+* @return int
+*/
+int queryRecord(const struct archiveRecord *record, const struct indexQuery *query, unsigned long code,
+    long vehicle)
+{
+    unsigned long word;
+
+    if (record->timestampNs < query->fromNs || record->timestampNs > query->toNs || record->seq < query->fromSeq ||
+        record->seq > query->toSeq || (vehicle >= 0 && record->link != (unsigned long)vehicle) ||
+        record->length != frameGeometry.frameBytes)
+        return 0;
+
+    if (code == 0)
+        return 1;
+
+    // Minor frames after END or KILL are not commands
+    for (int i = frameGeometry.headerWidth; i < frameGeometry.frameSize - frameGeometry.trailerWords; i++)
+    {
+        memcpy(&word, record->frame + i * sizeof(word), sizeof(word));
+
+        if (word == code)
+            return 1;
+
+        if (word == END || word == KILL)
+            return 0;
+    }
+    return 0;
+}
+
+/**
+* Takes the command line arguments and processes the input line, setting variables
+* from the caller when validation has been established.
+*
+* @param argc
+* @param argv
+* @param opts
+* @return void
+*/
+void argumentHandler(int *argc, char **argv, struct options *opts)
+{
+    char *end;
+
+    // Must pass the archive directory or segment to query
+    if (*argc < 2)
+        argumentError();
+
+    for (int i = 2; i < *argc; i++)
+    {
+        if (strcmp(argv[i], "--from") == 0 && i + 1 < *argc)
+            opts->from = argv[++i];
+        else if (strcmp(argv[i], "--to") == 0 && i + 1 < *argc)
+            opts->to = argv[++i];
+        else if (strcmp(argv[i], "--vehicle") == 0 && i + 1 < *argc)
+        {
+            if ((opts->vehicle = atol(argv[++i])) < 0)
+                argumentError();
+        }
+        else if (strcmp(argv[i], "--command") == 0 && i + 1 < *argc)
+            opts->command = argv[++i];
+        else if (strcmp(argv[i], "--seq") == 0 && i + 1 < *argc)
+        {
+            // FIRST:LAST, either side left open when empty
+            opts->fromSeq = strtoul(argv[++i], &end, 10);
+
+            if (*end != ':')
+                argumentError();
+
+            opts->toSeq = end[1] != '\0' ? strtoul(end + 1, NULL, 10) : ~0UL;
+        }
+        else if (strcmp(argv[i], "--dictionary") == 0 && i + 1 < *argc)
+            opts->dictionary = argv[++i];
+        else if (strcmp(argv[i], "--header-width") == 0 && i + 1 < *argc)
+            opts->headerWidth = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--trailer") == 0)
+            opts->trailer = 1;
+        else if (strcmp(argv[i], "--count") == 0)
+            opts->count = 1;
+        else
+            argumentError();
+    }
+
+    opts->archive = argv[1];
+}
+
+/**
+* Prints the accepted command lines and exits.
+*
+* @return void
+*/
+void argumentError()
+{
+    printf("Need the following arguments 1: ARCHIVE.\n");
+    printf("./query archive\n");
+    printf("./query archive --from SECONDS|+SECONDS --to SECONDS|+SECONDS\n");
+    printf("./query archive --vehicle N --command NAME [--dictionary FILE]\n");
+    printf("./query archive --seq FIRST:LAST\n");
+    printf("./query archive --header-width 2 --trailer --count\n");
+    exit(1);
+}
@@ -0,0 +1,246 @@
+#ifndef REASSEMBLER_H
+#define REASSEMBLER_H
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "commands.h"
+#include "metrics.h"
+
+/**
+* A streaming major frame reassembler built on a mirrored ring buffer. The ring
+* storage is mapped twice back to back in virtual memory so any span of up to
+* the ring capacity is contiguous, allowing complete major frames to be handed
+* out as pointers into the ring without copying them. Frame boundaries are
+* located by searching the stream for the H1/H2 sync marker and checking that
+* the whole alternating header follows it, since the marker also recurs within
+* headers wider than two words; short reads, coalesced reads and corrupted data
+* all recover alignment on the next frame with an intact header.
+*
+* @author Vincent Nigro
+* @version 0.0.2
+*/
+
+#define MAJOR_FRAME_BYTES (frameGeometry.frameBytes)
+#define SYNC_MARKER_BYTES (2 * sizeof(unsigned long))
+#define SYNC_HEADER_BYTES (frameGeometry.headerWidth * sizeof(unsigned long))
+#define REASSEMBLER_CAPACITY (64 * 1024)
+
+struct reassembler
+{
+    char *base;
+    size_t capacity;
+    size_t head;
+    size_t tail;
+    int synced;
+    unsigned long syncLosses;
+    unsigned long discarded;
+};
+
+int reassemblerInit(struct reassembler*, size_t);
+void reassemblerFree(struct reassembler*);
+ssize_t reassemblerFill(struct reassembler*, int);
+char *reassemblerNext(struct reassembler*);
+char *reassemblerNextBatch(struct reassembler*, size_t*);
+int reassemblerIsSync(const char*);
+
+/**
+* Maps the mirrored ring storage for a reassembler. The capacity must be a
+* multiple of the page size. Returns zero on success and -1 on failure with
+* errno describing the failed system call.
+*
+* @param ra
+* @param capacity
+* @return int
+*/
+int reassemblerInit(struct reassembler *ra, size_t capacity)
+{
+    int fd;
+    char *base;
+
+    memset(ra, 0, sizeof(*ra));
+
+    if ((fd = memfd_create("reassembler", MFD_CLOEXEC)) == -1)
+        return -1;
+
+    if (ftruncate(fd, capacity) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+
+    // Reserve twice the capacity, then map the same pages into both halves
+    base = mmap(NULL, 2 * capacity, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (base == MAP_FAILED)
+    {
+        close(fd);
+        return -1;
+    }
+
+    if (mmap(base, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+        mmap(base + capacity, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+    {
+        munmap(base, 2 * capacity);
+        close(fd);
+        return -1;
+    }
+
+    // The mappings keep the memory alive after the descriptor is closed
+    close(fd);
+
+    ra->base = base;
+    ra->capacity = capacity;
+    ra->synced = 1;
+
+    return 0;
+}
+
+/**
+* Unmaps the ring storage of a reassembler.
+*
+* @param ra
+* @return void
+*/
+void reassemblerFree(struct reassembler *ra)
+{
+    if (ra->base != NULL)
+        munmap(ra->base, 2 * ra->capacity);
+
+    ra->base = NULL;
+}
+
+/**
+* Reads as much data as the free space of the ring allows from the descriptor
+* with a single read call. Frames previously returned by reassemblerNext may be
+* overwritten, so they must be handled before the ring is filled again. Returns
+* the result of the read, or -1 with errno set to ENOBUFS when the ring is full.
+*
+* @param ra
+* @param fd
+* @return ssize_t
+*/
+ssize_t reassemblerFill(struct reassembler *ra, int fd)
+{
+    ssize_t received;
+    size_t space = ra->capacity - (ra->head - ra->tail);
+
+    if (space == 0)
+    {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    received = read(fd, ra->base + (ra->head % ra->capacity), space);
+
+    if (received > 0)
+        ra->head += received;
+
+    return received;
+}
+
+/**
+* Checks whether the data begins with the complete header of a major frame,
+* headerWidth words alternating between H1 and H2.
+*
+* @param data
+* @return int
+*/
+int reassemblerIsSync(const char *data)
+{
+    unsigned long word;
+
+    for (int i = 0; i < frameGeometry.headerWidth; i++)
+    {
+        memcpy(&word, data + i * sizeof(word), sizeof(word));
+
+        if (word != (i % 2 == 0 ? H1 : H2))
+            return 0;
+    }
+    return 1;
+}
+
+/**
+* Returns a pointer to the next complete major frame within the ring, or NULL
+* when no complete frame is buffered. Data preceding a complete header is
+* discarded and counted; a single sync loss is recorded each time alignment is
+* lost.
+*
+* @param ra
+* @return char*
+*/
+char *reassemblerNext(struct reassembler *ra)
+{
+    char *data, *marker;
+    size_t available, skip;
+    unsigned long pattern[2] = { H1, H2 };
+
+    while ((available = ra->head - ra->tail) >= MAJOR_FRAME_BYTES)
+    {
+        data = ra->base + (ra->tail % ra->capacity);
+
+        if (reassemblerIsSync(data))
+        {
+            ra->synced = 1;
+            ra->tail += MAJOR_FRAME_BYTES;
+            return data;
+        }
+
+        if (ra->synced)
+        {
+            ra->synced = 0;
+            ra->syncLosses++;
+            metricAdd(METRIC_SYNC_LOSSES, 1);
+        }
+
+        // Hunt for the next complete header, keeping a possible partial one
+        for (marker = data; (marker = memmem(marker + 1, available - (marker + 1 - data), pattern,
+            sizeof(pattern))) != NULL && available - (marker - data) >= SYNC_HEADER_BYTES &&
+            !reassemblerIsSync(marker); )
+            ;
+
+        skip = marker != NULL ? (size_t)(marker - data) : available - (SYNC_MARKER_BYTES - 1);
+
+        ra->discarded += skip;
+        metricAdd(METRIC_DISCARDED, skip);
+        ra->tail += skip;
+
+        if (marker == NULL)
+            break;
+    }
+    return NULL;
+}
+
+/**
+* Returns a pointer to the next run of consecutive complete major frames within
+* the ring and stores the number of frames in count, or returns NULL when no
+* complete frame is buffered. Every frame of the run begins with a sync marker
+* and the run is contiguous in memory, so it can be scanned as one buffer.
+*
+* @param ra
+* @param count
+* @return char*
+*/
+char *reassemblerNextBatch(struct reassembler *ra, size_t *count)
+{
+    char *first;
+
+    *count = 0;
+
+    if ((first = reassemblerNext(ra)) == NULL)
+        return NULL;
+
+    *count = 1;
+
+    // Extends the run while the following buffered frame is aligned
+    while (ra->head - ra->tail >= MAJOR_FRAME_BYTES && reassemblerIsSync(first + *count * MAJOR_FRAME_BYTES))
+    {
+        ra->tail += MAJOR_FRAME_BYTES;
+        (*count)++;
+    }
+    return first;
+}
+
+#endif
@@ -0,0 +1,351 @@
+#ifndef RECV_H
+#define RECV_H
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "reassembler.h"
+
+/**
+* Receive backends for filling a link reassembler from its socket. The read
+* backend issues one read per fill. The recvmmsg backend splits the free space
+* of the ring into several message buffers and drains them with one recvmmsg
+* call, closing the gaps left by short messages so the ring stays contiguous.
+* The io_uring backend keeps a receive pre-posted into the free space of every
+* link and reaps completions in batches, so the kernel writes straight into the
+* ring and one io_uring_enter call covers many links. Call and byte counters
+* allow the backends to be compared per received frame.
+*
+* @author Vincent Nigro
+* @version 0.0.2
+*/
+
+#define RECV_VLEN 8
+#define RECV_CHUNK (8 * 1024)
+#define URING_ENTRIES 256
+
+enum recvBackend
+{
+    RECV_READ,
+    RECV_RECVMMSG,
+    RECV_URING,
+    RECV_SHM
+};
+
+struct recvStats
+{
+    unsigned long calls;
+    unsigned long waits;
+    unsigned long bytes;
+    unsigned long frames;
+};
+
+/**
+* The submission and completion rings of an io_uring instance mapped into
+* the process.
+*/
+struct uring
+{
+    int fd;
+    unsigned int *sqHead;
+    unsigned int *sqTail;
+    unsigned int *sqMask;
+    unsigned int *sqArray;
+    unsigned int *cqHead;
+    unsigned int *cqTail;
+    unsigned int *cqMask;
+    unsigned int pending;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sqRing;
+    void *cqRing;
+    size_t sqRingSize;
+    size_t cqRingSize;
+    size_t sqesSize;
+};
+
+int recvParseBackend(const char*, int*);
+const char *recvBackendName(int);
+ssize_t recvFill(int, struct reassembler*, int);
+ssize_t recvFillBatched(struct reassembler*, int);
+int uringInit(struct uring*, unsigned int);
+void uringFree(struct uring*);
+struct io_uring_sqe *uringGetSqe(struct uring*);
+int uringSubmit(struct uring*, unsigned int);
+struct io_uring_cqe *uringPeekCqe(struct uring*);
+void uringSeenCqe(struct uring*);
+
+struct recvStats recvCounters;
+
+/**
+* Parses a receive backend name, returning zero when it is not recognized.
+*
+* @param name
+* @param backend
+* @return int
+*/
+int recvParseBackend(const char *name, int *backend)
+{
+    if (strcmp(name, "read") == 0)
+        *backend = RECV_READ;
+    else if (strcmp(name, "recvmmsg") == 0)
+        *backend = RECV_RECVMMSG;
+    else if (strcmp(name, "uring") == 0)
+        *backend = RECV_URING;
+    else
+        return 0;
+
+    return 1;
+}
+
+/**
+* Returns the command line name of a receive backend.
+*
+* @param backend
+* @return const char*
+*/
+const char *recvBackendName(int backend)
+{
+    switch (backend)
+    {
+        case RECV_RECVMMSG:
+            return "recvmmsg";
+        case RECV_URING:
+            return "uring";
+        case RECV_SHM:
+            return "shm";
+        default:
+            return "read";
+    }
+}
+
+/**
+* Fills a reassembler from a socket with the read or recvmmsg backend,
+* returning the bytes received, zero at end of stream or -1 with errno set.
+*
+* @param backend
+* @param ra
+* @param fd
+* @return ssize_t
+*/
+ssize_t recvFill(int backend, struct reassembler *ra, int fd)
+{
+    ssize_t received;
+
+    recvCounters.calls++;
+
+    if (backend == RECV_RECVMMSG)
+        received = recvFillBatched(ra, fd);
+    else
+        received = reassemblerFill(ra, fd);
+
+    if (received > 0)
+    {
+        recvCounters.bytes += received;
+        metricAdd(METRIC_BYTES, received);
+    }
+
+    return received;
+}
+
+/**
+* Drains up to RECV_VLEN chunks of the ring free space with a single recvmmsg
+* call. A stream socket may fill a message only partially before the next one
+* is received, so later messages are moved down to follow the earlier ones.
+*
+* @param ra
+* @param fd
+* @return ssize_t
+*/
+ssize_t recvFillBatched(struct reassembler *ra, int fd)
+{
+    int received;
+    size_t total = 0, length;
+    struct iovec iov[RECV_VLEN];
+    struct mmsghdr msgs[RECV_VLEN];
+    char *spare = ra->base + (ra->head % ra->capacity);
+    size_t space = ra->capacity - (ra->head - ra->tail);
+    unsigned int vlen = 0;
+
+    if (space == 0)
+    {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    memset(msgs, 0, sizeof(msgs));
+
+    for (size_t offset = 0; offset < space && vlen < RECV_VLEN; offset += RECV_CHUNK, vlen++)
+    {
+        iov[vlen].iov_base = spare + offset;
+        iov[vlen].iov_len = space - offset < RECV_CHUNK ? space - offset : RECV_CHUNK;
+        msgs[vlen].msg_hdr.msg_iov = &iov[vlen];
+        msgs[vlen].msg_hdr.msg_iovlen = 1;
+    }
+
+    // Blocks for the first message at most, the rest only take queued data
+    if ((received = recvmmsg(fd, msgs, vlen, MSG_WAITFORONE, NULL)) == -1)
+        return -1;
+
+    for (int i = 0; i < received; i++)
+    {
+        length = msgs[i].msg_len;
+
+        // An empty message marks the end of the stream
+        if (length == 0)
+            break;
+
+        if ((char *)iov[i].iov_base != spare + total)
+            memmove(spare + total, iov[i].iov_base, length);
+
+        total += length;
+    }
+
+    ra->head += total;
+    return total;
+}
+
+/**
+* Creates an io_uring instance and maps its rings. Returns zero on success and
+* -1 with errno set when the kernel does not provide io_uring.
+*
+* @param ring
+* @param entries
+* @return int
+*/
+int uringInit(struct uring *ring, unsigned int entries)
+{
+    struct io_uring_params params;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&params, 0, sizeof(params));
+
+    if ((ring->fd = syscall(__NR_io_uring_setup, entries, &params)) == -1)
+        return -1;
+
+    ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->cqRing = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+
+    if (ring->sqRing == MAP_FAILED || ring->cqRing == MAP_FAILED || ring->sqes == MAP_FAILED)
+    {
+        uringFree(ring);
+        return -1;
+    }
+
+    ring->sqHead = (unsigned int *)((char *)ring->sqRing + params.sq_off.head);
+    ring->sqTail = (unsigned int *)((char *)ring->sqRing + params.sq_off.tail);
+    ring->sqMask = (unsigned int *)((char *)ring->sqRing + params.sq_off.ring_mask);
+    ring->sqArray = (unsigned int *)((char *)ring->sqRing + params.sq_off.array);
+    ring->cqHead = (unsigned int *)((char *)ring->cqRing + params.cq_off.head);
+    ring->cqTail = (unsigned int *)((char *)ring->cqRing + params.cq_off.tail);
+    ring->cqMask = (unsigned int *)((char *)ring->cqRing + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)((char *)ring->cqRing + params.cq_off.cqes);
+
+    return 0;
+}
+
+/**
+* Unmaps the rings of an io_uring instance and closes it.
+*
+* @param ring
+* @return void
+*/
+void uringFree(struct uring *ring)
+{
+    if (ring->sqRing != NULL && ring->sqRing != MAP_FAILED)
+        munmap(ring->sqRing, ring->sqRingSize);
+    if (ring->cqRing != NULL && ring->cqRing != MAP_FAILED)
+        munmap(ring->cqRing, ring->cqRingSize);
+    if (ring->sqes != NULL && ring->sqes != MAP_FAILED)
+        munmap(ring->sqes, ring->sqesSize);
+
+    close(ring->fd);
+}
+
+/**
+* Returns a cleared submission queue entry, or NULL when the queue is full.
+*
+* @param ring
+* @return struct io_uring_sqe*
+*/
+struct io_uring_sqe *uringGetSqe(struct uring *ring)
+{
+    struct io_uring_sqe *sqe;
+    unsigned int tail = *ring->sqTail;
+
+    if (tail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE) > *ring->sqMask)
+        return NULL;
+
+    sqe = &ring->sqes[tail & *ring->sqMask];
+    memset(sqe, 0, sizeof(*sqe));
+
+    ring->sqArray[tail & *ring->sqMask] = tail & *ring->sqMask;
+    __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+    ring->pending++;
+
+    return sqe;
+}
+
+/**
+* Submits the queued entries and waits for the given number of completions
+* with a single io_uring_enter call.
+*
+* @param ring
+* @param wait
+* @return int
+*/
+int uringSubmit(struct uring *ring, unsigned int wait)
+{
+    int submitted;
+
+    recvCounters.waits++;
+
+    if ((submitted = syscall(__NR_io_uring_enter, ring->fd, ring->pending, wait,
+        wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0)) == -1)
+        return -1;
+
+    ring->pending -= submitted;
+    return submitted;
+}
+
+/**
+* Returns the oldest unseen completion, or NULL when none are available.
+*
+* @param ring
+* @return struct io_uring_cqe*
+*/
+struct io_uring_cqe *uringPeekCqe(struct uring *ring)
+{
+    unsigned int head = *ring->cqHead;
+
+    if (head == __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE))
+        return NULL;
+
+    return &ring->cqes[head & *ring->cqMask];
+}
+
+/**
+* Marks the oldest completion as handled.
+*
+* @param ring
+* @return void
+*/
+void uringSeenCqe(struct uring *ring)
+{
+    __atomic_store_n(ring->cqHead, *ring->cqHead + 1, __ATOMIC_RELEASE);
+}
+
+#endif
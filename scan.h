@@ -0,0 +1,314 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+#include <string.h>
+#include <immintrin.h>
+#include "commands.h"
+
+/**
+* Minor frame scanning kernels. A receive buffer of minor frames is compared
+* against the header sync words, the END/KILL terminators and the alarm codes
+* in a single pass, producing one bitmask per 64 minor frames for each class
+* of word. AVX2 and SSE4.1 kernels compare several minor frames per
+* instruction; a scalar kernel is used when neither is available. The kernel
+* is selected once at runtime by scanInit.
+*
+* The alarm codes are the commands of ALARM severity in the dictionary, taken
+* by scanAlarms once it is loaded. The kernels always compare against
+* SCAN_MAX_ALARMS codes, unused ones repeating the first, so the comparisons
+* are unrolled; a dictionary of more alarms marks every minor frame as a
+* possible alarm instead, leaving the caller to look each one up.
+*
+* @author Vincent Nigro
+* @version 0.0.2
+*/
+
+#define SCAN_BLOCK_WORDS 64
+#define SCAN_BLOCKS(words) (((words) + SCAN_BLOCK_WORDS - 1) / SCAN_BLOCK_WORDS)
+#define SCAN_MAX_ALARMS 8
+
+/**
+* Bitmasks for a block of 64 minor frames, bit n describing minor frame n.
+*/
+struct scanMasks
+{
+    unsigned long header;
+    unsigned long stop;
+    unsigned long zero;
+    unsigned long alarm;
+};
+
+typedef void (*scanKernel)(const unsigned long*, size_t, struct scanMasks*);
+
+void scanInit();
+void scanAlarms();
+const char *scanKernelName();
+void scanScalar(const unsigned long*, size_t, struct scanMasks*);
+void scanSSE4(const unsigned long*, size_t, struct scanMasks*);
+void scanAVX2(const unsigned long*, size_t, struct scanMasks*);
+int scanNextSet(const struct scanMasks*, size_t, size_t, size_t);
+int scanNextClear(const struct scanMasks*, size_t, size_t, size_t);
+
+static scanKernel scanWords = scanScalar;
+static unsigned long scanAlarmCodes[SCAN_MAX_ALARMS];
+static int scanAlarmAll;
+
+/**
+* Selects the widest scanning kernel supported by the executing processor.
+*
+* @return void
+*/
+void scanInit()
+{
+    scanAlarms();
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+        scanWords = scanAVX2;
+    else if (__builtin_cpu_supports("sse4.1"))
+        scanWords = scanSSE4;
+    else
+        scanWords = scanScalar;
+}
+
+/**
+* Takes the alarm codes compared against from the commands of ALARM severity
+* in the dictionary. Called again once a dictionary has been loaded.
+*
+* @return void
+*/
+void scanAlarms()
+{
+    unsigned int count = 0;
+
+    scanAlarmAll = 0;
+
+    for (unsigned int i = 0; i < commandCount; i++)
+    {
+        if (commandTable[i].severity != SEVERITY_ALARM)
+            continue;
+
+        if (count == SCAN_MAX_ALARMS)
+        {
+            scanAlarmAll = 1;
+            break;
+        }
+        scanAlarmCodes[count++] = commandTable[i].code;
+    }
+
+    // Without any alarm the codes repeat a word no frame is expected to hold
+    for (unsigned int i = count; i < SCAN_MAX_ALARMS; i++)
+        scanAlarmCodes[i] = count > 0 ? scanAlarmCodes[0] : ~0UL;
+}
+
+/**
+* Returns the name of the selected scanning kernel.
+*
+* @return const char*
+*/
+const char *scanKernelName()
+{
+    if (scanWords == scanAVX2)
+        return "avx2";
+    if (scanWords == scanSSE4)
+        return "sse4";
+    return "scalar";
+}
+
+/**
+* Classifies a single minor frame and sets its bit in the block masks.
+*
+* @param word
+* @param bit
+* @param masks
+* @return void
+*/
+static inline void scanClassify(unsigned long word, unsigned long bit, struct scanMasks *masks)
+{
+    if (word == H1 || word == H2)
+        masks->header |= bit;
+    if (word == END || word == KILL)
+        masks->stop |= bit;
+    if (word == 0)
+        masks->zero |= bit;
+    if (scanAlarmAll)
+        masks->alarm |= bit;
+
+    for (unsigned int a = 0; a < SCAN_MAX_ALARMS; a++)
+    {
+        if (word == scanAlarmCodes[a])
+            masks->alarm |= bit;
+    }
+}
+
+/**
+* Portable kernel comparing one minor frame at a time.
+*
+* @param words
+* @param count
+* @param masks
+* @return void
+*/
+void scanScalar(const unsigned long *words, size_t count, struct scanMasks *masks)
+{
+    memset(masks, 0, SCAN_BLOCKS(count) * sizeof(*masks));
+
+    for (size_t i = 0; i < count; i++)
+        scanClassify(words[i], 1UL << (i % SCAN_BLOCK_WORDS), &masks[i / SCAN_BLOCK_WORDS]);
+}
+
+/**
+* SSE4.1 kernel comparing two minor frames per instruction.
+*
+* @param words
+* @param count
+* @param masks
+* @return void
+*/
+__attribute__((target("sse4.1")))
+void scanSSE4(const unsigned long *words, size_t count, struct scanMasks *masks)
+{
+    size_t i = 0;
+    __m128i v, hdr, stop, alarm;
+    const __m128i h1 = _mm_set1_epi64x(H1), h2 = _mm_set1_epi64x(H2);
+    const __m128i end = _mm_set1_epi64x(END), kill = _mm_set1_epi64x(KILL);
+    const __m128i zero = _mm_setzero_si128(), all = _mm_set1_epi64x(scanAlarmAll ? -1 : 0);
+    __m128i alarms[SCAN_MAX_ALARMS];
+
+    for (unsigned int a = 0; a < SCAN_MAX_ALARMS; a++)
+        alarms[a] = _mm_set1_epi64x(scanAlarmCodes[a]);
+
+    memset(masks, 0, SCAN_BLOCKS(count) * sizeof(*masks));
+
+    for (; i + 2 <= count; i += 2)
+    {
+        struct scanMasks *m = &masks[i / SCAN_BLOCK_WORDS];
+        unsigned int shift = i % SCAN_BLOCK_WORDS;
+
+        v = _mm_loadu_si128((const __m128i *)(words + i));
+        hdr = _mm_or_si128(_mm_cmpeq_epi64(v, h1), _mm_cmpeq_epi64(v, h2));
+        stop = _mm_or_si128(_mm_cmpeq_epi64(v, end), _mm_cmpeq_epi64(v, kill));
+        alarm = all;
+
+        #pragma GCC unroll 8
+        for (unsigned int a = 0; a < SCAN_MAX_ALARMS; a++)
+            alarm = _mm_or_si128(alarm, _mm_cmpeq_epi64(v, alarms[a]));
+
+        m->header |= (unsigned long)_mm_movemask_pd(_mm_castsi128_pd(hdr)) << shift;
+        m->stop |= (unsigned long)_mm_movemask_pd(_mm_castsi128_pd(stop)) << shift;
+        m->zero |= (unsigned long)_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(v, zero))) << shift;
+        m->alarm |= (unsigned long)_mm_movemask_pd(_mm_castsi128_pd(alarm)) << shift;
+    }
+
+    for (; i < count; i++)
+        scanClassify(words[i], 1UL << (i % SCAN_BLOCK_WORDS), &masks[i / SCAN_BLOCK_WORDS]);
+}
+
+/**
+* AVX2 kernel comparing four minor frames per instruction.
+*
+* @param words
+* @param count
+* @param masks
+* @return void
+*/
+__attribute__((target("avx2")))
+void scanAVX2(const unsigned long *words, size_t count, struct scanMasks *masks)
+{
+    size_t i = 0;
+    __m256i v, hdr, stop, alarm;
+    const __m256i h1 = _mm256_set1_epi64x(H1), h2 = _mm256_set1_epi64x(H2);
+    const __m256i end = _mm256_set1_epi64x(END), kill = _mm256_set1_epi64x(KILL);
+    const __m256i zero = _mm256_setzero_si256(), all = _mm256_set1_epi64x(scanAlarmAll ? -1 : 0);
+    __m256i alarms[SCAN_MAX_ALARMS];
+
+    for (unsigned int a = 0; a < SCAN_MAX_ALARMS; a++)
+        alarms[a] = _mm256_set1_epi64x(scanAlarmCodes[a]);
+
+    memset(masks, 0, SCAN_BLOCKS(count) * sizeof(*masks));
+
+    for (; i + 4 <= count; i += 4)
+    {
+        struct scanMasks *m = &masks[i / SCAN_BLOCK_WORDS];
+        unsigned int shift = i % SCAN_BLOCK_WORDS;
+
+        v = _mm256_loadu_si256((const __m256i *)(words + i));
+        hdr = _mm256_or_si256(_mm256_cmpeq_epi64(v, h1), _mm256_cmpeq_epi64(v, h2));
+        stop = _mm256_or_si256(_mm256_cmpeq_epi64(v, end), _mm256_cmpeq_epi64(v, kill));
+        alarm = all;
+
+        #pragma GCC unroll 8
+        for (unsigned int a = 0; a < SCAN_MAX_ALARMS; a++)
+            alarm = _mm256_or_si256(alarm, _mm256_cmpeq_epi64(v, alarms[a]));
+
+        m->header |= (unsigned long)_mm256_movemask_pd(_mm256_castsi256_pd(hdr)) << shift;
+        m->stop |= (unsigned long)_mm256_movemask_pd(_mm256_castsi256_pd(stop)) << shift;
+        m->zero |= (unsigned long)_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(v, zero))) << shift;
+        m->alarm |= (unsigned long)_mm256_movemask_pd(_mm256_castsi256_pd(alarm)) << shift;
+    }
+
+    for (; i < count; i++)
+        scanClassify(words[i], 1UL << (i % SCAN_BLOCK_WORDS), &masks[i / SCAN_BLOCK_WORDS]);
+}
+
+/**
+* Returns the position of the first minor frame in [from, to) whose bit is set
+* in the mask selected by offset (offsetof a scanMasks member), or to when no
+* such minor frame exists.
+*
+* @param masks
+* @param offset
+* @param from
+* @param to
+* @return int
+*/
+int scanNextSet(const struct scanMasks *masks, size_t offset, size_t from, size_t to)
+{
+    unsigned long bits;
+
+    while (from < to)
+    {
+        memcpy(&bits, (const char *)&masks[from / SCAN_BLOCK_WORDS] + offset, sizeof(bits));
+        bits &= ~0UL << (from % SCAN_BLOCK_WORDS);
+
+        if (bits)
+        {
+            from = (from & ~(size_t)(SCAN_BLOCK_WORDS - 1)) + __builtin_ctzl(bits);
+            return from < to ? from : to;
+        }
+        from = (from & ~(size_t)(SCAN_BLOCK_WORDS - 1)) + SCAN_BLOCK_WORDS;
+    }
+    return to;
+}
+
+/**
+* Returns the position of the first minor frame in [from, to) whose bit is
+* clear in the mask selected by offset, or to when every bit is set.
+*
+* @param masks
+* @param offset
+* @param from
+* @param to
+* @return int
+*/
+int scanNextClear(const struct scanMasks *masks, size_t offset, size_t from, size_t to)
+{
+    unsigned long bits;
+
+    while (from < to)
+    {
+        memcpy(&bits, (const char *)&masks[from / SCAN_BLOCK_WORDS] + offset, sizeof(bits));
+        bits = ~bits & (~0UL << (from % SCAN_BLOCK_WORDS));
+
+        if (bits)
+        {
+            from = (from & ~(size_t)(SCAN_BLOCK_WORDS - 1)) + __builtin_ctzl(bits);
+            return from < to ? from : to;
+        }
+        from = (from & ~(size_t)(SCAN_BLOCK_WORDS - 1)) + SCAN_BLOCK_WORDS;
+    }
+    return to;
+}
+
+#endif
@@ -0,0 +1,275 @@
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/prctl.h>
+#include "metrics.h"
+
+/**
+* Rate controlled frame scheduling for the simulator. Ticks are laid out on
+* absolute deadlines of the monotonic clock from the start of each phase, so
+* oversleeping one tick shortens the wait for the next rather than drifting the
+* rate, and the scheduler sleeps with clock_nanosleep in between instead of
+* burning a core. A tick releases a burst of frames sent back to back. An
+* optional spin margin sleeps until shortly before each deadline and spins on
+* the clock for the rest, trading CPU for precision below the timer slack,
+* which is itself lowered to a microsecond from its 50us default.
+*
+* A profile is a cycle of phases, each a rate in frames per second (or max for
+* no pacing) held for a number of seconds, e.g. 1000:2,50000:0.5 alternates
+* two seconds at 1000 frames/s with half a second bursts at 50000 frames/s.
+* The lateness of every tick is kept as jitter statistics and exported as the
+* jitter stage of the metrics.
+*
+* @author Vincent Nigro
+* @version 0.0.2
+*/
+
+#define SCHEDULE_MAX_PHASES 16
+#define SCHEDULE_DEFAULT_RATE 1000
+#define SCHEDULE_TIMER_SLACK_NS 1000
+
+/**
+* A rate held for a number of seconds, zero seconds holding it forever. A
+* negative rate sends without pacing.
+*/
+struct schedulePhase
+{
+    double rate;
+    double seconds;
+};
+
+struct scheduler
+{
+    struct schedulePhase phases[SCHEDULE_MAX_PHASES];
+    int phaseCount;
+    int phase;
+    unsigned int burst;
+    unsigned long spinNs;
+    unsigned long phaseStart;
+    unsigned long phaseTicks;
+    unsigned long ticks;
+    unsigned long late;
+    unsigned long maxLateness;
+    double sumLateness;
+    unsigned long buckets[METRIC_BUCKETS];
+};
+
+void sleepUntil(unsigned long);
+void scheduleInit(struct scheduler*, double, unsigned int, double);
+int scheduleParse(struct scheduler*, const char*);
+unsigned long scheduleDue(struct scheduler*, unsigned long);
+unsigned int scheduleTick(struct scheduler*, unsigned long, unsigned long);
+unsigned int scheduleWait(struct scheduler*);
+int scheduleUnpaced(const struct scheduler*);
+void scheduleReport(const struct scheduler*);
+
+/**
+* Sleeps until the monotonic clock reaches the given time in nanoseconds.
+*
+* @param when
+* @return void
+*/
+void sleepUntil(unsigned long when)
+{
+    struct timespec deadline = { when / 1000000000UL, when % 1000000000UL };
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR)
+        ;
+}
+
+/**
+* Sets up a scheduler holding a single rate, releasing burst frames per tick
+* and spinning for the last spinUs microseconds before each deadline.
+*
+* @param s
+* @param rate
+* @param burst
+* @param spinUs
+* @return void
+*/
+void scheduleInit(struct scheduler *s, double rate, unsigned int burst, double spinUs)
+{
+    memset(s, 0, sizeof(*s));
+
+    s->phases[0].rate = rate;
+    s->phaseCount = 1;
+    s->burst = burst > 0 ? burst : 1;
+    s->spinNs = spinUs * 1e3;
+
+    // Sleeps end within a microsecond of their deadline rather than 50us
+    prctl(PR_SET_TIMERSLACK, SCHEDULE_TIMER_SLACK_NS);
+}
+
+/**
+* Replaces the phases of a scheduler with a profile of comma separated
+* RATE:SECONDS phases, returning zero when the profile is invalid.
+*
+* @param s
+* @param profile
+* @return int
+*/
+int scheduleParse(struct scheduler *s, const char *profile)
+{
+    char *end;
+    const char *p = profile;
+    struct schedulePhase phase;
+
+    s->phaseCount = 0;
+
+    while (*p && s->phaseCount < SCHEDULE_MAX_PHASES)
+    {
+        if (strncmp(p, "max", 3) == 0)
+        {
+            phase.rate = -1;
+            end = (char *)p + 3;
+        }
+        else if ((phase.rate = strtod(p, &end)) <= 0 || end == p)
+            return 0;
+
+        if (*end != ':' || (phase.seconds = strtod(end + 1, &end)) <= 0)
+            return 0;
+
+        s->phases[s->phaseCount++] = phase;
+
+        if (*end == ',')
+            end++;
+        else if (*end)
+            return 0;
+
+        p = end;
+    }
+    return s->phaseCount > 0 && !*p;
+}
+
+/**
+* Returns the deadline of the next tick of the schedule, moving on to the
+* phase covering the current time first. Unpaced phases are always due.
+*
+* @param s
+* @param now
+* @return unsigned long
+*/
+unsigned long scheduleDue(struct scheduler *s, unsigned long now)
+{
+    const struct schedulePhase *phase;
+    unsigned long length;
+
+    if (s->phaseStart == 0)
+        s->phaseStart = now;
+
+    // Moves on to the phases covering the current time
+    while ((phase = &s->phases[s->phase])->seconds > 0 &&
+        now - s->phaseStart >= (length = phase->seconds * 1e9))
+    {
+        s->phaseStart += length;
+        s->phaseTicks = 0;
+        s->phase = (s->phase + 1) % s->phaseCount;
+    }
+
+    if (phase->rate < 0)
+        return now;
+
+    return s->phaseStart + (unsigned long)(s->phaseTicks * s->burst * 1e9 / phase->rate);
+}
+
+/**
+* Takes the tick due at the given deadline, woken at now, and returns the
+* number of frames to send for it, recording how late the tick was woken.
+*
+* @param s
+* @param due
+* @param now
+* @return unsigned int
+*/
+unsigned int scheduleTick(struct scheduler *s, unsigned long due, unsigned long now)
+{
+    unsigned long lateness = now > due ? now - due : 0;
+    double rate = s->phases[s->phase].rate;
+
+    if (rate < 0)
+        return s->burst;
+
+    s->phaseTicks++;
+
+    // A tick more than a period late has missed its slot
+    if (lateness * rate > s->burst * 1e9)
+    {
+        s->late++;
+        metricAdd(METRIC_LATE_TICKS, 1);
+    }
+
+    if (lateness > s->maxLateness)
+        s->maxLateness = lateness;
+
+    s->ticks++;
+    s->sumLateness += lateness;
+    s->buckets[metricBucket(lateness)]++;
+
+    if (metricState.enabled)
+        metricRecord(STAGE_JITTER, lateness, 1);
+
+    return s->burst;
+}
+
+/**
+* Waits for the next tick of the schedule and returns the number of frames to
+* send for it.
+*
+* @param s
+* @return unsigned int
+*/
+unsigned int scheduleWait(struct scheduler *s)
+{
+    unsigned long now = metricsNow(), due = scheduleDue(s, now);
+
+    if (due > now)
+    {
+        if (s->spinNs == 0)
+            sleepUntil(due);
+        else
+        {
+            if (due - now > s->spinNs)
+                sleepUntil(due - s->spinNs);
+
+            while (metricsNow() < due)
+                __builtin_ia32_pause();
+        }
+        now = metricsNow();
+    }
+    return scheduleTick(s, due, now);
+}
+
+/**
+* Returns whether the current phase sends without pacing.
+*
+* @param s
+* @return int
+*/
+int scheduleUnpaced(const struct scheduler *s)
+{
+    return s->phases[s->phase].rate < 0;
+}
+
+/**
+* Prints the jitter statistics of the paced ticks of a scheduler.
+*
+* @param s
+* @return void
+*/
+void scheduleReport(const struct scheduler *s)
+{
+    if (s->ticks == 0)
+        return;
+
+    printf("Paced %lu ticks of %u frames, lateness mean %.3f us, p50 %.3f us, p99 %.3f us, max %.3f us, "
+        "%lu ticks late.\n", s->ticks, s->burst, s->sumLateness / s->ticks / 1e3,
+        metricsBucketPercentile(s->buckets, s->ticks, s->maxLateness, 0.5) / 1e3,
+        metricsBucketPercentile(s->buckets, s->ticks, s->maxLateness, 0.99) / 1e3, s->maxLateness / 1e3, s->late);
+}
+
+#endif
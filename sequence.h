@@ -0,0 +1,97 @@
+#ifndef SEQUENCE_H
+#define SEQUENCE_H
+
+#include "metrics.h"
+
+/**
+* Sequence number accounting for a sender numbering what it sends from zero,
+* shared by the datagram transport and the frame trailers. The last
+* SEQUENCE_WINDOW sequence numbers are remembered so late arrivals filling a
+* gap are told apart from duplicates; gaps, the numbers missing in them, late
+* arrivals and duplicates are counted per sender and exported through three
+* consecutive metric counters, a late arrival taking its number back off the
+* missing ones.
+*
+* @author Vincent Nigro
+* @version 0.0.2
+*/
+
+#define SEQUENCE_WINDOW 64
+
+/**
+* Bit i of the window is set when number next - 1 - i has been received. The
+* malformed count is kept by the caller for units it could not number.
+*/
+struct sequence
+{
+    unsigned long next;
+    unsigned long window;
+    unsigned long received;
+    unsigned long missing;
+    unsigned long gaps;
+    unsigned long reordered;
+    unsigned long duplicates;
+    unsigned long malformed;
+};
+
+int sequenceTrack(struct sequence*, unsigned long, int);
+
+/**
+* Accounts for a received sequence number, returning zero for a duplicate
+* which should be dropped. Missing, reordered and duplicated numbers are added
+* to the metric counters missed, missed + 1 and missed + 2.
+*
+* @param s
+* @param seq
+* @param missed
+* @return int
+*/
+int sequenceTrack(struct sequence *s, unsigned long seq, int missed)
+{
+    unsigned long age, shift;
+
+    if (seq >= s->next)
+    {
+        if (seq > s->next)
+        {
+            s->gaps++;
+            s->missing += seq - s->next;
+            metricAdd(missed, seq - s->next);
+        }
+
+        shift = seq - s->next + 1;
+        s->window = shift >= SEQUENCE_WINDOW ? 0 : s->window << shift;
+        s->window |= 1;
+        s->next = seq + 1;
+        s->received++;
+        return 1;
+    }
+
+    age = s->next - 1 - seq;
+
+    if (age < SEQUENCE_WINDOW)
+    {
+        if ((s->window >> age) & 1)
+        {
+            s->duplicates++;
+            metricAdd(missed + 2, 1);
+            return 0;
+        }
+        s->window |= 1UL << age;
+    }
+
+    // A late arrival fills a gap counted earlier, taking it back off the missed counter
+    s->reordered++;
+    metricAdd(missed + 1, 1);
+
+    if (s->missing > 0)
+    {
+        s->missing--;
+        metricAdd(missed, -1UL);
+    }
+
+    s->received++;
+    return 1;
+}
+
+#endif
@@ -0,0 +1,336 @@
+#ifndef SHM_H
+#define SHM_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <immintrin.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "futex.h"
+#include "metrics.h"
+
+/**
+* A shared memory transport for a sim and mdp on the same host. The mdp
+* creates a POSIX shared memory segment holding a single-producer/single-
+* consumer ring of major frames; one sim at a time attaches to it, copies its
+* frames straight into the free slots and publishes each batch with a single
+* release store of the head. The mdp decodes the frames in place and releases
+* them by advancing the tail. Neither side makes a system call per frame: a
+* side finding the ring empty or full spins for a while and only then sleeps
+* on a futex, which the other side wakes only when a sleeper has announced
+* itself. The ring holds the pid of its producer, so a producer that exits
+* without detaching does not keep the ring from later ones.
+*
+* @author Vincent Nigro
+* @version 0.0.2
+*/
+
+#define SHM_MAGIC 0x4D485354U
+#define SHM_RING_BYTES (16 << 20)
+#define SHM_HEADER_BYTES 4096
+#define SHM_SPINS 256
+#define SHM_WAIT_NSEC 100000000L
+
+/**
+* The header at the start of the segment. Attached holds the pid of the
+* producer, zero when there is none. The producer and consumer indices live on
+* cache lines of their own next to the futex word the other side sleeps on.
+*/
+struct shmRing
+{
+    uint32_t magic;
+    uint32_t frameBytes;
+    uint64_t capacity;
+    atomic_int attached;
+    atomic_int closed;
+    _Alignas(64) atomic_ulong head;
+    atomic_uint consumerWaiting;
+    _Alignas(64) atomic_ulong tail;
+    atomic_uint producerWaiting;
+};
+
+struct shmStats
+{
+    unsigned long batches;
+    unsigned long waits;
+};
+
+struct shmStats shmCounters;
+
+struct shmRing *shmCreate(const char*, size_t);
+struct shmRing *shmAttach(const char*, size_t);
+void shmDestroy(const char*, struct shmRing*);
+void shmDetach(struct shmRing*);
+int shmOrphaned(struct shmRing*);
+void shmWrite(struct shmRing*, const struct iovec*, unsigned int);
+char *shmPeek(struct shmRing*, size_t*);
+void shmRelease(struct shmRing*, size_t);
+int shmAwait(struct shmRing*);
+
+/**
+* Returns the frame storage of a ring.
+*
+* @param ring
+* @return char*
+*/
+static inline char *shmFrames(struct shmRing *ring)
+{
+    return (char *)ring + SHM_HEADER_BYTES;
+}
+
+/**
+* Creates the named segment with a ring of as many frames of frameBytes as a
+* power of two allows within SHM_RING_BYTES. Returns NULL with errno set when
+* the segment cannot be created.
+*
+* @param name
+* @param frameBytes
+* @return struct shmRing*
+*/
+struct shmRing *shmCreate(const char *name, size_t frameBytes)
+{
+    int fd;
+    struct shmRing *ring;
+    uint64_t capacity = 1;
+
+    while (capacity * 2 * frameBytes <= SHM_RING_BYTES)
+        capacity *= 2;
+
+    shm_unlink(name);
+
+    if ((fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600)) == -1)
+        return NULL;
+
+    if (ftruncate(fd, SHM_HEADER_BYTES + capacity * frameBytes) == -1 ||
+        (ring = mmap(NULL, SHM_HEADER_BYTES + capacity * frameBytes, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, fd, 0)) == MAP_FAILED)
+    {
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+    close(fd);
+
+    ring->frameBytes = frameBytes;
+    ring->capacity = capacity;
+    atomic_store(&ring->attached, 0);
+    atomic_store(&ring->closed, 0);
+    atomic_store(&ring->head, 0);
+    atomic_store(&ring->tail, 0);
+    atomic_store(&ring->consumerWaiting, 0);
+    atomic_store(&ring->producerWaiting, 0);
+
+    // Producers check the magic word last
+    atomic_thread_fence(memory_order_release);
+    ring->magic = SHM_MAGIC;
+
+    return ring;
+}
+
+/**
+* Attaches to the named segment as its producer, returning NULL with errno set
+* when it does not exist, holds frames of another size or already has a
+* producer that is still running. Waits for the frames of a previous producer
+* to be consumed.
+*
+* @param name
+* @param frameBytes
+* @return struct shmRing*
+*/
+struct shmRing *shmAttach(const char *name, size_t frameBytes)
+{
+    int fd, producer = 0;
+    unsigned long tail;
+    struct stat st;
+    struct shmRing *ring;
+
+    if ((fd = shm_open(name, O_RDWR, 0)) == -1)
+        return NULL;
+
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < SHM_HEADER_BYTES ||
+        (ring = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0)) == MAP_FAILED)
+    {
+        close(fd);
+        return NULL;
+    }
+    close(fd);
+
+    if (ring->magic != SHM_MAGIC || ring->frameBytes != frameBytes ||
+        SHM_HEADER_BYTES + ring->capacity * frameBytes > (size_t)st.st_size)
+    {
+        munmap(ring, st.st_size);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    // A producer that exited without detaching is taken over
+    if (!atomic_compare_exchange_strong(&ring->attached, &producer, getpid()) &&
+        (kill(producer, 0) == 0 || errno != ESRCH ||
+            !atomic_compare_exchange_strong(&ring->attached, &producer, getpid())))
+    {
+        munmap(ring, st.st_size);
+        errno = EBUSY;
+        return NULL;
+    }
+
+    atomic_store(&ring->closed, 0);
+
+    // Frames of a previous producer are consumed before the first new one
+    while ((tail = atomic_load(&ring->tail)) != atomic_load(&ring->head))
+        shmCounters.waits += futexWait(&ring->producerWaiting, &ring->tail, tail, NULL, SHM_WAIT_NSEC);
+
+    return ring;
+}
+
+/**
+* Detaches the producer from a ring, waking the consumer so it notices.
+*
+* @param ring
+* @return void
+*/
+void shmDetach(struct shmRing *ring)
+{
+    atomic_store(&ring->closed, 1);
+    atomic_store(&ring->attached, 0);
+    futexWake(&ring->consumerWaiting);
+    munmap(ring, SHM_HEADER_BYTES + ring->capacity * ring->frameBytes);
+}
+
+/**
+* Returns whether the producer of a ring has exited without detaching, in
+* which case the ring is detached on its behalf.
+*
+* @param ring
+* @return int
+*/
+int shmOrphaned(struct shmRing *ring)
+{
+    int producer = atomic_load(&ring->attached);
+
+    return producer != 0 && kill(producer, 0) == -1 && errno == ESRCH &&
+        atomic_compare_exchange_strong(&ring->attached, &producer, 0);
+}
+
+/**
+* Unmaps and removes the named segment.
+*
+* @param name
+* @param ring
+* @return void
+*/
+void shmDestroy(const char *name, struct shmRing *ring)
+{
+    munmap(ring, SHM_HEADER_BYTES + ring->capacity * ring->frameBytes);
+    shm_unlink(name);
+}
+
+/**
+* Copies a batch of frames into the free slots of a ring and publishes them,
+* waiting for the consumer whenever the ring is full.
+*
+* @param ring
+* @param iov
+* @param count
+* @return void
+*/
+void shmWrite(struct shmRing *ring, const struct iovec *iov, unsigned int count)
+{
+    unsigned long head = atomic_load_explicit(&ring->head, memory_order_relaxed), tail;
+    unsigned int space, n, spins = 0;
+    char *frames = shmFrames(ring);
+
+    while (count > 0)
+    {
+        tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+        if ((space = ring->capacity - (head - tail)) == 0)
+        {
+            if (++spins < SHM_SPINS)
+            {
+                _mm_pause();
+                continue;
+            }
+
+            shmCounters.waits += futexWait(&ring->producerWaiting, &ring->tail, tail, NULL, SHM_WAIT_NSEC);
+            spins = 0;
+            continue;
+        }
+
+        for (n = count < space ? count : space; n > 0; n--, count--, iov++, head++)
+            memcpy(frames + (head & (ring->capacity - 1)) * ring->frameBytes, iov->iov_base, iov->iov_len);
+
+        atomic_store(&ring->head, head);
+        shmCounters.batches++;
+        futexWake(&ring->consumerWaiting);
+    }
+}
+
+/**
+* Returns the contiguous run of published frames at the tail of a ring along
+* with their count, or NULL when the ring is empty.
+*
+* @param ring
+* @param count
+* @return char*
+*/
+char *shmPeek(struct shmRing *ring, size_t *count)
+{
+    unsigned long tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    unsigned long head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    unsigned long offset = tail & (ring->capacity - 1);
+
+    if (head == tail)
+        return NULL;
+
+    // A run ends at the end of the storage
+    *count = head - tail < ring->capacity - offset ? head - tail : ring->capacity - offset;
+    return shmFrames(ring) + offset * ring->frameBytes;
+}
+
+/**
+* Releases frames at the tail of a ring back to the producer.
+*
+* @param ring
+* @param count
+* @return void
+*/
+void shmRelease(struct shmRing *ring, size_t count)
+{
+    atomic_store(&ring->tail, atomic_load_explicit(&ring->tail, memory_order_relaxed) + count);
+    futexWake(&ring->producerWaiting);
+}
+
+/**
+* Waits for frames to be published to an empty ring, spinning first and then
+* sleeping on the futex. Returns zero when the ring is still empty, after a
+* timeout, an interruption or the producer detaching.
+*
+* @param ring
+* @return int
+*/
+int shmAwait(struct shmRing *ring)
+{
+    unsigned long tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+    for (int i = 0; i < SHM_SPINS; i++)
+    {
+        if (atomic_load_explicit(&ring->head, memory_order_acquire) != tail)
+            return 1;
+
+        _mm_pause();
+    }
+
+    shmCounters.waits += futexWait(&ring->consumerWaiting, &ring->head, tail, &ring->closed, SHM_WAIT_NSEC);
+
+    return atomic_load_explicit(&ring->head, memory_order_acquire) != tail;
+}
+
+#endif
@@ -1,27 +1,83 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
 #include "commands.h"
+#include "logger.h"
+#include "archive.h"
+#include "metrics.h"
+#include "frame.h"
+#include "dictionary.h"
+#include "schedule.h"
+#include "constellation.h"
+#include "datagram.h"
+#include "shm.h"
+#include "integrity.h"
+#include <time.h>
 #include <arpa/inet.h>
 #include <sys/errno.h>
+#include <sys/uio.h>
 #include <netdb.h>
 #define SOCKADDR struct sockaddr
+#define REPLAY_BATCH 1024
+
+/**
+* Command line configuration of the sim client utility.
+*/
+struct options
+{
+    char *host;
+    int port;
+    double seconds;
+    int debug;
+    char *replay;
+    double speed;
+    char *dictionary;
+    char *health;
+    char *statsFile;
+    char *statsSocket;
+    double statsInterval;
+    int quiet;
+    double rate;
+    char *profile;
+    int burst;
+    double spin;
+    int stamp;
+    int frameSize;
+    int headerWidth;
+    int vehicles;
+    int threads;
+    int udp;
+    int datagramFrames;
+    char *shm;
+    int trailer;
+};
 
 static unsigned long frameCount = 1;
+static struct scheduler scheduler;
+static int stampFrames = 0;
+static unsigned long healthCode;
+static struct constellation constellation;
+static int socketType = SOCK_STREAM;
+static struct datagramSender sender;
+static struct shmRing *ring = NULL;
+static unsigned long frameSeq = 0;
 
 void argumentError();
 void sendData(int*, int*, double*);
-void generateHeader(unsigned long*);
+void sendReplay(int*, struct options*);
+int frameHasKill(const char*);
+void writeFrames(int, struct iovec*, int);
 void ipv6AddrConnection(int*, char*, int*);
 void setSockAddr(struct sockaddr_in*, char*, int*);
-void generateFinalMinorFrame(unsigned long*, int*);
 void setSock6Addr(struct sockaddr_in6*, char*, int*);
-void generateSOHCheck(char*, const unsigned long*, int*);
-void argumentHandler(int*, char**, char**, int*, double*, int*);
+void argumentHandler(int*, char**, struct options*);
 void ipv4AddrConnection(struct sockaddr_in*, int*, char*, int*);
 int simulateSOHActivity(int*, int*, double*, const unsigned long*);
 void establishConnection(struct addrinfo**, struct sockaddr_in*, int*, int*, int*, char*);
+void sendConstellation(struct addrinfo*, struct options*);
+unsigned int healthScenarios(char*, unsigned long*);
 
 /**
 * A simple implementation of a space vehicle acting as a client to a ground systems'
@@ -40,24 +96,131 @@ void establishConnection(struct addrinfo**, struct sockaddr_in*, int*, int*, int
 */
 int main(int argc, char **argv)
 {
-    double SEC = 0;
-    char *HOST = "";
     struct sockaddr_in servaddr;
     struct addrinfo hint, *res = NULL;
-    int socket_fd, conn_fd, PORT = -1, debug = 0, ret;
+    int socket_fd = -1, conn_fd, ret;
+    struct options opts = { "", -1, 0, 0, NULL, 1, NULL, "GOOD", NULL, NULL, 1, 0,
+        SCHEDULE_DEFAULT_RATE, NULL, 1, 0, 0, FRAME_SIZE, HEADER_WIDTH, 1, 1, 0, DATAGRAM_DEFAULT_FRAMES, NULL, 0 };
 
     // Processes and populates command line argument fields
-    argumentHandler(&argc, argv, &HOST, &PORT, &SEC, &debug);
+    argumentHandler(&argc, argv, &opts);
+
+    // Fixes the frame geometry shared with the MDP and its generation kernel
+    if (!geometrySet(opts.frameSize, opts.headerWidth))
+    {
+        printf("Frame size must exceed a header width of at least 2 and be at most %d.\n", FRAME_MAX_SIZE);
+        exit(1);
+    }
+
+    // Frame trailers carry a sequence number and CRC32C checked by the MDP
+    if (!geometryTrailer(opts.trailer))
+    {
+        printf("Frame trailers need %d minor frames after the header and final minor frame.\n",
+            FRAME_TRAILER_WORDS);
+        exit(1);
+    }
+    integrityInit();
+
+    // Compressed archive segments are replayed through the column kernels
+    columnarInit();
+
+    // Loads the telemetry dictionary the frame codes are taken from
+    if (opts.dictionary != NULL && dictionaryLoad(opts.dictionary) == -1)
+        exit(1);
+
+    // Vehicles take the comma separated health scenarios round robin
+    constellation.healthCount = healthScenarios(opts.health, constellation.healths);
+    healthCode = constellation.healths[0];
+    frameInit();
+
+    // Debug output is logged synchronously to stay ordered with frame dumps
+    loggerInit(opts.debug, opts.quiet);
+
+    // Frame pacing and latency stamping of the simulated frames
+    scheduleInit(&scheduler, opts.rate, opts.burst, opts.spin);
+
+    if (opts.profile != NULL && !scheduleParse(&scheduler, opts.profile))
+    {
+        printf("Invalid rate profile %s, expected RATE:SECONDS[,RATE:SECONDS...].\n", opts.profile);
+        exit(1);
+    }
+
+    if (opts.udp && !datagramFramesFit(opts.datagramFrames, frameGeometry.frameBytes))
+    {
+        printf("Datagrams hold 1 to %d frames of at most %d bytes together.\n", DATAGRAM_MAX_FRAMES,
+            DATAGRAM_MAX_BYTES);
+        exit(1);
+    }
+    socketType = opts.udp ? SOCK_DGRAM : SOCK_STREAM;
+
+    // Stamping needs room for STAMP, its operand and the final minor frame
+    stampFrames = opts.stamp &&
+        frameGeometry.frameSize - frameGeometry.headerWidth - frameGeometry.trailerWords >= 3;
+
+    // Exports throughput counters and stage latencies when requested
+    metricsInit("sim", opts.statsFile, opts.statsSocket, opts.statsInterval);
+
+    // A co-located MDP takes frames from its shared memory ring instead
+    if (opts.shm != NULL)
+    {
+        if ((ring = shmAttach(opts.shm, frameGeometry.frameBytes)) == NULL)
+        {
+            printf("Unable to attach to shared memory ring %s: %s.\n", opts.shm, strerror(errno));
+            exit(1);
+        }
+        printf("Have attached to MDP shared memory ring %s, preparing data dump sequence.\n", opts.shm);
+
+        if (opts.replay != NULL)
+            sendReplay(&socket_fd, &opts);
+        else
+            sendData(&socket_fd, &opts.debug, &opts.seconds);
+
+        printf("Published %lu batches with %lu waits.\n", shmCounters.batches, shmCounters.waits);
+        shmDetach(ring);
+        loggerShutdown();
+        metricsShutdown();
+        return 0;
+    }
 
     // Gets info about host address to be connected to
-    ret = getaddrinfo(HOST, NULL, &hint, &res);
+    ret = getaddrinfo(opts.host, NULL, &hint, &res);
+
+    // A constellation connects one socket per vehicle and sends from worker threads
+    if (opts.vehicles > 1 || opts.threads > 1)
+    {
+        if (ret)
+        {
+            printf("Invalid address: %s.\n", gai_strerror(ret));
+            exit(1);
+        }
+        sendConstellation(res, &opts);
+        freeaddrinfo(res);
+        loggerShutdown();
+        metricsShutdown();
+        return 0;
+    }
 
     // Attempts to establish connection to the host:port for determined protocol
-    establishConnection(&res, &servaddr, &ret, &socket_fd, &PORT, HOST);
+    establishConnection(&res, &servaddr, &ret, &socket_fd, &opts.port, opts.host);
     freeaddrinfo(res);
 
-    // Dumps binary data onto socket.
-    sendData(&socket_fd, &debug, &SEC);
+    // A connected datagram socket sends every datagram to the MDP
+    if (opts.udp)
+        datagramSenderInit(&sender, socket_fd, opts.datagramFrames);
+
+    // Dumps binary data onto socket, either recorded or simulated.
+    if (opts.replay != NULL)
+        sendReplay(&socket_fd, &opts);
+    else
+        sendData(&socket_fd, &opts.debug, &opts.seconds);
+
+    if (opts.udp)
+        printf("Sent %lu datagrams with %lu sendmmsg calls, %lu refused.\n", sender.seq, sender.calls,
+            sender.refused);
+
+    // Flushes all frame output still queued for the writer thread
+    loggerShutdown();
+    metricsShutdown();
 
     // close the socket
     close(socket_fd);
@@ -78,14 +241,258 @@ void sendData(int *fd, int *debug_mode, double *seconds)
 {
     int executing = 1;
 
+    // The simulation reports once it has sent the KILL command
     while (executing)
-        executing = simulateSOHActivity(fd, debug_mode, seconds, &GOOD);
+        executing = !simulateSOHActivity(fd, debug_mode, seconds, &healthCode);
+
+    scheduleReport(&scheduler);
+}
+
+/**
+* Replays the major frames of a recorded archive to the MDP server utility.
+* Segments are mapped read only and frames are sent in batches of up to
+* REPLAY_BATCH with writev, each iovec pointing at a frame inside the mapping,
+* so frame bytes are never copied in user space; compressed segments are
+* decoded a block at a time instead. Frames are paced by their
+* recorded receive times divided by the speed factor, or sent as fast as
+* possible with a speed of zero; a positive seconds value bounds the replay.
+* Recorded KILL frames are skipped so every link of the archive is replayed,
+* and the session is ended with a generated KILL frame. With trailers, an
+* archive recorded without them is refused and frames whose trailer does not
+* match are skipped, as the MDP would drop them.
+*
+* @param fd
+* @param opts
+* @return void
+*/
+void sendReplay(int *fd, struct options *opts)
+{
+    int kill = 1, batch = 0, replaying = 1;
+    struct archiveSet set;
+    struct archiveRecord *record;
+    struct iovec iov[REPLAY_BATCH];
+    unsigned long start, due, now, firstNs = 0, sent = 0, calls = 0, unsealed = 0;
+    unsigned long limit = opts->seconds * 1e9;
+    char buff[FRAME_MAX_SIZE * sizeof(unsigned long)];
+
+    if (archiveOpenSet(&set, opts->replay) == -1)
+    {
+        printf("Unable to open archive %s: %s.\n", opts->replay, strerror(errno));
+        exit(1);
+    }
+
+    printf("Replaying %lu frames from %zu archive segments at %s.\n", set.records, set.count,
+        opts->speed > 0 ? "recorded timing" : "full speed");
+
+    start = now = metricsNow();
+
+    for (size_t s = 0; replaying && s < set.count; s++)
+    {
+        for (unsigned long i = 0; replaying && i < set.segments[s].header->count; i++)
+        {
+            // Decoding the next block of a compressed segment replaces the batched records
+            if (batch > 0 && !archiveRecordCached(&set.segments[s], i))
+            {
+                writeFrames(*fd, iov, batch);
+                calls++;
+                batch = 0;
+            }
+
+            if ((record = archiveRecordAt(&set.segments[s], i)) == NULL)
+            {
+                printf("Skipping the rest of archive segment %u: %s.\n", set.segments[s].header->segment,
+                    strerror(errno));
+                break;
+            }
+
+            if (record->length != frameGeometry.frameBytes || frameHasKill(record->frame))
+                continue;
+
+            if (frameGeometry.trailerWords && !frameSealed(record->frame))
+            {
+                if (sent == 0)
+                {
+                    printf("Archive %s was recorded without frame trailers, replay it without --trailer.\n",
+                        opts->replay);
+                    exit(1);
+                }
+                unsealed++;
+                continue;
+            }
+
+            if (firstNs == 0)
+                firstNs = record->timestampNs;
+
+            // Frames already due go out together; otherwise flush and wait. Receive times are
+            // wall clock times, so one stepped back before the first is due at once
+            if (opts->speed > 0)
+            {
+                due = start + (record->timestampNs > firstNs ? record->timestampNs - firstNs : 0) / opts->speed;
+
+                if (due > now && (now = metricsNow()) < due)
+                {
+                    if (batch > 0)
+                    {
+                        writeFrames(*fd, iov, batch);
+                        calls++;
+                        batch = 0;
+                    }
+                    sleepUntil(due);
+                    now = due;
+                }
+            }
+
+            if (limit && now - start >= limit)
+            {
+                replaying = 0;
+                continue;
+            }
+
+            if (opts->debug)
+            {
+                printf("\nMajor Frame %lu Dump\n", frameCount);
+                printBits(frameGeometry.frameBytes, record->frame);
+            }
+
+            iov[batch].iov_base = record->frame;
+            iov[batch].iov_len = record->length;
+            frameCount++;
+            sent++;
+
+            // Recorded trailers are replayed as they are, the final KILL frame follows them
+            if (frameGeometry.trailerWords)
+            {
+                memcpy(&frameSeq, record->frame + (frameGeometry.frameSize - 2) * sizeof(unsigned long),
+                    sizeof(frameSeq));
+                frameSeq++;
+            }
+
+            if (++batch == REPLAY_BATCH)
+            {
+                writeFrames(*fd, iov, batch);
+                calls++;
+                batch = 0;
+
+                if (limit)
+                    now = metricsNow();
+            }
+        }
+    }
+
+    if (batch > 0)
+    {
+        writeFrames(*fd, iov, batch);
+        calls++;
+    }
+
+    // Ends the session since recorded KILL frames were not replayed
+    generateSOHCheck(buff, &healthCode, &kill);
+
+    if (frameGeometry.trailerWords)
+        sealFrame(buff, frameSeq++);
+
+    iov[0].iov_base = buff;
+    iov[0].iov_len = frameGeometry.frameBytes;
+    writeFrames(*fd, iov, 1);
+
+    if (socketType == SOCK_DGRAM)
+        datagramResend(&sender, DATAGRAM_KILL_COPIES - 1);
+
+    if (unsealed > 0)
+        printf("Skipped %lu frames without a matching trailer.\n", unsealed);
+
+    now = metricsNow();
+    printf("Replayed %lu frames in %.3f s with %lu writev calls: %.0f frames per second.\n",
+        sent, (now - start) / 1e9, calls, sent / ((now - start) / 1e9));
+
+    archiveCloseSet(&set);
+}
+
+/**
+* Determines whether any minor frame of a major frame is the KILL command.
+*
+* @param frame
+* @return int
+*/
+int frameHasKill(const char *frame)
+{
+    unsigned long minorFrame;
+
+    for (int i = 0; i < frameGeometry.frameSize; i++)
+    {
+        memcpy(&minorFrame, frame + i * sizeof(minorFrame), sizeof(minorFrame));
+
+        if (minorFrame == KILL)
+            return 1;
+    }
+    return 0;
+}
+
+/**
+* Writes every frame of an iovec batch, resuming after partial writes, sends
+* the batch as datagrams in UDP mode or copies it into the shared memory ring.
+* The write stage is timed per frame of the batch.
+*
+* @param fd
+* @param iov
+* @param count
+* @return void
+*/
+void writeFrames(int fd, struct iovec *iov, int count)
+{
+    ssize_t written;
+    int frames = count;
+    unsigned long start = metricStart();
+
+    if (ring != NULL)
+    {
+        shmWrite(ring, iov, count);
+        count = 0;
+    }
+    else if (socketType == SOCK_DGRAM)
+    {
+        datagramSend(&sender, iov, count);
+        count = 0;
+    }
+
+    while (count > 0)
+    {
+        if ((written = writev(fd, iov, count)) == -1)
+        {
+            if (errno == EINTR)
+                continue;
+
+            printf("writev call failed: %s.\n", strerror(errno));
+            exit(1);
+        }
+
+        // Skips the iovecs written in full and trims a partially written one
+        while (count > 0 && (size_t)written >= iov->iov_len)
+        {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+
+        if (count > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+
+    metricStop(STAGE_WRITE, start, frames);
+    metricAdd(METRIC_FRAMES, frames);
+    metricAdd(METRIC_BYTES, frames * frameGeometry.frameBytes);
 }
 
 /**
 * A basic timed simulation producing a continuous flow of SOH checks with some
 * passed health value and continuing to send this type of frame until the elapsed
-* time has exceeded the configured time reference, seconds.
+* time has exceeded the configured time reference, seconds. Frames come from a
+* pool generated up front and are sent with one writev per scheduler tick, or
+* per FRAME_POOL_FRAMES frames when unpaced; only the stamps are written per
+* frame, and the final KILL frame is generated over the first frame of the pool.
 *
 * @param fd
 * @param debug_mode
@@ -96,110 +503,164 @@ int simulateSOHActivity(int *fd, int *debug_mode,
         double *seconds, const unsigned long *health)
 {
     int finished = 0;
-    clock_t start, end;
-    double elapsed = 0;
-    unsigned long command;
-    char buff[FRAME_SIZE * sizeof(unsigned long)];
+    char *frame;
+    unsigned int pending, batch;
+    unsigned long stage, start;
+    struct framePool pool;
+    struct iovec iov[FRAME_POOL_FRAMES];
 
-    start = clock();
+    if (framePoolInit(&pool, health, FRAME_POOL_FRAMES) == -1)
+    {
+        printf("Unable to allocate frame pool.\n");
+        exit(1);
+    }
+
+    start = metricsNow();
 
     while (!finished)
     {
-        bzero(&buff, sizeof(buff));
+        // Waits for the next tick of the schedule, unpaced phases send whole pools
+        pending = scheduleWait(&scheduler);
 
-        delay(1); // Necessary to prevent infinite loop.
-        end = clock();
-        elapsed = ((double)(end - start)) / CLOCKS_PER_SEC;
+        if (scheduleUnpaced(&scheduler))
+            pending = pool.count;
 
-        if (elapsed >= *seconds)
-            finished = 1;
+        while (!finished && pending > 0)
+        {
+            batch = pending < pool.count ? pending : pool.count;
+
+            // The first frame past the time limit ends the session on its own
+            if ((metricsNow() - start) / 1e9 >= *seconds)
+            {
+                finished = 1;
+                batch = 1;
+            }
 
-        generateSOHCheck(buff, health, &finished);
-        write(*fd, buff, sizeof(buff));
+            stage = metricStart();
 
-        // If statement prevents printout of dump that is never sent.
-        if (!finished)
-        {
-            if (*debug_mode)
+            for (unsigned int i = 0; i < batch; i++)
             {
-                printf("\nMajor Frame %lu Dump\n", frameCount);
-                printBits(sizeof(buff), buff);
+                frame = framePoolFrame(&pool, i);
+
+                // The KILL frame is generated afresh, a stamp left in its slot would be stale
+                if (finished)
+                    generateSOHCheck(frame, health, &finished);
+                else if (stampFrames)
+                    stampFrame(frame);
+
+                if (frameGeometry.trailerWords)
+                    sealFrame(frame, frameSeq++);
+
+                iov[i].iov_base = frame;
+                iov[i].iov_len = frameGeometry.frameBytes;
+            }
+            metricStop(STAGE_GENERATE, stage, batch);
+
+            writeFrames(*fd, iov, batch);
+            pending -= batch;
+
+            // Copies of the final datagram make the KILL frame survive a loss
+            if (finished && socketType == SOCK_DGRAM)
+                datagramResend(&sender, DATAGRAM_KILL_COPIES - 1);
+
+            // If statement prevents printout of dump that is never sent.
+            for (unsigned int i = 0; !finished && i < batch; i++)
+            {
+                if (*debug_mode)
+                {
+                    printf("\nMajor Frame %lu Dump\n", frameCount);
+                    printBits(frameGeometry.frameBytes, framePoolFrame(&pool, i));
+                }
+                logRecord(LOG_FRAME_SENT, 0, frameCount++, NULL);
             }
-            printf("Major Frame %lu has been sent to MDP.\n", frameCount++);
         }
     }
+
+    framePoolFree(&pool);
     return finished;
 }
 
 /**
-* A simulated SOH telemetry frame for a simple spacecraft language definition.
-* The SOH check frame is repeated over the entire frame in case of lost minor
-* frames occur.
+* Parses the comma separated health commands a vehicle is given round robin
+* into their codes, returning their number.
 *
-* @param buffer
-* @param health
-* @param kill
-* @return void
+* @param names
+* @param healths
+* @return unsigned int
 */
-void generateSOHCheck(char *buffer, const unsigned long *health, int *kill)
+unsigned int healthScenarios(char *names, unsigned long *healths)
 {
-    generateHeader((unsigned long *)buffer);
-    int minorFrameCount = 0;
+    unsigned int count = 0;
+    char *name, *save;
 
-    // Loops through each minor frame remaining in major frame.
-    for (unsigned long *cmdItr = (unsigned long *)
-            (buffer + (sizeof(unsigned long) * HEADER_WIDTH));
-                minorFrameCount < (FRAME_SIZE - HEADER_WIDTH); cmdItr++)
+    for (name = strtok_r(names, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save))
     {
-        if (minorFrameCount == (FRAME_SIZE - HEADER_WIDTH) - 1)
-            generateFinalMinorFrame(cmdItr, kill);
-        else if (minorFrameCount % 2 == 0)
-            memcpy(cmdItr, &SOH, sizeof(*cmdItr));
-        else
-            memcpy(cmdItr, health, sizeof(*cmdItr));
+        if (dictionaryFind(name) == NULL)
+        {
+            printf("Health command %s is not in the dictionary.\n", name);
+            exit(1);
+        }
 
-        minorFrameCount++;
+        if (count == CONSTELLATION_MAX_SCENARIOS)
+        {
+            printf("At most %d health scenarios can be given.\n", CONSTELLATION_MAX_SCENARIOS);
+            exit(1);
+        }
+        healths[count++] = dictionaryCode(name, GOOD);
     }
+
+    if (count == 0)
+    {
+        printf("No health command given.\n");
+        exit(1);
+    }
+    return count;
 }
 
 /**
-* Generates a basic header of some predefined header length of a repeated pattern.
-* The header is captured and removed by the MDP server utility.
+* Connects one socket per vehicle to the MDP and runs the constellation over
+* them, each vehicle ending its own stream with a KILL frame.
 *
-* @param buffer
+* @param res
+* @param opts
 * @return void
 */
-void generateHeader(unsigned long *buffer)
+void sendConstellation(struct addrinfo *res, struct options *opts)
 {
-    int headerCount = 0;
+    struct sockaddr_in servaddr;
+    int *fds;
 
-    // Creates header width by iterating through minor frames.
-    for (unsigned long *cmdItr = buffer;
-            headerCount < HEADER_WIDTH; cmdItr++)
+    if ((fds = malloc(opts->vehicles * sizeof(*fds))) == NULL)
     {
-        if (headerCount % 2 == 0)
-            memcpy(cmdItr, &H1, sizeof(*cmdItr));
-        else
-            memcpy(cmdItr, &H2, sizeof(*cmdItr));
+        printf("Unable to allocate %d vehicle sockets.\n", opts->vehicles);
+        exit(1);
+    }
+
+    printf("Attempting to connect %d vehicles to %s:%d...\n", opts->vehicles, opts->host, opts->port);
 
-        headerCount++;
+    for (int i = 0; i < opts->vehicles; i++)
+    {
+        if (res->ai_family == AF_INET)
+            ipv4AddrConnection(&servaddr, &fds[i], opts->host, &opts->port);
+        else if (res->ai_family == AF_INET6)
+            ipv6AddrConnection(&fds[i], opts->host, &opts->port);
+        else
+        {
+            printf("%s is an unknown address format %d\n", opts->host, res->ai_family);
+            exit(1);
+        }
     }
-}
+    printf("Have connected to MDP, preparing data dump sequence.\n");
 
-/**
-* Generates the final minor frame for a major frame and signals either
-* the end of the frame or the end of the communications.
-*
-* @param cmdBuffer
-* @param kill
-* @return void
-*/
-void generateFinalMinorFrame(unsigned long *cmdBuffer, int *kill)
-{
-    if (*kill)
-        memcpy(cmdBuffer, &KILL, sizeof(*cmdBuffer));
-    else
-        memcpy(cmdBuffer, &END, sizeof(*cmdBuffer));
+    constellation.vehicleCount = opts->vehicles;
+    constellation.threadCount = opts->threads < opts->vehicles ? opts->threads : opts->vehicles;
+    constellation.seconds = opts->seconds;
+    constellation.stamp = stampFrames;
+    constellation.debug = opts->debug;
+    constellation.scheduler = scheduler;
+
+    constellationRun(&constellation, fds);
+    free(fds);
 }
 
 /**
@@ -249,28 +710,91 @@ void establishConnection(struct addrinfo **res, struct sockaddr_in *adr,
 *
 * @param argc
 * @param argv
-* @param host
-* @param port
-* @param sec
-* @param dbg
+* @param opts
 * @return void
 */
-void argumentHandler(int *argc, char **argv, char **host, int *port, double *sec, int *dbg)
+void argumentHandler(int *argc, char **argv, struct options *opts)
 {
     // Must pass parameters containing host, port, and seconds to open socket interface.
     if (*argc < 4)
         argumentError();
 
-    // Handle special case arguments
-    if (*argc == 5)
+    // Handle any optional arguments following the seconds
+    for (int i = 4; i < *argc; i++)
     {
-        if (strcmp(argv[4], "--debug") == 0)
-            *dbg = 1;
+        if (strcmp(argv[i], "--debug") == 0)
+            opts->debug = 1;
+        else if (strcmp(argv[i], "--replay") == 0 && i + 1 < *argc)
+            opts->replay = argv[++i];
+        else if (strcmp(argv[i], "--speed") == 0 && i + 1 < *argc)
+            opts->speed = atof(argv[++i]);
+        else if (strcmp(argv[i], "--stats") == 0 && i + 1 < *argc)
+            opts->statsFile = argv[++i];
+        else if (strcmp(argv[i], "--stats-socket") == 0 && i + 1 < *argc)
+            opts->statsSocket = argv[++i];
+        else if (strcmp(argv[i], "--stats-interval") == 0 && i + 1 < *argc)
+            opts->statsInterval = atof(argv[++i]);
+        else if (strcmp(argv[i], "--quiet") == 0)
+            opts->quiet = 1;
+        else if (strcmp(argv[i], "--dictionary") == 0 && i + 1 < *argc)
+            opts->dictionary = argv[++i];
+        else if (strcmp(argv[i], "--health") == 0 && i + 1 < *argc)
+            opts->health = argv[++i];
+        else if (strcmp(argv[i], "--rate") == 0 && i + 1 < *argc)
+        {
+            // max sends frames back to back, a rate paces them per second
+            if (strcmp(argv[++i], "max") == 0)
+                opts->rate = -1;
+            else if ((opts->rate = atof(argv[i])) <= 0)
+                argumentError();
+        }
+        else if (strcmp(argv[i], "--profile") == 0 && i + 1 < *argc)
+            opts->profile = argv[++i];
+        else if (strcmp(argv[i], "--burst") == 0 && i + 1 < *argc)
+        {
+            if ((opts->burst = atoi(argv[++i])) < 1)
+                argumentError();
+        }
+        else if (strcmp(argv[i], "--spin") == 0 && i + 1 < *argc)
+            opts->spin = atof(argv[++i]);
+        else if (strcmp(argv[i], "--stamp") == 0)
+            opts->stamp = 1;
+        else if (strcmp(argv[i], "--frame-size") == 0 && i + 1 < *argc)
+            opts->frameSize = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--header-width") == 0 && i + 1 < *argc)
+            opts->headerWidth = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--udp") == 0)
+            opts->udp = 1;
+        else if (strcmp(argv[i], "--datagram-frames") == 0 && i + 1 < *argc)
+            opts->datagramFrames = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--shm") == 0 && i + 1 < *argc)
+            opts->shm = argv[++i];
+        else if (strcmp(argv[i], "--trailer") == 0)
+            opts->trailer = 1;
+        else if (strcmp(argv[i], "--vehicles") == 0 && i + 1 < *argc)
+        {
+            if ((opts->vehicles = atoi(argv[++i])) < 1 || opts->vehicles > CONSTELLATION_MAX_VEHICLES)
+                argumentError();
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < *argc)
+        {
+            if ((opts->threads = atoi(argv[++i])) < 1 || opts->threads > CONSTELLATION_MAX_THREADS)
+                argumentError();
+        }
+        else
+            argumentError();
     }
 
-    *host = argv[1];
-    *port = atoi(argv[2]);
-    *sec = atof(argv[3]);
+    // Replays record a single link and constellations stream over TCP
+    if ((opts->replay != NULL || opts->udp || opts->shm != NULL) && (opts->vehicles > 1 || opts->threads > 1))
+        argumentError();
+
+    if (opts->udp && opts->shm != NULL)
+        argumentError();
+
+    opts->host = argv[1];
+    opts->port = atoi(argv[2]);
+    opts->seconds = atof(argv[3]);
 }
 
 /**
@@ -303,7 +827,7 @@ void setSockAddr(struct sockaddr_in *adr, char *host, int *port)
 void ipv4AddrConnection(struct sockaddr_in *adr, int *sock_fd, char *host, int *port)
 {
     // socket creation with IPV4  & SOCK_STREAM (TCP)
-    if ((*sock_fd = socket(AF_INET, SOCK_STREAM, 0)) == -1)
+    if ((*sock_fd = socket(AF_INET, socketType, 0)) == -1)
     {
         printf("BSD socket call failed: %s.\n", strerror(errno));
         exit(1);
@@ -354,7 +878,7 @@ void ipv6AddrConnection(int *sock_fd, char *host, int *port)
     struct sockaddr_in6 servaddr_6;
 
     // socket creation with IPV6  & SOCK_STREAM (TCP)
-    if ((*sock_fd = socket(AF_INET6, SOCK_STREAM, 0)) == -1)
+    if ((*sock_fd = socket(AF_INET6, socketType, 0)) == -1)
     {
         printf("BSD socket call failed: %s.\n", strerror(errno));
         exit(1);
@@ -385,6 +909,16 @@ void argumentError()
     printf("Need the following arguments 1: HOST 2: PORT 3: SEC\n");
     printf("./sim 127.0.0.1 8080 45\n");
     printf("./sim ::1 8080 45\n");
-    printf("./sim 127.0.0.1 8080 45 --debug");
+    printf("./sim 127.0.0.1 8080 45 --debug\n");
+    printf("./sim 127.0.0.1 8080 0 --replay DIR|SEGMENT [--speed N]\n");
+    printf("./sim 127.0.0.1 8080 45 --stats FILE [--stats-socket PATH] [--stats-interval 1]\n");
+    printf("./sim 127.0.0.1 8080 45 --quiet --rate N|max --stamp\n");
+    printf("./sim 127.0.0.1 8080 45 --rate N [--burst N] [--spin US] [--profile RATE:SEC,...]\n");
+    printf("./sim 127.0.0.1 8080 45 --frame-size 32 [--header-width 4]\n");
+    printf("./sim 127.0.0.1 8080 45 --dictionary FILE [--health NAME[,NAME...]]\n");
+    printf("./sim 127.0.0.1 8080 45 --vehicles N [--threads M]\n");
+    printf("./sim 127.0.0.1 8080 45 --udp [--datagram-frames 8]\n");
+    printf("./sim 127.0.0.1 8080 45 --shm NAME\n");
+    printf("./sim 127.0.0.1 8080 45 --trailer\n");
     exit(1);
 }